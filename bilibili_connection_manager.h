@@ -0,0 +1,14 @@
+#pragma once
+#include "bili_packet.h"
+#include <mutex>
+#include <unordered_map>
+#include <cstdio>
+#include <atomic>
+namespace vNerve::bilibili {
+class bilibili_connection_manager {
+public:
+  std::mutex m; std::unordered_map<int,int> last; std::atomic<long> total{0}; long bad = 0;
+  void on_room_data(int room, const borrowed_message* msg) {
+    std::lock_guard g(m); auto& l = last[room]; if (msg->seq != l + 1) bad++; l = msg->seq; total++; }
+};
+}
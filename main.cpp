@@ -0,0 +1,20 @@
+#include "parse_pool.h"
+#include "bilibili_connection_manager.h"
+#include <thread>
+using namespace vNerve::bilibili;
+int main() {
+  bilibili_connection_manager mgr;
+  long expected = 0;
+  {
+    parse_pool pool(mgr, 4);
+    std::vector<std::thread> shards;
+    for (int s = 0; s < 3; s++) shards.emplace_back([&, s] {
+      auto prod = pool.create_producer(); std::unordered_map<int,int> seq;
+      for (int i = 0; i < 300000; i++) { int room = s * 1000 + (i % 50 == 0 ? i % 997 : 7); int v = ++seq[room];
+        unsigned char b[8]; std::memcpy(b, &v, 4); pool.submit(*prod, room, b, 4); }
+    });
+    for (auto& t : shards) t.join();
+    expected = 900000;
+  }  // destructor drains
+  std::printf("total=%ld expected=%ld bad=%ld\n", mgr.total.load(), expected, mgr.bad);
+}
@@ -0,0 +1,360 @@
+#include "bench_corpus.h"
+
+#include <boost/asio/detail/socket_ops.hpp>
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#include <zlib.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+
+namespace vNerve::bilibili::bench
+{
+using boost::asio::detail::socket_ops::host_to_network_long;
+using boost::asio::detail::socket_ops::host_to_network_short;
+using boost::asio::detail::socket_ops::network_to_host_long;
+using boost::asio::detail::socket_ops::network_to_host_short;
+
+const size_t PACKET_HEADER_SIZE = 16;
+const uint32_t JSON_MESSAGE_OP_CODE = 5;
+
+// 弹幕、用户名、牌子等文本的样本，混合了中文、emoji 与 ASCII。
+const char* const danmaku_texts[] = {
+    "哈哈哈哈哈哈哈",
+    "草",
+    "awsl",
+    "？？？",
+    "晚上好",
+    "主播今天播到几点",
+    "好耶！",
+    "8888888888",
+    "这波操作太秀了吧",
+    "前方高能预警 🎉🎉🎉",
+    "kksk",
+    "来了来了",
+    "这个BGM叫什么名字啊",
+    "2333333",
+    "下次一定",
+    "第一次看直播，关注了",
+    "你们都是怎么发出彩色弹幕的",
+    "好可爱 (*^▽^*)",
+};
+const char* const user_names[] = {
+    "路过的咸鱼", "bilibili_user_20200101", "夜猫子不睡觉", "一只小透明", "Kazami", "吃瓜群众甲",
+    "momo酱", "今天也要加油鸭", "键盘侠本侠", "星河滚烫", "xX_SniperKing_Xx", "三分钟热度",
+};
+const char* const medal_names[] = {"鸽子", "咸鱼", "奶糖", "小狐狸", "电池", "猫咪"};
+const char* const streamer_names[] = {"某科学的主播", "今天不鸽", "VirtualStreamer", "一只夜猫"};
+const char* const gift_names[] = {"辣条", "小心心", "粉丝团灯牌", "牛哇牛哇", "打call", "小花花"};
+const char* const superchat_texts[] = {
+    "主播辛苦了，早点休息！",
+    "第一次打SC，请问下首歌可以唱千本樱吗",
+    "生日快乐！！！祝越来越好 🎂",
+};
+
+class corpus_generator
+{
+private:
+    std::mt19937 _random;
+
+    template <typename T, size_t N>
+    const T& pick(const T (&values)[N]) { return values[_random() % N]; }
+    unsigned long long between(const unsigned long long min, const unsigned long long max)
+    {
+        return std::uniform_int_distribution<unsigned long long>(min, max)(_random);
+    }
+    std::string uid() { return std::to_string(between(10000, 3000000000ull)); }
+    std::string timestamp() { return std::to_string(between(1600000000, 1700000000)); }
+
+public:
+    explicit corpus_generator(const uint32_t seed) : _random(seed) {}
+
+    std::string danmu_msg()
+    {
+        auto medal = _random() % 3 != 0;
+        return std::string("{\"cmd\":\"DANMU_MSG\",\"info\":[[0,1,25,16777215,") + timestamp() + "000,"
+               + std::to_string(between(0, 2000000000)) + ",0,\"b3d4f2a1\",0,0,0,\"\",0,\"{}\",\"{}\"],\""
+               + pick(danmaku_texts) + "\",[" + uid() + ",\"" + pick(user_names) + "\",0,0,0,10000,1,\"\"],"
+               + (medal ? std::string("[") + std::to_string(between(1, 30)) + ",\"" + pick(medal_names) + "\",\""
+                              + pick(streamer_names) + "\"," + std::to_string(between(1000, 30000000)) + ",0,"
+                              + std::to_string(between(0, 16777215)) + ",0,6809855,398668,6850801,0,1,"
+                              + uid() + "]"
+                        : std::string("[]"))
+               + ",[" + std::to_string(between(0, 60)) + ",0,9868950,\">50000\",0],[\"\",\"\"],0,"
+               + std::to_string(between(0, 3)) + ",null,{\"ts\":" + timestamp()
+               + ",\"ct\":\"5B0A2E1F\"},0,0,null,null,0,105]}";
+    }
+    std::string interact_word()
+    {
+        return std::string("{\"cmd\":\"INTERACT_WORD\",\"data\":{\"contribution\":{\"grade\":0},\"dmscore\":12,"
+                           "\"fans_medal\":{\"anchor_roomid\":0,\"guard_level\":0,\"icon_id\":0,\"is_lighted\":0,"
+                           "\"medal_color\":0,\"medal_level\":0,\"medal_name\":\"\",\"score\":0,\"special\":\"\","
+                           "\"target_id\":0},\"identities\":[1],\"is_spread\":0,\"msg_type\":1,\"roomid\":")
+               + std::to_string(between(1000, 30000000)) + ",\"score\":" + timestamp() + "000,\"spread_desc\":\"\","
+               + "\"timestamp\":" + timestamp() + ",\"uid\":" + uid() + ",\"uname\":\"" + pick(user_names)
+               + "\",\"uname_color\":\"\"}}";
+    }
+    std::string send_gift()
+    {
+        auto num = between(1, 10);
+        auto price = between(0, 1) ? 100 : 0;
+        return std::string("{\"cmd\":\"SEND_GIFT\",\"data\":{\"action\":\"投喂\",\"batch_combo_id\":\"\","
+                           "\"coin_type\":\"")
+               + (price ? "gold" : "silver") + "\",\"face\":\"http://i0.hdslb.com/bfs/face/member/noface.jpg\","
+               + "\"giftId\":" + std::to_string(between(1, 31000)) + ",\"giftName\":\"" + pick(gift_names)
+               + "\",\"giftType\":5,\"medal_info\":{\"anchor_roomid\":0,\"anchor_uname\":\"" + pick(streamer_names)
+               + "\",\"guard_level\":0,\"medal_color\":" + std::to_string(between(0, 16777215))
+               + ",\"medal_level\":" + std::to_string(between(0, 30)) + ",\"medal_name\":\"" + pick(medal_names)
+               + "\",\"target_id\":" + uid() + "},\"num\":" + std::to_string(num)
+               + ",\"price\":" + std::to_string(price) + ",\"rnd\":\"" + timestamp()
+               + "\",\"timestamp\":" + timestamp() + ",\"total_coin\":" + std::to_string(num * price)
+               + ",\"uid\":" + uid() + ",\"uname\":\"" + pick(user_names) + "\"}}";
+    }
+    std::string online_rank_count()
+    {
+        return "{\"cmd\":\"ONLINE_RANK_COUNT\",\"data\":{\"count\":" + std::to_string(between(10, 50000)) + "}}";
+    }
+    std::string like_click()
+    {
+        return std::string("{\"cmd\":\"LIKE_INFO_V3_CLICK\",\"data\":{\"show_area\":0,\"msg_type\":6,"
+                           "\"like_icon\":\"https://i0.hdslb.com/bfs/live/23678e3d90402bea6a65251b3e728044c21b1f0f.png\","
+                           "\"uid\":")
+               + uid() + ",\"like_text\":\"为主播点赞了\",\"uname\":\"" + pick(user_names)
+               + "\",\"uname_color\":\"\",\"identities\":[1],\"dmscore\":20}}";
+    }
+    std::string watched_change()
+    {
+        auto count = between(100, 1000000);
+        return "{\"cmd\":\"WATCHED_CHANGE\",\"data\":{\"num\":" + std::to_string(count) + ",\"text_small\":\""
+               + std::to_string(count) + "\",\"text_large\":\"" + std::to_string(count) + "人看过\"}}";
+    }
+    std::string entry_effect()
+    {
+        return std::string("{\"cmd\":\"ENTRY_EFFECT\",\"data\":{\"id\":4,\"uid\":") + uid()
+               + ",\"target_id\":" + uid() + ",\"mock_effect\":0,\"face\":\"https://i0.hdslb.com/bfs/face/member/noface.jpg\","
+               + "\"privilege_type\":3,\"copy_writing\":\"欢迎舰长 <%" + pick(user_names)
+               + "%> 进入直播间\",\"copy_color\":\"#ffffff\",\"highlight_color\":\"#E6FF00\",\"priority\":70,"
+               + "\"trigger_time\":" + timestamp() + "000000000,\"identities\":3,\"effect_silent_time\":0}}";
+    }
+    std::string super_chat_message()
+    {
+        auto start = between(1600000000, 1700000000);
+        return std::string("{\"cmd\":\"SUPER_CHAT_MESSAGE\",\"data\":{\"background_color\":\"#EDF5FF\",\"id\":")
+               + std::to_string(between(1, 9000000)) + ",\"message\":\"" + pick(superchat_texts)
+               + "\",\"price\":30,\"time\":60,\"start_time\":" + std::to_string(start)
+               + ",\"end_time\":" + std::to_string(start + 60) + ",\"token\":\"A1B2C3D4\",\"uid\":" + uid()
+               + ",\"medal_info\":{\"anchor_roomid\":" + std::to_string(between(1000, 30000000))
+               + ",\"anchor_uname\":\"" + pick(streamer_names) + "\",\"medal_color\":6126494,\"medal_level\":"
+               + std::to_string(between(1, 30)) + ",\"medal_name\":\"" + pick(medal_names)
+               + "\",\"target_id\":" + uid() + "},\"user_info\":{\"face\":\"http://i0.hdslb.com/bfs/face/member/noface.jpg\","
+               + "\"guard_level\":0,\"is_main_vip\":0,\"is_svip\":0,\"is_vip\":0,\"manager\":0,\"title\":\"0\","
+               + "\"uname\":\"" + pick(user_names) + "\",\"user_level\":" + std::to_string(between(1, 60)) + "}}}";
+    }
+    std::string guard_buy()
+    {
+        auto start = between(1600000000, 1700000000);
+        return std::string("{\"cmd\":\"GUARD_BUY\",\"data\":{\"uid\":") + uid() + ",\"username\":\""
+               + pick(user_names) + "\",\"guard_level\":3,\"num\":1,\"price\":198000,\"gift_id\":10003,"
+               + "\"gift_name\":\"舰长\",\"start_time\":" + std::to_string(start)
+               + ",\"end_time\":" + std::to_string(start) + "}}";
+    }
+
+    ///
+    /// 按比例随机生成一条消息：进房 35%，弹幕 30%，礼物 15%，点赞 8%，其余为低频的 cmd。
+    std::string next()
+    {
+        auto roll = _random() % 1000;
+        if (roll < 350)
+            return interact_word();
+        if (roll < 650)
+            return danmu_msg();
+        if (roll < 800)
+            return send_gift();
+        if (roll < 880)
+            return like_click();
+        if (roll < 930)
+            return online_rank_count();
+        if (roll < 960)
+            return watched_change();
+        if (roll < 985)
+            return entry_effect();
+        if (roll < 995)
+            return super_chat_message();
+        return guard_buy();
+    }
+};
+
+std::vector<std::string> generate_corpus(const size_t count, const uint32_t seed)
+{
+    corpus_generator generator(seed);
+    std::vector<std::string> messages;
+    messages.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        messages.push_back(generator.next());
+    return messages;
+}
+
+namespace
+{
+std::string inflate_all(const unsigned char* data, const size_t size)
+{
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK)
+        throw std::runtime_error("inflateInit failed");
+    std::string result;
+    unsigned char chunk[64 * 1024];
+    stream.next_in = const_cast<unsigned char*>(data);
+    stream.avail_in = static_cast<uInt>(size);
+    int status;
+    do
+    {
+        stream.next_out = chunk;
+        stream.avail_out = sizeof(chunk);
+        status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END)
+        {
+            inflateEnd(&stream);
+            throw std::runtime_error("Bad zlib-compressed packet in capture");
+        }
+        result.append(reinterpret_cast<char*>(chunk), sizeof(chunk) - stream.avail_out);
+    } while (status != Z_STREAM_END);
+    inflateEnd(&stream);
+    return result;
+}
+
+std::string brotli_decompress_all(const unsigned char* data, size_t size)
+{
+    auto state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    std::string result;
+    BrotliDecoderResult status;
+    do
+    {
+        size_t available = 0;
+        status = BrotliDecoderDecompressStream(state, &size, &data, &available, nullptr, nullptr);
+        size_t output_size = 0;
+        auto output = BrotliDecoderTakeOutput(state, &output_size);
+        result.append(reinterpret_cast<const char*>(output), output_size);
+    } while (status == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    BrotliDecoderDestroyInstance(state);
+    if (status != BROTLI_DECODER_RESULT_SUCCESS)
+        throw std::runtime_error("Bad brotli-compressed packet in capture");
+    return result;
+}
+
+void split_stream(const std::string& stream, std::vector<std::string>& messages)
+{
+    auto data = reinterpret_cast<const unsigned char*>(stream.data());
+    size_t offset = 0;
+    while (stream.size() - offset >= PACKET_HEADER_SIZE)
+    {
+        uint32_t length;
+        uint16_t protocol_version;
+        uint32_t op_code;
+        std::memcpy(&length, data + offset, 4);
+        std::memcpy(&protocol_version, data + offset + 6, 2);
+        std::memcpy(&op_code, data + offset + 8, 4);
+        length = network_to_host_long(length);
+        protocol_version = network_to_host_short(protocol_version);
+        op_code = network_to_host_long(op_code);
+        if (length < PACKET_HEADER_SIZE || length > stream.size() - offset)
+            throw std::runtime_error("Truncated packet in capture");
+
+        auto payload = data + offset + PACKET_HEADER_SIZE;
+        auto payload_size = length - PACKET_HEADER_SIZE;
+        if (protocol_version == 2)
+            split_stream(inflate_all(payload, payload_size), messages);
+        else if (protocol_version == 3)
+            split_stream(brotli_decompress_all(payload, payload_size), messages);
+        else if (op_code == JSON_MESSAGE_OP_CODE)
+            messages.emplace_back(reinterpret_cast<const char*>(payload), payload_size);
+        offset += length;
+    }
+}
+}  // namespace
+
+std::vector<std::string> read_capture(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Can't open capture: " + path);
+    std::string stream((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<std::string> messages;
+    split_stream(stream, messages);
+    return messages;
+}
+
+std::vector<std::string> load_corpus(const int argc, char** argv, const size_t generated_count)
+{
+    if (argc > 1)
+        return read_capture(argv[1]);
+    return generate_corpus(generated_count);
+}
+
+std::string make_packet(const std::string& payload, const uint16_t protocol_version, const uint32_t op_code)
+{
+    unsigned char header[PACKET_HEADER_SIZE];
+    auto length = host_to_network_long(static_cast<uint32_t>(PACKET_HEADER_SIZE + payload.size()));
+    auto header_length = host_to_network_short(PACKET_HEADER_SIZE);
+    auto version = host_to_network_short(protocol_version);
+    auto op = host_to_network_long(op_code);
+    auto sequence = host_to_network_long(1);
+    std::memcpy(header, &length, 4);
+    std::memcpy(header + 4, &header_length, 2);
+    std::memcpy(header + 6, &version, 2);
+    std::memcpy(header + 8, &op, 4);
+    std::memcpy(header + 12, &sequence, 4);
+    return std::string(reinterpret_cast<char*>(header), PACKET_HEADER_SIZE) + payload;
+}
+
+std::string make_stream(const std::vector<std::string>& messages, const uint16_t protocol_version,
+                        const size_t bundle_size)
+{
+    std::string stream;
+    for (size_t i = 0; i < messages.size(); i += bundle_size)
+    {
+        std::string bundle;
+        for (size_t j = i; j < messages.size() && j < i + bundle_size; j++)
+            bundle += make_packet(messages[j], 0, JSON_MESSAGE_OP_CODE);
+        if (protocol_version == 2)
+            stream += make_packet(zlib_compress(bundle), 2, JSON_MESSAGE_OP_CODE);
+        else if (protocol_version == 3)
+            stream += make_packet(brotli_compress(bundle), 3, JSON_MESSAGE_OP_CODE);
+        else
+            stream += bundle;
+    }
+    return stream;
+}
+
+std::string zlib_compress(const std::string& data)
+{
+    auto size = compressBound(static_cast<uLong>(data.size()));
+    std::string result(size, '\0');
+    if (compress(reinterpret_cast<Bytef*>(result.data()), &size,
+                 reinterpret_cast<const Bytef*>(data.data()), static_cast<uLong>(data.size()))
+        != Z_OK)
+        throw std::runtime_error("compress failed");
+    result.resize(size);
+    return result;
+}
+
+std::string brotli_compress(const std::string& data)
+{
+    auto size = BrotliEncoderMaxCompressedSize(data.size());
+    std::string result(size, '\0');
+    if (!BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               data.size(), reinterpret_cast<const uint8_t*>(data.data()),
+                               &size, reinterpret_cast<uint8_t*>(result.data())))
+        throw std::runtime_error("BrotliEncoderCompress failed");
+    result.resize(size);
+    return result;
+}
+
+void keep(const void* value)
+{
+    static const void* volatile sink;
+    sink = value;
+}
+}  // namespace vNerve::bilibili::bench
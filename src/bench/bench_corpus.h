@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vNerve::bilibili::bench
+{
+///
+/// 读取基准测试的语料：一条条消息的 json。
+/// 命令行第一个参数为抓包文件时从中读取，否则按常见的 cmd 比例生成 generated_count 条消息。
+std::vector<std::string> load_corpus(int argc, char** argv, size_t generated_count = 20000);
+///
+/// 按热门直播间中常见的 cmd 比例生成消息。相同的种子总是生成相同的消息。
+std::vector<std::string> generate_corpus(size_t count, uint32_t seed = 1);
+///
+/// 读取抓包文件。文件内容为从弹幕服务器收到的原始字节流，即若干首尾相接的数据包；
+/// 压缩的数据包会被解压，只保留 json 消息。
+/// @throw std::runtime_error 文件无法读取或格式错误时抛出。
+std::vector<std::string> read_capture(const std::string& path);
+
+///
+/// 生成一个数据包（16 字节头部 + payload）。
+std::string make_packet(const std::string& payload, uint16_t protocol_version, uint32_t op_code);
+///
+/// 把消息按每 bundle_size 条一组打包成数据包流，与服务器推送的格式相同。
+/// protocol_version 为 0 时每条消息单独成包；为 2/3 时每组消息拼接后用 zlib/brotli 压缩成一个数据包。
+std::string make_stream(const std::vector<std::string>& messages, uint16_t protocol_version, size_t bundle_size);
+
+std::string zlib_compress(const std::string& data);
+std::string brotli_compress(const std::string& data);
+
+///
+/// 阻止编译器优化掉基准测试的结果。
+void keep(const void* value);
+
+///
+/// 运行 rounds 轮，返回最快一轮的耗时（秒）。
+template <typename Function>
+double best_of(const int rounds, Function&& function)
+{
+    double best = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+    return best;
+}
+}  // namespace vNerve::bilibili::bench
@@ -0,0 +1,100 @@
+// 对比 cmd 分发的两种做法：
+// robin_hood - 原来的做法，把 cmd 拷贝进 std::string，在 unordered_map<string, function> 中 find 一次、operator[] 一次；
+// perfect    - bili_json 现在的做法，编译期生成的完美哈希表，以 string_view 查找，表项为函数指针。
+// 两边登记的 cmd 与 BILI_COMMANDS 相同，处理函数什么也不做，测得的只是分发本身。
+// 用法：bench_cmd_dispatch [抓包文件]
+
+#include "bench_corpus.h"
+#include "perfect_hash.h"
+
+#include <robin_hood.h>
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace vNerve::bilibili;
+
+const int ROUNDS = 20;
+const int REPEAT = 50;
+
+size_t handled = 0;
+
+bool count_message(const char* json)
+{
+    bench::keep(json);
+    handled++;
+    return true;
+}
+
+struct entry
+{
+    std::string_view name;
+    bool (*handler)(const char*) = nullptr;
+};
+
+constexpr entry commands[] = {
+    {"DANMU_MSG", count_message},
+    {"SUPER_CHAT_MESSAGE", count_message},
+    {"SEND_GIFT", count_message},
+    {"GUARD_BUY", count_message},
+};
+constexpr perfect_hash_table<entry, sizeof(commands) / sizeof(entry)> command_table(commands);
+
+// rapidjson 给出的 cmd 是以 '\0' 结尾的字符串与长度，这里从 json 中取出同样的形式。
+std::vector<std::string> extract_cmds(const std::vector<std::string>& messages)
+{
+    const char key[] = "\"cmd\":\"";
+    std::vector<std::string> cmds;
+    for (auto& message : messages)
+    {
+        auto begin = message.find(key);
+        if (begin == std::string::npos)
+            continue;
+        begin += sizeof(key) - 1;
+        cmds.push_back(message.substr(begin, message.find('"', begin) - begin));
+    }
+    return cmds;
+}
+
+int main(int argc, char** argv)
+{
+    auto cmds = extract_cmds(bench::load_corpus(argc, argv));
+
+    robin_hood::unordered_map<std::string, std::function<bool(const char*)>> command;
+    for (auto& registered : commands)
+        command[std::string(registered.name)] = count_message;
+
+    size_t robin_hood_handled = 0, perfect_handled = 0;
+    auto robin_hood_seconds = bench::best_of(ROUNDS, [&] {
+        handled = 0;
+        for (int i = 0; i < REPEAT; i++)
+            for (auto& value : cmds)
+            {
+                std::string cmd(value.c_str(), value.size());
+                if (command.find(cmd) != command.end())
+                    command[cmd](value.c_str());
+            }
+        robin_hood_handled = handled;
+    });
+    auto perfect_seconds = bench::best_of(ROUNDS, [&] {
+        handled = 0;
+        for (int i = 0; i < REPEAT; i++)
+            for (auto& value : cmds)
+            {
+                auto index = command_table.index_of(std::string_view(value.c_str(), value.size()));
+                if (index != command_table.npos)
+                    command_table.slot(index).handler(value.c_str());
+            }
+        perfect_handled = handled;
+    });
+
+    auto lookups = static_cast<double>(cmds.size()) * REPEAT;
+    std::printf("%zu messages, %zu handled per pass\n", cmds.size(), perfect_handled / REPEAT);
+    std::printf("  robin_hood: %6.1f ns/message (%zu handled)\n", robin_hood_seconds / lookups * 1e9, robin_hood_handled);
+    std::printf("  perfect:    %6.1f ns/message (%zu handled)\n", perfect_seconds / lookups * 1e9, perfect_handled);
+    return 0;
+}
@@ -0,0 +1,45 @@
+// 对比 protover 0（不压缩）、2（zlib）、3（brotli）的线路字节数与处理速度。
+// 数据包流经 handle_buffer、handle_packet 与每线程的解压上下文，与 bilibili_connection 相同；
+// json 由 null_serializer 清点而不解析，三种协议的解析开销相同，不计入。
+// 用法：bench_decompress [抓包文件]
+
+#include "bench_corpus.h"
+#include "bili_packet.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace vNerve::bilibili;
+
+const size_t BUNDLE_SIZE = 10;  // 服务器每个压缩包中的消息条数与房间热度有关，常见为数条到数十条。
+const int ROUNDS = 10;
+
+int main(int argc, char** argv)
+{
+    spdlog::set_level(spdlog::level::warn);
+    auto messages = bench::load_corpus(argc, argv);
+    size_t json_bytes = 0;
+    for (auto& message : messages)
+        json_bytes += message.size();
+    auto json_mib = static_cast<double>(json_bytes) / (1024 * 1024);
+    std::printf("%zu messages, %.2f MiB of json, %zu messages per compressed packet\n",
+                messages.size(), json_mib, BUNDLE_SIZE);
+
+    for (uint16_t protocol_version : {0, 2, 3})
+    {
+        auto stream = bench::make_stream(messages, protocol_version, BUNDLE_SIZE);
+        std::vector<unsigned char> buffer(stream.begin(), stream.end());
+        buffer.resize(stream.size() + json_padding);
+
+        size_t handled = 0;
+        auto seconds = bench::best_of(ROUNDS, [&] {
+            handled = 0;
+            handle_buffer(buffer.data(), stream.size(), json_padding, stream.size(), 0, 1,
+                          [&handled](const borrowed_message* message) { handled += message->count; });
+        });
+        std::printf("protover=%u: %9zu wire bytes (%5.1f%%), %zu messages, %8.1f MiB/s of json, %6.2f M messages/s\n",
+                    protocol_version, stream.size(), 100.0 * stream.size() / json_bytes, handled,
+                    json_mib / seconds, handled / seconds / 1e6);
+    }
+    return 0;
+}
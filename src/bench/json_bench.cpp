@@ -0,0 +1,59 @@
+// serialize_buffer 的吞吐量，包括指纹、json 解析与 protobuf 编码。
+// CMake 用两个 json 后端各编译一份：bench_json_rapidjson 与 bench_json_simdjson，对同一份语料运行即可对比。
+// 每条消息先复制到缓冲区再解析（rapidjson 原地解析会改写数据），两个后端都计入这次复制。
+// 用法：bench_json_<后端> [抓包文件]
+
+#include "bench_corpus.h"
+#include "bili_json.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace vNerve::bilibili;
+
+const int ROUNDS = 10;
+const unsigned int ROOM_ID = 1;
+
+int main(int argc, char** argv)
+{
+    spdlog::set_level(spdlog::level::warn);
+    check_message_schema();
+    auto messages = bench::load_corpus(argc, argv);
+    size_t json_bytes = 0, max_size = 0;
+    for (auto& message : messages)
+    {
+        json_bytes += message.size();
+        max_size = std::max(max_size, message.size());
+    }
+    std::vector<char> buffer(max_size + json_padding);
+
+    size_t serialized = 0, encoded_bytes = 0;
+    auto seconds = bench::best_of(ROUNDS, [&] {
+        serialized = encoded_bytes = 0;
+        for (auto& message : messages)
+        {
+            std::memcpy(buffer.data(), message.data(), message.size());
+            buffer[message.size()] = '\0';
+            if (auto result = serialize_buffer(buffer.data(), message.size(), ROOM_ID, buffer.size() - message.size()))
+            {
+                serialized++;
+                encoded_bytes += result->size();
+            }
+        }
+    });
+
+#if defined(VNERVE_JSON_SIMDJSON)
+    const char* backend = "simdjson";
+#else
+    const char* backend = "rapidjson";
+#endif
+    std::printf("%s: %zu messages (%.2f MiB), %zu serialized into %zu bytes\n",
+                backend, messages.size(), json_bytes / (1024.0 * 1024), serialized, encoded_bytes);
+    std::printf("  %7.1f ns/message, %8.1f MiB/s of json\n",
+                seconds / messages.size() * 1e9, json_bytes / (1024.0 * 1024) / seconds);
+    return 0;
+}
@@ -0,0 +1,45 @@
+// 拆包与解压的基准测试用它代替 bili_json.cpp：只清点消息条数，不解析 json，
+// 测得的是传输层本身的开销。
+#include "bench_corpus.h"
+#include "bili_json.h"
+
+namespace vNerve::bilibili
+{
+thread_local borrowed_message null_message;
+thread_local int batch_depth = 0;
+thread_local size_t batch_count = 0;
+
+const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int&, size_t)
+{
+    bench::keep(buf);
+    if (batch_depth)
+    {
+        batch_count++;
+        return nullptr;
+    }
+    null_message._data = reinterpret_cast<unsigned char*>(buf);
+    null_message._length = length;
+    null_message.count = 1;
+    return &null_message;
+}
+
+void begin_batch()
+{
+    if (!batch_depth++)
+        batch_count = 0;
+}
+
+const borrowed_message* end_batch()
+{
+    if (--batch_depth || !batch_count)
+        return nullptr;
+    null_message._data = nullptr;
+    null_message._length = 0;
+    null_message.count = batch_count;
+    return &null_message;
+}
+
+void set_command_filter(const std::vector<std::string>&, const std::vector<std::string>&) {}
+
+void check_message_schema() {}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,101 @@
+// 对比两种读取缓冲区：
+// linear   - 原来的做法，每次读取后把不完整的数据包 memmove 回缓冲区开头；
+// mirrored - bilibili_connection 现在的做法，双重映射的环形缓冲区，不搬运数据。
+// 读取按 TCP 分段模拟：每次读取到 1~8 个 1448 字节的分段，与数据包边界无关。
+// 用法：bench_read_buffer [抓包文件]
+
+#include "bench_corpus.h"
+#include "bili_packet.h"
+#include "mirrored_buffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+using namespace vNerve::bilibili;
+
+const size_t READ_BUFFER_SIZE = 128 * 1024;  // 默认的 read-buffer。
+const size_t SEGMENT_SIZE = 1448;
+const int ROUNDS = 5;
+
+struct read_result
+{
+    size_t packets = 0;
+    size_t copied_bytes = 0;
+};
+
+template <typename Reader>
+read_result replay(const std::string& stream, Reader&& reader)
+{
+    std::mt19937 random(1);
+    read_result result;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        auto size = std::min<size_t>(SEGMENT_SIZE * (1 + random() % 8), stream.size() - offset);
+        offset += reader(stream.data() + offset, size, result);
+    }
+    return result;
+}
+
+read_result replay_linear(const std::string& stream, std::vector<unsigned char>& buffer)
+{
+    size_t filled = 0, skipping = 0;
+    return replay(stream, [&](const char* data, size_t size, read_result& result) -> size_t {
+        size = std::min(size, READ_BUFFER_SIZE - filled);
+        std::memcpy(buffer.data() + filled, data, size);  // async_receive
+        filled += size;
+        auto [consumed, next_skipping] = split_buffer(
+            buffer.data(), filled, READ_BUFFER_SIZE, skipping,
+            [&result](unsigned char* packet, size_t) { result.packets++; bench::keep(packet); });
+        skipping = next_skipping;
+        filled -= consumed;
+        if (filled)
+        {
+            std::memmove(buffer.data(), buffer.data() + consumed, filled);
+            result.copied_bytes += filled;
+        }
+        return size;
+    });
+}
+
+read_result replay_mirrored(const std::string& stream, const mirrored_buffer& buffer)
+{
+    size_t head = 0, filled = 0, skipping = 0;
+    return replay(stream, [&](const char* data, size_t size, read_result& result) -> size_t {
+        size = std::min(size, buffer.size() - filled);
+        std::memcpy(buffer.at(head + filled), data, size);  // async_receive
+        filled += size;
+        auto [consumed, next_skipping] = split_buffer(
+            buffer.at(head), filled, buffer.size(), skipping,
+            [&result](unsigned char* packet, size_t) { result.packets++; bench::keep(packet); });
+        skipping = next_skipping;
+        head = (head + consumed) % buffer.size();
+        filled -= consumed;
+        return size;
+    });
+}
+
+int main(int argc, char** argv)
+{
+    spdlog::set_level(spdlog::level::warn);
+    auto messages = bench::load_corpus(argc, argv);
+    // 缓冲区在连接的整个生命周期中复用，不计入创建的开销。
+    std::vector<unsigned char> linear_buffer(READ_BUFFER_SIZE + 1);
+    mirrored_buffer ring_buffer(READ_BUFFER_SIZE);
+    for (uint16_t protocol_version : {0, 2})
+    {
+        auto stream = bench::make_stream(messages, protocol_version, 8);
+        auto mib = static_cast<double>(stream.size()) / (1024 * 1024);
+        std::printf("protover=%u: %zu messages, %.2f MiB on the wire\n", protocol_version, messages.size(), mib);
+
+        read_result linear, mirrored;
+        auto linear_seconds = bench::best_of(ROUNDS, [&] { linear = replay_linear(stream, linear_buffer); });
+        auto mirrored_seconds = bench::best_of(ROUNDS, [&] { mirrored = replay_mirrored(stream, ring_buffer); });
+        std::printf("  linear:   %zu packets, %10.0f bytes copied/MiB, %8.1f MiB/s\n",
+                    linear.packets, linear.copied_bytes / mib, mib / linear_seconds);
+        std::printf("  mirrored: %zu packets, %10.0f bytes copied/MiB, %8.1f MiB/s\n",
+                    mirrored.packets, mirrored.copied_bytes / mib, mib / mirrored_seconds);
+    }
+    return 0;
+}
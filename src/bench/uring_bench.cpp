@@ -0,0 +1,330 @@
+// 对比两种接收方式在大量安静连接下的开销：
+// reactor - 原来的做法，每个连接一个 async_receive 与自己的读缓冲区，每次读取前由 epoll 等待可读；
+// uring   - io-uring 模式，每个连接一次 multishot 接收，数据读入共用的缓冲区环，心跳一起提交。
+// 本机的模拟服务器（子进程）接受全部连接后，按固定速率向随机的连接推送数据包，到时间后关闭全部连接。
+// 两种方式各收一轮相同的数据，并按 40 秒一圈的时间轮发送心跳；比较接收线程的 CPU 时间。
+// 用法：bench_uring [连接数=10000] [秒数=10] [每秒数据包数=20000]
+
+#include "bench_corpus.h"
+#include "bili_packet.h"
+#include "mirrored_buffer.h"
+#include "uring_context.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace vNerve::bilibili;
+
+const size_t READ_BUFFER_SIZE = 128 * 1024;  // 默认的 read-buffer。
+const size_t URING_BUFFER_SIZE = 16 * 1024;   // 默认的 io-uring-buffer-size。
+const unsigned URING_BUFFERS = 1024;          // 默认的 io-uring-buffers。
+const unsigned URING_ENTRIES = 4096;
+const size_t HEARTBEAT_SLOTS = 40;  // 默认的 heartbeat-timeout。
+const size_t MAX_PACKET_SIZE = 16 * 1024 * 1024;
+
+struct receive_result
+{
+    size_t packets = 0;
+    size_t bytes = 0;
+    size_t completions = 0;
+    size_t heartbeats = 0;
+    double cpu_seconds = 0;
+    double wall_seconds = 0;
+};
+
+double thread_cpu_seconds()
+{
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+///
+/// 模拟服务器：接受 connections 个连接后，在 seconds 秒内以每秒 rate 个的速率向随机的连接发送数据包，然后关闭全部连接。
+void serve(const int listener, const size_t connections, const int seconds, const int rate,
+           const std::vector<std::string>& packets)
+{
+    std::vector<int> clients;
+    clients.reserve(connections);
+    while (clients.size() < connections)
+    {
+        auto client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            std::perror("accept");
+            std::exit(1);
+        }
+        clients.push_back(client);
+    }
+
+    std::mt19937 random(1);
+    auto start = std::chrono::steady_clock::now();
+    size_t sent = 0, dropped = 0;
+    for (int tick = 0; tick < seconds * 1000; tick++)
+    {
+        // 每毫秒发送一批，批内各包发给不同的随机连接。
+        auto due = static_cast<size_t>(static_cast<long long>(tick + 1) * rate / 1000);
+        for (; sent + dropped < due;)
+        {
+            auto& packet = packets[random() % packets.size()];
+            if (send(clients[random() % clients.size()], packet.data(), packet.size(), MSG_DONTWAIT | MSG_NOSIGNAL)
+                == static_cast<ssize_t>(packet.size()))
+                sent++;
+            else
+                dropped++;
+        }
+        std::this_thread::sleep_until(start + std::chrono::milliseconds(tick + 1));
+    }
+    for (auto client : clients)
+        close(client);
+    if (dropped)
+        std::fprintf(stderr, "  server: %zu packets not sent.\n", dropped);
+}
+
+///
+/// 起一个模拟服务器子进程，连上 connections 个 socket。
+pid_t start_server(boost::asio::io_context& context, std::vector<boost::asio::ip::tcp::socket>& sockets,
+                   const size_t connections, const int seconds, const int rate,
+                   const std::vector<std::string>& packets)
+{
+    auto listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 4096) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+    {
+        std::perror("listen");
+        std::exit(1);
+    }
+    auto pid = fork();
+    if (pid == 0)
+    {
+        serve(listener, connections, seconds, rate, packets);
+        _exit(0);
+    }
+    close(listener);
+
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), ntohs(address.sin_port));
+    sockets.reserve(connections);
+    for (size_t i = 0; i < connections; i++)
+    {
+        sockets.emplace_back(context);
+        sockets.back().connect(endpoint);
+    }
+    return pid;
+}
+
+///
+/// 两种方式共用的心跳时间轮：每秒向一格中的连接发送心跳。
+template <typename Sender>
+void start_heartbeat(boost::asio::steady_timer& timer, size_t& cursor, const size_t connections, Sender& send_heartbeat)
+{
+    timer.expires_at(timer.expiry() + std::chrono::seconds(1));
+    timer.async_wait([&timer, &cursor, connections, &send_heartbeat](const boost::system::error_code& err) {
+        if (err)
+            return;
+        for (auto i = cursor; i < connections; i += HEARTBEAT_SLOTS)
+            send_heartbeat(i);
+        cursor = (cursor + 1) % HEARTBEAT_SLOTS;
+        start_heartbeat(timer, cursor, connections, send_heartbeat);
+    });
+}
+
+struct reactor_connection
+{
+    boost::asio::ip::tcp::socket* socket;
+    mirrored_buffer buffer;
+    size_t head = 0, filled = 0, skipping = 0;
+};
+
+receive_result run_reactor(const size_t connections, const int seconds, const int rate,
+                           const std::vector<std::string>& packets, const std::string& heartbeat)
+{
+    boost::asio::io_context context(1);
+    std::vector<boost::asio::ip::tcp::socket> sockets;
+    auto server = start_server(context, sockets, connections, seconds, rate, packets);
+    std::vector<reactor_connection> states;
+    states.reserve(connections);
+    for (auto& socket : sockets)
+        states.push_back(reactor_connection{&socket, mirrored_buffer(READ_BUFFER_SIZE)});
+
+    receive_result result;
+    size_t open = connections;
+    boost::asio::steady_timer timer(context, std::chrono::steady_clock::now());
+    size_t cursor = 0;
+    auto send_heartbeat = [&](const size_t i) {
+        result.heartbeats++;
+        states[i].socket->async_send(boost::asio::buffer(heartbeat), [](const boost::system::error_code&, size_t) {});
+    };
+
+    std::function<void(reactor_connection&)> start_read = [&](reactor_connection& state) {
+        state.socket->async_receive(
+            boost::asio::buffer(state.buffer.at(state.head + state.filled), state.buffer.size() - state.filled),
+            [&](const boost::system::error_code& err, const size_t transferred) {
+                result.completions++;
+                if (err)
+                {
+                    if (!--open)
+                        context.stop();
+                    return;
+                }
+                result.bytes += transferred;
+                state.filled += transferred;
+                auto [consumed, skipping] = split_buffer(
+                    state.buffer.at(state.head), state.filled, state.buffer.size(), state.skipping,
+                    [&result](unsigned char* packet, size_t) { result.packets++; bench::keep(packet); });
+                state.head = (state.head + consumed) % state.buffer.size();
+                state.filled -= consumed;
+                state.skipping = skipping;
+                start_read(state);
+            });
+    };
+
+    auto wall = std::chrono::steady_clock::now();
+    auto cpu = thread_cpu_seconds();
+    for (auto& state : states)
+        start_read(state);
+    start_heartbeat(timer, cursor, connections, send_heartbeat);
+    context.run();
+    result.cpu_seconds = thread_cpu_seconds() - cpu;
+    result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+    waitpid(server, nullptr, 0);
+    return result;
+}
+
+///
+/// 与 bilibili_connection 在 io-uring 模式下相同：在缓冲区环中直接切分，只把不完整的数据包复制出来。
+class uring_connection : public uring_receiver
+{
+public:
+    receive_result* result;
+    size_t* open;
+    boost::asio::io_context* context;
+    std::vector<unsigned char> tail;
+    size_t skipping = 0;
+
+    void handle(unsigned char* target, const size_t filled)
+    {
+        auto [consumed, next_skipping] = split_buffer(
+            target, filled, MAX_PACKET_SIZE, skipping,
+            [this](unsigned char* packet, size_t) { result->packets++; bench::keep(packet); });
+        skipping = next_skipping;
+        if (target == tail.data())
+            tail.erase(tail.begin(), tail.begin() + consumed);
+        else
+            tail.assign(target + consumed, target + filled);
+    }
+
+    void on_uring_receive(unsigned char* data, const size_t size) override
+    {
+        result->completions++;
+        result->bytes += size;
+        if (tail.empty())
+        {
+            handle(data, size);
+            return;
+        }
+        tail.insert(tail.end(), data, data + size);
+        handle(tail.data(), tail.size());
+    }
+
+    void on_uring_error(int) override
+    {
+        result->completions++;
+        if (!--*open)
+            context->stop();  // the uring_context keeps waiting for completions.
+    }
+};
+
+receive_result run_uring(const size_t connections, const int seconds, const int rate,
+                         const std::vector<std::string>& packets, const std::string& heartbeat)
+{
+    boost::asio::io_context context(1);
+    uring_context uring(context, URING_ENTRIES, URING_BUFFER_SIZE, URING_BUFFERS);
+    std::vector<boost::asio::ip::tcp::socket> sockets;
+    auto server = start_server(context, sockets, connections, seconds, rate, packets);
+
+    receive_result result;
+    size_t open = connections;
+    boost::asio::steady_timer timer(context, std::chrono::steady_clock::now());
+    size_t cursor = 0;
+    std::vector<uring_connection> states(connections);
+    std::vector<uint64_t> tokens(connections);
+    auto send_heartbeat = [&](const size_t i) {
+        result.heartbeats++;
+        uring.send(tokens[i], heartbeat.data(), heartbeat.size());
+    };
+
+    auto wall = std::chrono::steady_clock::now();
+    auto cpu = thread_cpu_seconds();
+    for (size_t i = 0; i < connections; i++)
+    {
+        states[i].result = &result;
+        states[i].open = &open;
+        states[i].context = &context;
+        tokens[i] = uring.start_receive(sockets[i].native_handle(), &states[i]);
+    }
+    start_heartbeat(timer, cursor, connections, send_heartbeat);
+    context.run();
+    result.cpu_seconds = thread_cpu_seconds() - cpu;
+    result.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+    waitpid(server, nullptr, 0);
+    return result;
+}
+
+void print(const char* name, const receive_result& result)
+{
+    std::printf("  %-8s %zu packets, %.2f MiB, %zu receive completions, %zu heartbeats, "
+                "%.0f ms CPU in %.1f s (%.2f us CPU per packet)\n",
+                name, result.packets, result.bytes / (1024.0 * 1024), result.completions, result.heartbeats,
+                result.cpu_seconds * 1000, result.wall_seconds, result.cpu_seconds * 1e6 / std::max<size_t>(result.packets, 1));
+}
+
+int main(int argc, char** argv)
+{
+    spdlog::set_level(spdlog::level::warn);
+    size_t connections = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 10;
+    int rate = argc > 3 ? std::atoi(argv[3]) : 20000;
+
+    // protover 2 的数据包：每包为若干条消息压缩而成，与热门房间以外的大多数房间相同。
+    auto messages = bench::generate_corpus(4000);
+    std::vector<std::string> packets;
+    for (size_t i = 0; i + 4 <= messages.size(); i += 4)
+    {
+        std::string bundle;
+        for (size_t j = i; j < i + 4; j++)
+            bundle += bench::make_packet(messages[j], 0, 5);
+        packets.push_back(bench::make_packet(bench::zlib_compress(bundle), 2, 5));
+    }
+    auto heartbeat = bench::make_packet("", 0, 2);  // 与 generate_heartbeat_packet() 相同。
+
+    std::printf("%zu connections, %d s, %d packets/s from a local mock server\n", connections, seconds, rate);
+    print("reactor:", run_reactor(connections, seconds, rate, packets, heartbeat));
+    try
+    {
+        print("uring:", run_uring(connections, seconds, rate, packets, heartbeat));
+    }
+    catch (std::system_error& ex)
+    {
+        std::printf("  uring:   unavailable: %s\n", ex.what());
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+// 对比 UTF-8 检查的开销：
+// whole     - bili_json 现在的做法，解析前对整条 json 做一次 is_valid_utf8；
+// scalar    - 同上，但不使用 SIMD；
+// per-field - 原来由 protobuf 对每个字符串字段分别检查，这里对 json 中的每个字符串值调用 protobuf 的检查函数。
+//             被映射的字段只是其中一部分，因此这是原来开销的上限；protobuf 在序列化和解析时各检查一次，这里只算一次。
+// 只统计 BILI_COMMANDS 中的 cmd，其余消息在检查之前就被丢弃。
+// 用法：bench_utf8 [抓包文件]
+
+#include "bench_corpus.h"
+#include "utf8_validate.h"
+
+#include <google/protobuf/stubs/common.h>
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace vNerve::bilibili;
+
+const int ROUNDS = 10;
+const int REPEAT = 10;
+const std::string_view handled_cmds[] = {"DANMU_MSG", "SUPER_CHAT_MESSAGE", "SEND_GIFT", "GUARD_BUY"};
+
+bool is_handled(const std::string& message)
+{
+    for (auto cmd : handled_cmds)
+        if (message.find("\"cmd\":\"" + std::string(cmd) + "\"") != std::string::npos)
+            return true;
+    return false;
+}
+
+// json 中所有字符串值（不含键）的位置，转义序列原样保留。
+std::vector<std::pair<size_t, size_t>> string_values(const std::string& message)
+{
+    std::vector<std::pair<size_t, size_t>> values;
+    size_t i = 0;
+    while ((i = message.find('"', i)) != std::string::npos)
+    {
+        auto begin = ++i;
+        while (i < message.size() && message[i] != '"')
+            i += message[i] == '\\' ? 2 : 1;
+        auto end = i++;
+        auto next = message.find_first_not_of(" \t\r\n", i);
+        if (next == std::string::npos || message[next] != ':')
+            values.emplace_back(begin, end - begin);
+    }
+    return values;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> messages;
+    std::vector<std::vector<std::pair<size_t, size_t>>> fields;
+    size_t total = 0, bytes = 0, field_count = 0, field_bytes = 0;
+    for (auto& message : bench::load_corpus(argc, argv))
+    {
+        total++;
+        if (!is_handled(message))
+            continue;
+        fields.push_back(string_values(message));
+        for (auto [_, size] : fields.back())
+            field_bytes += size;
+        field_count += fields.back().size();
+        bytes += message.size();
+        messages.push_back(std::move(message));
+    }
+    std::printf("%zu of %zu messages handled, %zu bytes; %zu string values, %zu bytes\n",
+                messages.size(), total, bytes, field_count, field_bytes);
+
+    size_t valid = 0;
+    auto whole_seconds = bench::best_of(ROUNDS, [&] {
+        valid = 0;
+        for (int i = 0; i < REPEAT; i++)
+            for (auto& message : messages)
+                valid += is_valid_utf8(message.data(), message.size());
+    });
+    std::printf("  whole:     %6.1f ns/message, %7.1f MiB/s (%zu valid)\n",
+                whole_seconds / messages.size() / REPEAT * 1e9, bytes * REPEAT / whole_seconds / (1024 * 1024), valid / REPEAT);
+
+    auto scalar_seconds = bench::best_of(ROUNDS, [&] {
+        valid = 0;
+        for (int i = 0; i < REPEAT; i++)
+            for (auto& message : messages)
+                valid += is_valid_utf8_scalar(message.data(), message.size());
+    });
+    std::printf("  scalar:    %6.1f ns/message, %7.1f MiB/s (%zu valid)\n",
+                scalar_seconds / messages.size() / REPEAT * 1e9, bytes * REPEAT / scalar_seconds / (1024 * 1024), valid / REPEAT);
+
+    auto field_seconds = bench::best_of(ROUNDS, [&] {
+        valid = 0;
+        for (int i = 0; i < REPEAT; i++)
+            for (size_t j = 0; j < messages.size(); j++)
+            {
+                bool succeeded = true;
+                for (auto [offset, size] : fields[j])
+                    succeeded &= google::protobuf::internal::IsStructurallyValidUTF8(
+                        messages[j].data() + offset, static_cast<int>(size));
+                valid += succeeded;
+            }
+    });
+    std::printf("  per-field: %6.1f ns/message, %7.1f MiB/s of fields (%zu valid)\n",
+                field_seconds / messages.size() / REPEAT * 1e9, field_bytes * REPEAT / field_seconds / (1024 * 1024), valid / REPEAT);
+    return 0;
+}
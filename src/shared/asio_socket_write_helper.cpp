@@ -64,7 +64,10 @@ void asio_socket_write_helper::on_written(const boost::system::error_code& ec, s
     }
 
     if (ec.value() == boost::asio::error::operation_aborted)
+    {
+        notify_drained();
         return;
+    }
     if (ec)
     {
         spdlog::warn(LOG_PREFIX "{} Error writing to socket! Disconnecting. err: {}:{}", _log_prefix, ec.value(), ec.message());
@@ -73,6 +76,8 @@ void asio_socket_write_helper::on_written(const boost::system::error_code& ec, s
     SPDLOG_DEBUG(LOG_PREFIX "{} Written {} bytes in {} buffers.", _log_prefix, byte_transferred, buffer_count);
     if (!_write_queue.empty())
         start_async_write();
+    else
+        notify_drained();
 }
 
 void asio_socket_write_helper::delete_first_n_buffers(int n)
@@ -84,6 +89,27 @@ void asio_socket_write_helper::delete_first_n_buffers(int n)
         std::get<2>(buf_iter)(std::get<0>(buf_iter)); // Use deleter
         _write_queue.pop_front();
     }
+    if (_write_queue.empty())
+        notify_drained();
+}
+
+void asio_socket_write_helper::notify_drained()
+{
+    if (!_drained_handler)
+        return;
+    auto handler = std::move(_drained_handler);
+    _drained_handler = nullptr;
+    handler();
+}
+
+void asio_socket_write_helper::on_drained(socket_drained_handler handler)
+{
+    _drained_handler = std::move(handler);
+    if (_write_queue.empty() || _socket.expired())
+    {
+        delete_first_n_buffers(static_cast<int>(_write_queue.size()));  // nowhere to write them.
+        notify_drained();
+    }
 }
 
 void asio_socket_write_helper::reset(std::shared_ptr<boost::asio::ip::tcp::socket> socket)
@@ -111,7 +137,7 @@ void asio_socket_write_helper::write(unsigned char* buf, size_t len, const super
             deleter(buf);
             return;
         }
-        bool write_in_process = _write_queue.empty();
+        bool write_in_process = !_write_queue.empty();
         _write_queue.emplace_back(buf, len, deleter);
         if (!write_in_process)
             start_async_write();
@@ -7,6 +7,7 @@ namespace vNerve::bilibili
 {
 using supervisor_buffer_deleter = std::function<void(unsigned char*)>;
 using socket_close_handler = std::function<void()>;
+using socket_drained_handler = std::function<void()>;
 
 class asio_socket_write_helper
 {
@@ -16,17 +17,21 @@ private:
 
     std::weak_ptr<boost::asio::ip::tcp::socket> _socket;
     socket_close_handler _close_handler;
+    socket_drained_handler _drained_handler;
 
     void start_async_write();
     void on_written(const boost::system::error_code& ec, size_t byte_transferred, int buffer_count);
     void delete_first_n_buffers(int n);
+    void notify_drained();
 
 public:
     asio_socket_write_helper(std::string log_prefix, std::shared_ptr<boost::asio::ip::tcp::socket> socket, socket_close_handler close_handler);
     void reset(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
 
     void write(unsigned char*, size_t, const supervisor_buffer_deleter&);
-
+    ///
+    /// 写队列清空时调用一次 handler，队列已空时立即调用。必须在 socket 的 IO 线程上调用。
+    void on_drained(socket_drained_handler handler);
 
     asio_socket_write_helper(const asio_socket_write_helper& other) = delete;
     asio_socket_write_helper& operator=(const asio_socket_write_helper& other) = delete;
@@ -35,7 +40,8 @@ public:
         : _write_queue(std::move(other._write_queue)),
           _log_prefix(std::move(other._log_prefix)),
           _socket(std::move(other._socket)),
-          _close_handler(std::move(other._close_handler))
+          _close_handler(std::move(other._close_handler)),
+          _drained_handler(std::move(other._drained_handler))
     {
     }
 
@@ -47,6 +53,7 @@ public:
         _log_prefix = std::move(other._log_prefix);
         _socket = std::move(other._socket);
         _close_handler = std::move(other._close_handler);
+        _drained_handler = std::move(other._drained_handler);
         return *this;
     }
 };
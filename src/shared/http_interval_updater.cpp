@@ -34,9 +34,6 @@ http_interval_updater::http_interval_updater(int update_interval_min, int timeou
 
 http_interval_updater::~http_interval_updater()
 {
-    curl_easy_cleanup(_curl);
-    _curl = nullptr;
-
     boost::system::error_code nec;
     _timer->cancel(nec);  // ignore error_code
     try
@@ -50,6 +47,11 @@ http_interval_updater::~http_interval_updater()
             "[http_upd] Failed shutting down session IO Context! err:{}:{}:{}",
             ex.code().value(), ex.code().message(), ex.what());
     }
+    if (_thread.joinable())
+        _thread.join();  // a refreshing request may be using _curl.
+
+    curl_easy_cleanup(_curl);
+    _curl = nullptr;
 }
 
 void http_interval_updater::reschedule_timer()
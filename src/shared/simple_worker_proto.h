@@ -1,6 +1,11 @@
 #pragma once
 #include <utility>
 #include <functional>
+#include <cassert>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+#include <boost/asio/detail/socket_ops.hpp>
 
 namespace vNerve::bilibili::worker_supervisor
 {
@@ -11,6 +16,7 @@ const size_t routing_key_max_size = 24;
 inline const unsigned char worker_ready_code = static_cast<unsigned char>(0x00000001);
 inline const unsigned char room_failed_code =  static_cast<unsigned char>(0x00000002);
 inline const unsigned char worker_data_code =  static_cast<unsigned char>(0x00000000);
+inline const unsigned char worker_batch_data_code = static_cast<unsigned char>(0x00000003);
 
 inline const unsigned char assign_room_code =   static_cast<unsigned char>(0x10000001);
 inline const unsigned char unassign_room_code = static_cast<unsigned char>(0x10000002);
@@ -18,6 +24,14 @@ inline const unsigned char unassign_room_code = static_cast<unsigned char>(0x100
 inline const size_t simple_message_header_length = sizeof(unsigned int);
 inline const unsigned int worker_ready_payload_length = 1 + 4;
 inline const unsigned int assign_unassign_payload_length = 1 + 4;
+inline const size_t checksum_size = 8;
+inline const unsigned int worker_data_header_length = 1 + 4 + checksum_size + routing_key_max_size;
+///
+/// 不含 CHECKSUMS，CHECKSUMS 的长度为 COUNT * checksum_size。
+inline const unsigned int worker_batch_data_header_length = 1 + 4 + 4 + routing_key_max_size;
+///
+/// 批量数据包 PAYLOAD 中每条消息的 tag：字段 1，length-delimited。
+inline const unsigned char batch_message_tag = (1 << 3) | 2;
 
 /*
  * All big endian.
@@ -25,14 +39,18 @@ inline const unsigned int assign_unassign_payload_length = 1 + 4;
  * OP_CODE=1 ROOM_ID   (ROOM FAILED)
  * OP_CODE=2 MAX_ROOMS (WORKER READY)
  *
- * byte      uint32  int32 char[24]
- * OP_CODE=0 ROOM_ID CRC32 ROUTING_KEY PAYLOAD
+ * byte      uint32  uint64   char[24]
+ * OP_CODE=0 ROOM_ID CHECKSUM ROUTING_KEY PAYLOAD
+ *
+ * byte      uint32  uint32 uint64[COUNT] char[24]
+ * OP_CODE=3 ROOM_ID COUNT  CHECKSUMS     ROUTING_KEY PAYLOAD (BATCH DATA)
+ * PAYLOAD 为同一个压缩包中的 COUNT 条 RoomMessage，每条都是字段 1 的 length-delimited 项，顺序与 CHECKSUMS 相同。
  *
  * OP_CODE ROOM_ID
  */
 
 /**
- * All packets starts with packet length, then the payload.
+ * All packets starts with payload length, then the payload.
  */
 
 using buffer_handler = std::function<void (unsigned char*, size_t)>;
@@ -44,10 +62,107 @@ using buffer_handler = std::function<void (unsigned char*, size_t)>;
 /// @param transferred 本次读取到的字节数
 /// @param buffer_size 整个缓冲区的大小
 /// @param skipping_size 上次调用获得的返回值的第二项，标识应该跳过的大小
-/// @param handler 回调，用于处理获取到的信息
+/// @param handler 回调，以 `(unsigned char*, size_t)` 调用，用于处理获取到的信息
 /// @return 下次读取结果应该存放的偏移量以及需要传入下一次调用最后一个参数的偏移量。如果本结果含有不完整的数据包，本函数将会将该数据包的一部分复制到 `buf` 开头，则返回的就是数据包片段的尾部位置 + 1.
+template <typename Handler>
 std::pair<size_t, size_t> handle_simple_message(unsigned char* buf, size_t transferred,
                                                 size_t buffer_size,
                                                 size_t skipping_size,
-                                                buffer_handler handler);
+                                                Handler&& handler)
+{
+    using namespace boost::asio::detail::socket_ops;
+    spdlog::trace(
+        "[simple_message] [{:p}] Handling buffer: transferred={}, buffer_size={}, skipping_size={}.",
+        buf, transferred, buffer_size, skipping_size);
+    if (skipping_size > transferred)
+    {
+        auto next_skipping_size = skipping_size - transferred;
+        spdlog::trace(
+            "[simple_message] [{:p}] Continue skipping message... Next skipping size=",
+            buf, next_skipping_size);
+        return std::pair<size_t, size_t>(
+            0, next_skipping_size);  // continue disposing
+    }
+    long long remaining = transferred - skipping_size;
+    auto begin = buf + skipping_size;
+
+    while (remaining > 0)
+    {
+        spdlog::trace("[simple_message] [{:p}] Decoding message, remaining={}",
+                      buf, remaining);
+        assert(remaining <= buffer_size && remaining <= transferred);
+        if (remaining < simple_message_header_length)
+        {
+            // the remaining bytes can't even form a header, so move it to the head and wait for more data.
+            spdlog::trace(
+                "[simple_message] [{:p}] Remaining bytes can't form a header. Request for more data be written to buf+{}.",
+                buf, remaining);
+            std::memmove(buf, begin, remaining);
+            return std::pair<size_t, size_t>(remaining, 0);
+        }
+        // 头部记录的是 PAYLOAD 的长度，不含头部本身。
+        auto length = simple_message_header_length + network_to_host_long(*reinterpret_cast<simple_message_header*>(begin));
+        if (length > buffer_size)
+        {
+            spdlog::info(
+                "[simple_message] [{:p}] Packet too big: {} > max size({}). Disposing and skipping next {} bytes.",
+                buf, length, buffer_size, length - remaining);
+            assert(length > transferred);
+            // The packet is too big, dispose it.
+            return std::pair<size_t, size_t>(
+                0, length - remaining);  // skip the remaining bytes.
+        }
+
+        if (length > remaining)
+        {
+            // need more data.
+            std::memmove(buf, begin, remaining);
+            spdlog::trace(
+                "[simple_message] [{:p}] Packet not complete. Request for more data be written to buf+{}.",
+                buf, remaining);
+            return std::pair<size_t, size_t>(remaining, 0);
+        }
+
+        // 到此处我们拥有一个完整的数据包：[begin, begin + length)
+
+        handler(begin + simple_message_header_length, length - simple_message_header_length);
+        remaining -= length;
+        begin += length;
+    }
+
+    return std::pair(0, 0);  // read from starting, and skip no bytes.
+}
+
+///
+/// 依次取出批量数据包 PAYLOAD 中的每条消息。
+/// @param payload 批量数据包的 PAYLOAD 部分
+/// @param count 头部中的 COUNT
+/// @param handler 回调，以 `(size_t index, unsigned char* message, size_t length)` 调用，index 对应 CHECKSUMS 中的下标
+/// @return PAYLOAD 是否恰好由 count 条消息组成。返回 false 之前可能已经回调过前面的消息。
+template <typename Handler>
+bool for_each_batch_message(unsigned char* payload, size_t length, size_t count, Handler&& handler)
+{
+    auto end = payload + length;
+    size_t index = 0;
+    while (payload < end)
+    {
+        if (index >= count || *payload++ != batch_message_tag)
+            return false;
+        size_t message_length = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            if (payload >= end || shift > 28)
+                return false;
+            auto byte = *payload++;
+            message_length |= static_cast<size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        if (message_length > static_cast<size_t>(end - payload))
+            return false;
+        handler(index++, payload, message_length);
+        payload += message_length;
+    }
+    return index == count;
+}
 }
@@ -9,5 +9,5 @@ namespace worker_supervisor
 using identifier_t = uint64_t;
 using room_id_t = int;
 }
-using checksum_t = int; // CRC-32
+using checksum_t = uint64_t; // 原始 json 的指纹，见 worker 的 fingerprint.h
 }
\ No newline at end of file
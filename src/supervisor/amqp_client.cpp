@@ -11,6 +11,7 @@ amqp_asio_connection::amqp_asio_connection(const std::string& host, int port, co
       _guard(_context.get_executor()),
       _resolver(_context.get_executor()),
       _timer(_context.get_executor()),
+      _shutdown_timer(_context.get_executor()),
       _host(host),
       _port(port)
 {
@@ -62,6 +63,8 @@ void amqp_asio_connection::onClosed(AMQP::Connection* connection)
         return;
     _initializing = false;
     close_socket();
+    if (_closing)
+        finish_shutdown();
 }
 
 uint16_t amqp_asio_connection::onNegotiate(AMQP::Connection* connection, uint16_t interval)
@@ -72,6 +75,38 @@ uint16_t amqp_asio_connection::onNegotiate(AMQP::Connection* connection, uint16_
     return _heartbeat_interval_sec * 2;
 }
 
+void amqp_asio_connection::shutdown(int timeout_sec)
+{
+    // Queued after every publish posted before, so all of them are handed to AMQP-CPP first.
+    post([this, timeout_sec]() -> void
+    {
+        _closing = true;
+        if (!_connection || !_socket)
+        {
+            finish_shutdown();
+            return;
+        }
+        _shutdown_timer.expires_from_now(boost::posix_time::seconds(timeout_sec));
+        _shutdown_timer.async_wait([this](const boost::system::error_code& ec) -> void
+        {
+            if (!ec)
+                finish_shutdown();  // the server didn't confirm closing in time.
+        });
+        _connection->close();  // flushes pending frames, then onClosed after the server confirms.
+    });
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void amqp_asio_connection::finish_shutdown()
+{
+    boost::system::error_code nec;
+    _shutdown_timer.cancel(nec);
+    close_socket();
+    _guard.reset();
+    _context.stop();
+}
+
 bool amqp_asio_connection::reconnect(std::function<void()> onReady)
 {
     if (_connection)
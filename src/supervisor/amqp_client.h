@@ -24,6 +24,8 @@ private:
     boost::asio::ip::tcp::resolver _resolver;
     boost::thread _thread;
     boost::asio::deadline_timer _timer;
+    boost::asio::deadline_timer _shutdown_timer;
+    bool _closing = false;
 
     std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
     std::unique_ptr<unsigned char[]> _read_buffer_guard;
@@ -44,6 +46,7 @@ private:
     void close_socket();
     void start_async_read();
     void start_heartbeat_timer();
+    void finish_shutdown();
 
     void on_timer_tick(const boost::system::error_code& ec);
     void on_received(const boost::system::error_code& ec, size_t transferred);
@@ -55,5 +58,9 @@ public:
 
     bool reconnect(std::function<void()> onReady);
     void post(std::function<void()> func);
+    ///
+    /// 优雅关闭 AMQP 连接：已投递的 publish 发送完毕、服务器确认关闭后断开（最多等待 timeout_sec 秒），
+    /// 然后等待 IO 线程退出。阻塞调用，不能在 IO 线程上调用。
+    void shutdown(int timeout_sec);
 };
 }
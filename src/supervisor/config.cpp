@@ -13,6 +13,9 @@ const int DEFAULT_WORKER_MIN_CHECK_INTERVAL_MS = 2000;
 const int DEFAULT_READ_BUFFER = 128 * 1024;
 const int DEFAULT_WORKER_INTERVAL_THRESHOLD_SEC = 40;
 const int DEFAULT_WORKER_PENALTY_MIN = 5;
+const int DEFAULT_HANDOFF_TIMEOUT_SEC = 60;
+const int DEFAULT_DEDUPLICATE_WINDOW_SEC = 60;
+const int DEFAULT_SHUTDOWN_TIMEOUT_SEC = 5;
 
 boost::program_options::options_description create_description()
 {
@@ -39,6 +42,10 @@ boost::program_options::options_description create_description()
         ("read-buffer,b", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) of sockets to each worker.")
         ("worker-interval-threshold-sec,i", value<int>()->default_value(DEFAULT_WORKER_INTERVAL_THRESHOLD_SEC), "Worker message timeout threshold. Task/Worker which didn't receive any message within this period will fail.")
         ("worker-penalty-min,p", value<int>()->default_value(DEFAULT_WORKER_PENALTY_MIN), "Penalty applied to worker when a task fails. in minutes. No new task will be assign to the worker in the given time period.")
+        ("room-handoff", bool_switch(), "Make before break: when moving a room, unassign the old task only after the new one receives data.")
+        ("handoff-timeout-sec", value<int>()->default_value(DEFAULT_HANDOFF_TIMEOUT_SEC), "Max time(sec) to keep the old task when moving a room in handoff mode.")
+        ("deduplicate-window-sec", value<int>()->default_value(DEFAULT_DEDUPLICATE_WINDOW_SEC), "Messages with the same checksum received within this period(sec) are forwarded only once.")
+        ("shutdown-timeout-sec", value<int>()->default_value(DEFAULT_SHUTDOWN_TIMEOUT_SEC), "Max time(sec) for flushing messages to workers and MQ when shutting down.")
         //("worker-mq-threads, t", value<int>()->default_value(DEFAULT_WORKER_MQ_THREADS), "Thread count for MQ communicating with workers.")
     ;
 
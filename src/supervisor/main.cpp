@@ -2,6 +2,11 @@
 
 #include "config.h"
 
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <spdlog/spdlog.h>
+
+#include <csignal>
 #include <memory>
 #include <iostream>
 
@@ -17,6 +22,18 @@ int main(int argc, char** argv)
                 }
                 std::cout << "Total: " << vec.size() << std::endl;
     });
-    while (1)
-        ;
+
+    // Sleep until asked to exit, then shut down in order.
+    boost::asio::io_context signal_context;
+    boost::asio::signal_set signals(signal_context, SIGINT, SIGTERM);
+    signals.async_wait([](const boost::system::error_code& ec, int signal) -> void
+    {
+        if (!ec)
+            spdlog::info("[main] Received signal {}. Shutting down.", signal);
+    });
+    signal_context.run();
+
+    updater.reset();  // joins the updating thread.
+    spdlog::info("[main] Bye.");
+    return 0;
 }
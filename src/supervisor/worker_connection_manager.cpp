@@ -91,7 +91,7 @@ void worker_session::send(unsigned char* buf, size_t len, supervisor_buffer_dele
 
 void worker_session::disconnect(bool callback)
 {
-    if (_socket)
+    if (!_socket)
         return;
     spdlog::info(LOG_PREFIX "[{:016x}] Disconnecting worker socket.", _identifier);
     auto ec = boost::system::error_code();
@@ -118,6 +118,8 @@ worker_connection_manager::worker_connection_manager(
       _timer(std::make_unique<boost::asio::deadline_timer>(_context)),
       _timer_interval_ms((*config)["check-interval-ms"].as<int>()),
       _read_buffer_size((*config)["read-buffer"].as<size_t>()),
+      _shutdown_timer(_context),
+      _shutdown_timeout_sec((*config)["shutdown-timeout-sec"].as<int>()),
       _buffer_handler(std::move(buffer_handler)),
       _tick_handler(std::move(tick_handler)),
       _new_worker_handler(std::move(new_worker_handler)),
@@ -148,6 +150,52 @@ worker_connection_manager::
         spdlog::critical(LOG_PREFIX "Failed shutting down session IO Context! err:{}:{}:{}",
                          ex.code().value(), ex.code().message(), ex.what());
     }
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void worker_connection_manager::shutdown()
+{
+    post(_context, [this]() -> void
+    {
+        spdlog::info(LOG_PREFIX "Shutting down. Flushing pending messages to {} workers.", _sockets.size());
+        _closing = true;
+        boost::system::error_code nec;
+        _acceptor.cancel(nec);
+        _acceptor.close(nec);
+        _timer->cancel(nec);
+
+        _shutdown_timer.expires_from_now(boost::posix_time::seconds(_shutdown_timeout_sec));
+        _shutdown_timer.async_wait([this](const boost::system::error_code& ec) -> void
+        {
+            if (ec)
+                return;  // flushed.
+            spdlog::warn(LOG_PREFIX "Timed out flushing messages to {} workers. Dropping.", _draining_sessions);
+            finish_shutdown();
+        });
+        _draining_sessions = _sockets.size() + 1;  // +1 so that sessions drained right away don't finish early.
+        for (auto& [identifier, session] : _sockets)
+            session.on_drained([this]() -> void
+            {
+                if (--_draining_sessions == 0)
+                    finish_shutdown();
+            });
+        if (--_draining_sessions == 0)
+            finish_shutdown();
+    });
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void worker_connection_manager::finish_shutdown()
+{
+    boost::system::error_code nec;
+    _shutdown_timer.cancel(nec);
+    for (auto& [identifier, session] : _sockets)
+        session.disconnect(false);
+    _sockets.clear();
+    _guard.reset();
+    _context.stop();
 }
 
 void worker_connection_manager::
@@ -199,6 +247,8 @@ void worker_connection_manager::on_accept(
         _new_worker_handler(identifier);
     }
 
+    if (_closing)
+        return;
     start_accept();
 }
 
@@ -213,6 +263,8 @@ void worker_connection_manager::reschedule_timer()
 
 void worker_connection_manager::on_timer_tick(const boost::system::error_code& ec)
 {
+    if (_closing)
+        return;
     if (ec)
     {
         if (ec.value() == boost::asio::error::operation_aborted)
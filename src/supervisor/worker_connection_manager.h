@@ -44,6 +44,7 @@ public:
     ~worker_session();
 
     void send(unsigned char*, size_t, supervisor_buffer_deleter);
+    void on_drained(socket_drained_handler handler) { _write_helper.on_drained(std::move(handler)); }
     void disconnect(bool callback);
     std::shared_ptr<boost::asio::ip::tcp::socket> socket() { return _socket; }
 
@@ -87,6 +88,10 @@ private:
     std::unique_ptr<boost::asio::deadline_timer> _timer;
     int _timer_interval_ms;
     size_t _read_buffer_size;
+    boost::asio::deadline_timer _shutdown_timer;
+    int _shutdown_timeout_sec;
+    size_t _draining_sessions = 0;
+    bool _closing = false;
 
     boost::thread _thread;
     supervisor_buffer_handler _buffer_handler;
@@ -104,6 +109,7 @@ private:
 
     void reschedule_timer();
     void on_timer_tick(const boost::system::error_code& ec);
+    void finish_shutdown();
 
 public:
     worker_connection_manager(config::config_t config,
@@ -121,5 +127,9 @@ public:
     /// @param msg Message to be sent. Taking ownership of msg
     void send_message(identifier_t identifier, unsigned char* msg, size_t len, supervisor_buffer_deleter deleter);
     void disconnect_worker(identifier_t identifier, bool callback = false);
+    ///
+    /// 停止接受新的 worker 连接，等待发往各 worker 的消息发送完毕（最多 shutdown-timeout-sec 秒），
+    /// 然后断开所有 worker 并等待 IO 线程退出。阻塞调用，不能在 IO 线程上调用。
+    void shutdown();
 };
 }  // namespace vNerve::bilibili::worker_supervisor
\ No newline at end of file
@@ -30,7 +30,10 @@ scheduler_session::scheduler_session(const config::config_t config)
           std::chrono::milliseconds(
               (*config)["min-check-interval-ms"].as<int>())),
       _worker_interval_threshold(std::chrono::seconds((*config)["worker-interval-threshold-sec"].as<int>())),
-      _worker_penalty(std::chrono::minutes((*config)["worker-penalty-min"].as<int>()))
+      _worker_penalty(std::chrono::minutes((*config)["worker-penalty-min"].as<int>())),
+      _handoff((*config)["room-handoff"].as<bool>()),
+      _handoff_timeout(std::chrono::seconds((*config)["handoff-timeout-sec"].as<int>())),
+      _deduplicate(std::chrono::seconds((*config)["deduplicate-window-sec"].as<int>()))
 {
     _worker_session = std::make_shared<worker_connection_manager>(
         config,
@@ -51,7 +54,26 @@ void scheduler_session::clear_worker_tasks(identifier_t identifier)
 {
     spdlog::debug(LOG_PREFIX "[{:016x}] Clearing tasks from worker", identifier);
     auto& tasks_by_id = _tasks.get<tasks_by_identifier>();
+    auto [begin, end] = tasks_by_id.equal_range(identifier);
+    std::vector<room_id_t> rooms;
+    for (auto task_iter = begin; task_iter != end; ++task_iter)
+        if (!task_iter->draining)
+            rooms.push_back(task_iter->room_id);
     tasks_by_id.erase(identifier);
+
+    // The worker may have been taking over these rooms. Tasks still draining into it are the only ones
+    // connected now, so keep them; the next check drains the extra tasks again.
+    auto& tasks_by_rid = _tasks.get<tasks_by_room_id>();
+    for (auto room_id : rooms)
+    {
+        auto [room_begin, room_end] = tasks_by_rid.equal_range(room_id);
+        for (auto task_iter = room_begin; task_iter != room_end; ++task_iter)
+            if (task_iter->draining)
+            {
+                spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Handoff target is gone, keeping draining task.", task_iter->identifier, room_id);
+                tasks_by_rid.modify(task_iter, [](room_task& it) -> void { it.draining = false; });
+            }
+    }
 }
 
 void scheduler_session::reset_worker(worker_status* worker)
@@ -74,9 +96,10 @@ void scheduler_session::delete_worker(worker_status* worker)
 
 void scheduler_session::delete_and_disconnect_worker(worker_status* worker)
 {
-    spdlog::info(LOG_PREFIX "[{:016x}] Disconnecting worker.", worker->identifier);
+    auto identifier = worker->identifier;  // worker is gone after delete_worker.
+    spdlog::info(LOG_PREFIX "[{:016x}] Disconnecting worker.", identifier);
     delete_worker(worker);
-    _worker_session->disconnect_worker(worker->identifier);
+    _worker_session->disconnect_worker(identifier);
 }
 
 template <int N, class Iterator>
@@ -90,6 +113,7 @@ Iterator scheduler_session::delete_task(Iterator iter, const bool desc_rank)
     }
     auto identifier = iter->identifier;
     auto room = iter->room_id;
+    auto counted = !iter->draining;  // draining tasks have been uncounted.
     spdlog::debug(LOG_PREFIX "[{0:016x}] Deleting task to room {1}. Desc_rank: {2}", identifier, room, desc_rank);
     iter = tasks_by_id_rid.erase(iter);
 
@@ -97,18 +121,13 @@ Iterator scheduler_session::delete_task(Iterator iter, const bool desc_rank)
     if (worker_iter != _workers.end())
     {
         if (desc_rank)
-        {
-            if (!worker_iter->second.punished)
-                worker_iter->second.allow_new_task_after = std::chrono::system_clock::now() + std::chrono::minutes(10);
-            else
-                worker_iter->second.allow_new_task_after += _worker_penalty; // acc
-            SPDLOG_TRACE(LOG_PREFIX "Updating rank of worker: {}", worker_iter->second.allow_new_task_after.count());
-        }
-        worker_iter->second.current_connections--;
+            punish_worker(&worker_iter->second);
+        if (counted)
+            worker_iter->second.current_connections--;
     }
 
     auto room_iter = _rooms.find(room);
-    if (room_iter != _rooms.end())
+    if (room_iter != _rooms.end() && counted)
         room_iter->second.current_connections--;
     return iter;
 }
@@ -121,11 +140,75 @@ void scheduler_session::delete_task(identifier_t identifier, room_id_t room_id,
     delete_task<tasks_by_identifier_and_room_id>(task_iter, desc_rank);
 }
 
+void scheduler_session::punish_worker(worker_status* worker)
+{
+    if (!worker->punished)
+        worker->allow_new_task_after = std::chrono::system_clock::now() + std::chrono::minutes(10);
+    else
+        worker->allow_new_task_after += _worker_penalty; // acc
+    SPDLOG_TRACE(LOG_PREFIX "Updating rank of worker: {}", worker->allow_new_task_after.time_since_epoch().count());
+}
+
+void scheduler_session::drain_task(identifier_t identifier, room_id_t room_id)
+{
+    auto& tasks_by_id_rid = _tasks.get<tasks_by_identifier_and_room_id>();
+    auto task_iter = tasks_by_id_rid.find(boost::make_tuple(identifier, room_id));
+    if (task_iter == tasks_by_id_rid.end() || task_iter->draining)
+        return;
+    if (!_handoff)
+    {
+        send_unassign(identifier, room_id);
+        delete_task<tasks_by_identifier_and_room_id>(task_iter, false);
+        return;
+    }
+    spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Draining task, waiting for handoff.", identifier, room_id);
+    auto now = std::chrono::system_clock::now();
+    tasks_by_id_rid.modify(task_iter, [now](room_task& it) -> void
+    {
+        it.draining = true;
+        it.draining_since = now;
+    });
+
+    auto worker_iter = _workers.find(identifier);
+    if (worker_iter != _workers.end())
+        worker_iter->second.current_connections--;
+    auto room_iter = _rooms.find(room_id);
+    if (room_iter != _rooms.end())
+        room_iter->second.current_connections--;
+}
+
+void scheduler_session::finish_handoff(room_id_t room_id)
+{
+    auto& tasks_by_rid = _tasks.get<tasks_by_room_id>();
+    auto [begin, end] = tasks_by_rid.equal_range(room_id);
+    if (std::none_of(begin, end, [](const room_task& task) { return task.confirmed && !task.draining; }))
+        return;  // no one is receiving data from this room yet.
+    for (auto task_iter = begin; task_iter != end;)
+        if (task_iter->draining)
+        {
+            spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Handoff finished, unassigning.", task_iter->identifier, room_id);
+            send_unassign(task_iter->identifier, room_id);
+            task_iter = delete_task<tasks_by_room_id>(task_iter, false);
+        }
+        else
+            ++task_iter;
+}
+
 void scheduler_session::assign_task(worker_status* worker, room_status* room)
 {
     SPDLOG_TRACE(LOG_PREFIX "Trying to assign task <{0:016x},{1}>", worker->identifier, room->room_id);
     auto [iter, inserted] = _tasks.emplace(worker->identifier, room->room_id);
-    if (!inserted) return;
+    if (!inserted)
+    {
+        if (!iter->draining)
+            return;
+        // still connected, just keep it.
+        _tasks.modify(iter, [](room_task& it) -> void { it.draining = false; });
+        worker->current_connections++;
+        room->current_connections++;
+        spdlog::debug(LOG_PREFIX "[{0:016x}] Keeping draining task to room {1}.", worker->identifier, room->room_id);
+        return;
+    }
     send_assign(worker->identifier, room->room_id);
     worker->current_connections++;
     room->current_connections++;
@@ -145,28 +228,55 @@ void scheduler_session::refresh_counts()
     auto& tasks_by_wid = _tasks.get<tasks_by_identifier>();
     auto& tasks_by_rid = _tasks.get<tasks_by_room_id>();
 
+    // draining tasks aren't counted.
+    auto not_draining = [](const room_task& task) { return !task.draining; };
     for (auto& [identifier, worker] : _workers)
-        worker.current_connections = tasks_by_wid.count(identifier);
+    {
+        auto [begin, end] = tasks_by_wid.equal_range(identifier);
+        worker.current_connections = static_cast<int>(std::count_if(begin, end, not_draining));
+    }
     for (auto& [room_id, room] : _rooms)
-        room.current_connections = tasks_by_rid.count(room_id);
+    {
+        auto [begin, end] = tasks_by_rid.equal_range(room_id);
+        room.current_connections = static_cast<int>(std::count_if(begin, end, not_draining));
+    }
 }
 
 void scheduler_session::check_worker_task_interval()
 {
     auto now = std::chrono::system_clock::now();
-    for (auto& [_, worker] : _workers)
+    std::vector<identifier_t> silent_workers;
+    for (auto& [identifier, worker] : _workers)
         if (now - worker.last_received > _worker_interval_threshold)
-        {
-            spdlog::warn(LOG_PREFIX "[{0:016x}] Worker exceeding max interval, disconnecting!", worker.current_connections);
-            delete_and_disconnect_worker(&worker);
-        }
+            silent_workers.push_back(identifier);
+    for (auto identifier : silent_workers)
+    {
+        spdlog::warn(LOG_PREFIX "[{0:016x}] Worker exceeding max interval, disconnecting!", identifier);
+        delete_and_disconnect_worker(&_workers.find(identifier)->second);
+    }
+
+    // Punish the worker, then hand the room over to another worker before unassigning.
+    std::vector<std::pair<identifier_t, room_id_t>> silent_tasks;
+    for (auto& task : _tasks)
+        if (!task.draining && now - task.last_received > _worker_interval_threshold)
+            silent_tasks.emplace_back(task.identifier, task.room_id);
+    for (auto [identifier, room_id] : silent_tasks)
+    {
+        spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Task exceeding max interval, unassigning!", identifier, room_id);
+        auto worker_iter = _workers.find(identifier);
+        if (worker_iter != _workers.end())
+            punish_worker(&worker_iter->second);
+        drain_task(identifier, room_id);
+    }
+    // Don't keep a draining task forever if the new worker never receives anything.
     for (auto it = _tasks.begin(); it != _tasks.end();)
-        if (now - it->last_received <= _worker_interval_threshold)
+        if (!it->draining || now - it->draining_since <= _handoff_timeout)
             ++it;
         else
         {
-            it = delete_task<tasks_by_identifier_and_room_id>(it);
-            spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Task exceeding max interval, unassigning!", it->identifier, it->room_id);
+            spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Handoff timed out, unassigning!", it->identifier, it->room_id);
+            send_unassign(it->identifier, it->room_id);
+            it = delete_task<tasks_by_identifier_and_room_id>(it, false);
         }
 }
 
@@ -195,10 +305,14 @@ void scheduler_session::check_all_states()
 
     spdlog::debug(LOG_PREFIX "Triggering check.");
 
+    _deduplicate.check_expire(current_time);
     // 检查最大间隔
     check_worker_task_interval();
     // 刷新所有计数器
     refresh_counts();
+    // 超时被排空的任务若已有其他任务接手，立即取消分配。
+    for (auto& [room_id, _] : _rooms)
+        finish_handoff(room_id);
 
     tasks_by_room_id_t& tasks_by_rid = _tasks.get<tasks_by_room_id>();
     // tasks_by_identifier_t& tasks_by_wid = _tasks.get<tasks_by_identifier>(); // unused
@@ -230,7 +344,7 @@ void scheduler_session::check_all_states()
             continue;
         }
         spdlog::info(LOG_PREFIX "Deleting inactive room {0}", room.room_id);
-        // disconnect all tasks in room
+        // disconnect all tasks in room. No one takes over an inactive room, so there's nothing to hand off.
         auto [begin, end] = tasks_by_rid.equal_range(it->first);
         for (auto task_iter = begin; task_iter != end;
              task_iter = delete_task<tasks_by_room_id>(task_iter))
@@ -255,10 +369,19 @@ void scheduler_session::check_all_states()
             // Too much workers on one single room. Unassign some.
             spdlog::debug(LOG_PREFIX "Too much workers on room {0}({2}). Try to unassign {1} rooms.", room_id, overkill, room.current_connections);
             auto [begin, end] = tasks_by_rid.equal_range(room_id);
-            auto task_iter = begin;
-            for (int i = 0; i < overkill && task_iter != end;
-                 i++, task_iter = delete_task<tasks_by_room_id>(task_iter, false))
-                send_unassign(task_iter->identifier, task_iter->room_id);
+            // Unassign tasks which haven't received anything first, the confirmed ones are known to work.
+            std::vector<std::pair<bool, identifier_t>> candidates;
+            for (auto task_iter = begin; task_iter != end; ++task_iter)
+                if (!task_iter->draining)
+                    candidates.emplace_back(task_iter->confirmed, task_iter->identifier);
+            std::stable_sort(candidates.begin(), candidates.end(),
+                             [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+            if (static_cast<int>(candidates.size()) > overkill)
+                candidates.resize(overkill);
+            // Make before break: unassign only after someone else is receiving data from the room.
+            for (auto [_, identifier] : candidates)
+                drain_task(identifier, room_id);
+            finish_handoff(room_id);
         }
         else if (underkill > 0)
         {
@@ -353,11 +476,25 @@ void scheduler_session::handle_buffer(
         delete_task(identifier, room_id);
         check_all_states();
     }
-    else if (op_code == worker_data_code)
+    else if (op_code == worker_data_code || op_code == worker_batch_data_code)
     {
-        if (payload_len < 33) // 1 + 4 + 4 + 24
+        auto batch = op_code == worker_batch_data_code;
+        size_t count = 1;
+        size_t header_length = worker_data_header_length;  // 1 + 4 + 8 + 24
+        if (batch)
+        {
+            if (payload_len < worker_batch_data_header_length)  // 1 + 4 + 4 + 24
+            {
+                SPDLOG_TRACE(LOG_PREFIX "Malformed batch data packet: payload len {}<{}!", payload_len, worker_batch_data_header_length);
+                return;
+            }
+            count = boost::asio::detail::socket_ops::network_to_host_long(
+                *reinterpret_cast<simple_message_header*>(payload_data + 5));
+            header_length = worker_batch_data_header_length + count * checksum_size;
+        }
+        if (payload_len < header_length || count == 0)
         {
-            SPDLOG_TRACE(LOG_PREFIX "Malformed data packet: wrong payload len {}!=33!", payload_len);
+            SPDLOG_TRACE(LOG_PREFIX "Malformed data packet: payload len {}<{}!", payload_len, header_length);
             return;
         }
 
@@ -366,17 +503,50 @@ void scheduler_session::handle_buffer(
         if (task_iter == idx.end())
             return;
 
+        auto first_data = !task_iter->confirmed;
         idx.modify(task_iter, [current_time](room_task& it) -> void
         {
             it.last_received = current_time;
+            it.confirmed = true;
         });
-        auto crc32 = *reinterpret_cast<unsigned long*>(payload_data + 5);
-        auto routing_key = reinterpret_cast<char*>(payload_data) + 9;
+        if (first_data && !task_iter->draining)
+            finish_handoff(room_id);  // the new task is receiving, so tasks draining from this room can go.
+
+        auto checksums = payload_data + (batch ? 9 : 5);
+        auto read_checksum = [checksums](size_t index) {
+            checksum_t checksum = 0;
+            for (size_t i = 0; i < checksum_size; i++)
+                checksum = checksum << 8 | checksums[index * checksum_size + i]; // big endian
+            return checksum;
+        };
+        auto routing_key = reinterpret_cast<char*>(payload_data) + header_length - routing_key_max_size;
         auto routing_key_len = strnlen(routing_key, routing_key_max_size);
-        spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Received data packet. payload_len={2}, CRC32={3}", identifier, room_id, payload_len - 33, crc32);
+        auto payload = payload_data + header_length;
+        auto length = payload_len - header_length;
+        spdlog::debug(LOG_PREFIX "[<{0:016x},{1}>] Received data packet. payload_len={2}, count={3}", identifier, room_id, length, count);
+
+        // 各 worker 拆分压缩包的方式不同，批量数据包中的消息也要逐条去重。
+        if (!batch)
+            handle_message(identifier, room_id, read_checksum(0), payload, length);
+        else if (!for_each_batch_message(payload, length, count, [&](size_t index, unsigned char* message, size_t message_length) {
+                     handle_message(identifier, room_id, read_checksum(index), message, message_length);
+                 }))
+            spdlog::warn(LOG_PREFIX "[<{0:016x},{1}>] Malformed batch data packet: payload doesn't hold {2} messages.", identifier, room_id, count);
+    }
+}
 
-        // TODO send out packet to MQ
+void scheduler_session::handle_message(
+    identifier_t identifier, room_id_t room_id, checksum_t checksum,
+    unsigned char* message, size_t length)
+{
+    if (!_deduplicate.check_and_add(checksum))
+    {
+        SPDLOG_TRACE(LOG_PREFIX "[<{0:016x},{1}>] Duplicated message. checksum={2:016x}", identifier, room_id, checksum);
+        return;
     }
+    SPDLOG_TRACE(LOG_PREFIX "[<{0:016x},{1}>] New message. len={2}, checksum={3:016x}", identifier, room_id, length, checksum);
+
+    // TODO send out packet to MQ
 }
 
 void scheduler_session::handle_worker_disconnect(identifier_t identifier)
@@ -386,6 +556,8 @@ void scheduler_session::handle_worker_disconnect(identifier_t identifier)
     auto iter = _workers.find(identifier);
     if (iter != _workers.end())
         delete_worker(&(iter->second));
+    // Reschedule the rooms of the worker.
+    check_all_states();
 }
 
 void scheduler_session::send_to_identifier(
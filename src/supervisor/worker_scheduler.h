@@ -1,5 +1,6 @@
 #pragma once
 #include "config.h"
+#include "deduplicate_context.h"
 #include "type.h"
 #include "worker_connection_manager.h"
 
@@ -38,11 +39,18 @@ struct room_task
     room_id_t room_id;
 
     std::chrono::system_clock::time_point last_received;
+    ///
+    /// Ƿյݡ
+    bool confirmed = false;
+    ///
+    /// Уȴͬһʼյݺȡ䡣뷿 worker 
+    bool draining = false;
+    std::chrono::system_clock::time_point draining_since;
     //std::weak_ptr<worker_status> worker; // is use shared_ptr + weak_ptr better than looking up unordered_map?
     //std::weak_ptr<room_status> room;
 
     room_task(identifier_t identifier, room_id_t room_id)
-        : identifier(identifier), room_id(room_id) {}
+        : identifier(identifier), room_id(room_id), last_received(std::chrono::system_clock::now()) {}
 };
 
 struct worker_status
@@ -121,9 +129,19 @@ private:
     std::chrono::system_clock::duration _min_check_interval;
     std::chrono::system_clock::duration _worker_interval_threshold;
     std::chrono::system_clock::duration _worker_penalty;
+    bool _handoff;
+    std::chrono::system_clock::duration _handoff_timeout;
+    ///
+    /// ͬһϢɶ worker յԭʼ json ָȥء
+    deduplicate_context _deduplicate;
+
+    ///
+    /// ȥزתһϢ
+    void handle_message(identifier_t identifier, room_id_t room_id, checksum_t checksum,
+                        unsigned char* message, size_t length);
 
     ///
-    /// ڸ worker \n
+    /// ڸ worker 񡣽Ӹ worker ķнеᱻָ\n
     /// Warning: not notifying the worker! \n
     /// <b> Worker  Room ļ</b>
     void clear_worker_tasks(identifier_t identifier);
@@ -149,6 +167,18 @@ private:
     /// @param room_id Room id of the room.
     /// @param desc_rank Whether to decrease the rank of the worker or not. When you aren't disconnecting the task because of error, this should be false.
     void delete_task(identifier_t identifier, room_id_t room_id, bool desc_rank = true);
+    ///
+    /// Ƴ worker ʱ䣬ܷʱۼӡ
+    void punish_worker(worker_status* worker);
+    ///
+    /// ȡһڹȡ䶼Ӧ\n
+    /// ȽϣΪУȷյݺ finish_handoff ȡ䣻
+    /// δ room-handoff ʱȡ䡣\n
+    ///  room  worker ļ
+    void drain_task(identifier_t identifier, room_id_t room_id);
+    ///
+    /// δڽյݵʱȡ÷не
+    void finish_handoff(room_id_t room_id);
 
     ///
     /// Assign a task to a worker.  room  worker ļ. \n
@@ -1,31 +1,50 @@
 #include "bili_conn.h"
 
 #include "bili_packet.h"
-#include "bilibili_connection_manager.h"
+#include "bilibili_shard.h"
 
 #include <boost/bind.hpp>
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bin_to_hex.h>
 
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+namespace vNerve::bilibili
+{
+// shared-read-slab 模式下允许的最大数据包，超过此大小的数据包仍会被跳过。
+const size_t max_spill_packet_size = 16 * 1024 * 1024;
+// 平常消息间隔的多少倍算作停滞。
+const double stall_gap_factor = 10;
+// 至少收到这么多个消息数据包后才判断停滞。
+const size_t stall_min_packets = 16;
+}
+
 vNerve::bilibili::bilibili_connection::bilibili_connection(
     const std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-    const std::shared_ptr<bilibili_connection_manager> session, int room_id)
-    : _read_buffer_size(session->get_options()["read-buffer"].as<size_t>()),
-      _session(session),
+    bilibili_shard* const shard, int room_id)
+    : _read_buffer(shard->get_read_slab() || shard->get_uring()
+                       ? mirrored_buffer()
+                       : mirrored_buffer(shard->get_options()["read-buffer"].as<size_t>())),
+      _shared_slab(shard->get_read_slab() != nullptr),
+      _tail(&shard->get_buffer_pool()),
+      _uring(shard->get_uring()),
+      _shard(shard),
       _socket(socket),
-      _heartbeat_timer(std::make_unique<boost::asio::deadline_timer>(
-          _session->get_io_context())),
       _room_id(room_id),
-      _heartbeat_interval_sec(
-          _session->get_options()["heartbeat-timeout"].as<int>())
+      _last_data_at(std::chrono::steady_clock::now())
 {
     spdlog::info("[conn] [room={}] Established connection to server.", room_id);
-    _read_buffer_ptr =
-        std::unique_ptr<unsigned char[]>(new unsigned char[_read_buffer_size]);
+    if (_shared_slab)
+    {
+        boost::system::error_code ec;
+        _socket->non_blocking(true, ec);
+    }
     start_read();
 
     auto str = new std::string(generate_join_room_packet(
-        room_id, session->get_options()["protocol-ver"].as<int>()));
+        room_id, shard->get_options()["protocol-ver"].as<int>()));
     auto buffer = boost::asio::buffer(*str);
     spdlog::debug(
         "[conn] [room={}] Sending handshake packet with payload(len={}): {:Xs}",
@@ -41,49 +60,77 @@ vNerve::bilibili::bilibili_connection::bilibili_connection(
 
 vNerve::bilibili::bilibili_connection::~bilibili_connection()
 {
-    close(false);
-}
-
-void vNerve::bilibili::bilibili_connection::reschedule_timer()
-{
-    spdlog::debug("[conn] [room={}] Scheduling heartbeat, interval={}",
-                  _room_id, _heartbeat_interval_sec);
-    _heartbeat_timer->expires_from_now(
-        boost::posix_time::seconds(_heartbeat_interval_sec));
-    _heartbeat_timer->async_wait(
-        boost::bind(&bilibili_connection::on_heartbeat_tick, this,
-                    boost::asio::placeholders::error));
+    // 正常关闭时 close() 已经通知过分片；走到这里说明分片正在析构，不能再回调分片。
+    close_socket();
 }
 
 void vNerve::bilibili::bilibili_connection::start_read()
 {
+#ifdef VNERVE_IO_URING
+    if (_uring)
+    {
+        // 一次 multishot 接收一直有效，直到连接关闭。
+        _uring_token = _uring->start_receive(_socket->native_handle(), this);
+        return;
+    }
+#endif
+    if (_shared_slab)
+    {
+        start_wait_readable();
+        return;
+    }
+    // 写入位置之后的空闲空间可能跨越缓冲区末尾，但由于双重映射，它总是连续的。
+    auto free_size = _read_buffer.size() - _read_filled;
     spdlog::trace(
-        "[conn] [room={}] Starting next async read. offset={}, size={}/{}",
-        _room_id, _read_buffer_offset, _read_buffer_size - _read_buffer_offset,
-        _read_buffer_size);
+        "[conn] [room={}] Starting next async read. head={}, filled={}, size={}/{}",
+        _room_id, _read_head, _read_filled, free_size, _read_buffer.size());
     _socket->async_receive(
-        boost::asio::buffer(_read_buffer_ptr.get() + _read_buffer_offset,
-                            _read_buffer_size - _read_buffer_offset),
+        boost::asio::buffer(_read_buffer.at(_read_head + _read_filled),
+                            free_size),
         boost::bind(&bilibili_connection::on_receive, this,
                     boost::asio::placeholders::error,
                     boost::asio::placeholders::bytes_transferred));
 }
 
-void vNerve::bilibili::bilibili_connection::close(const bool failed)
+void vNerve::bilibili::bilibili_connection::start_wait_readable()
+{
+    spdlog::trace("[conn] [room={}] Waiting for socket readable. tail={}/{}",
+                  _room_id, _tail_filled, _tail.capacity());
+    _socket->async_wait(
+        boost::asio::ip::tcp::socket::wait_read,
+        boost::bind(&bilibili_connection::on_readable, this,
+                    boost::asio::placeholders::error));
+}
+
+bool vNerve::bilibili::bilibili_connection::close_socket()
 {
     boost::system::error_code ec;
     if (!_socket)
-        return;
+        return false;
+#ifdef VNERVE_IO_URING
+    if (_uring_token)
+    {
+        _uring->stop_receive(_uring_token);
+        _uring_token = 0;
+    }
+#endif
     _socket->shutdown(boost::asio::socket_base::shutdown_both, ec);
     _socket->cancel(ec);
     _socket->close(ec);
-    _heartbeat_timer->cancel(ec);
 
     _socket.reset();
+    _tail.release();
+    _tail_filled = 0;
+    return true;
+}
 
+void vNerve::bilibili::bilibili_connection::close(const bool failed)
+{
+    if (!close_socket())
+        return;
     if (failed)
-        _session->on_room_failed(_room_id);
-    _session->on_room_closed(_room_id);
+        _shard->on_room_failed(_room_id);
+    _shard->on_room_closed(_room_id);
 }
 
 void vNerve::bilibili::bilibili_connection::on_join_room_sent(
@@ -103,12 +150,13 @@ void vNerve::bilibili::bilibili_connection::on_join_room_sent(
             "[conn] [room={}] Failed sending handshake packet! err:{}: {}",
             _room_id, err.value(), err.message());
         close(true);
+        return;
     }
 
     spdlog::debug(
         "[conn] [room={}] Sent handshake packet. Bytes transferred: {}",
         _room_id, transferred);
-    reschedule_timer();
+    _shard->schedule_heartbeat(_room_id);
 }
 
 void vNerve::bilibili::bilibili_connection::on_heartbeat_sent(
@@ -126,6 +174,7 @@ void vNerve::bilibili::bilibili_connection::on_heartbeat_sent(
             "[conn] [room={}] Failed sending heartbeat packet! err:{}: {}",
             _room_id, err.value(), err.message());
         close(true);
+        return;
     }
     // nothing to do.
     spdlog::debug(
@@ -133,32 +182,59 @@ void vNerve::bilibili::bilibili_connection::on_heartbeat_sent(
         _room_id, transferred);
 }
 
-void vNerve::bilibili::bilibili_connection::on_heartbeat_tick(
-    const boost::system::error_code& err)
+void vNerve::bilibili::bilibili_connection::send_heartbeat()
 {
-    if (err)
+    if (!_socket)
+        return;
+    auto& buf = _shard->get_heartbeat_buffer();
+    spdlog::trace("[conn] [room={}] Sending heartbeat packet(len={}).",
+                  _room_id, buf.size());
+#ifdef VNERVE_IO_URING
+    if (_uring)
     {
-        if (err.value() == boost::asio::error::operation_aborted)
-        {
-            spdlog::debug("[conn] [room={}] Cancelling heartbeat timer.",
-                          _room_id);
-            return;  // closing socket.
-        }
-        spdlog::warn("[conn] [room={}] Error in heartbeat tick! err:{}: {}",
-                     _room_id, err.value(), err.message());
+        // 同一次心跳时间轮中的发送一起提交。
+        _uring->send(_uring_token, buf.data(), buf.size());
+        return;
     }
-
-    auto& buf = _session->get_heartbeat_buffer();
-    auto buf_ptr = reinterpret_cast<const char*>(buf.data());
-    spdlog::debug(
-        "[conn] [room={}] Sending heartbeat packet with payload(len={}): {:Xs}",
-        _room_id, buf.size(), spdlog::to_hex(buf_ptr, buf_ptr + buf.size()));
+#endif
     _socket->async_send(
         buf, boost::bind(&bilibili_connection::on_heartbeat_sent, this,
                          boost::asio::placeholders::error,
                          boost::asio::placeholders::bytes_transferred));
+}
 
-    reschedule_timer();
+std::pair<size_t, size_t> vNerve::bilibili::bilibili_connection::handle_read(
+    unsigned char* buf, const size_t filled, const size_t padding, const size_t buffer_size)
+{
+    auto end = buf + filled + padding;
+    return split_buffer(buf, filled, buffer_size, _skipping_bytes,
+                        [this, end](unsigned char* packet, const size_t length) {
+                            // compressed packets carry the json_message op code as well.
+                            if (reinterpret_cast<bilibili_packet_header*>(packet)->op_code() == json_message)
+                                on_data_packet();
+                            if (_shard->parses_inline())
+                                handle_packet(packet, end - (packet + length), _room_id,
+                                              [this](const borrowed_message* message) { _shard->on_room_data(_room_id, message); });
+                            else
+                                _shard->submit_packet(_room_id, packet, length);
+                        });
+}
+
+void vNerve::bilibili::bilibili_connection::on_data_packet()
+{
+    auto now = std::chrono::steady_clock::now();
+    auto gap = std::chrono::duration<double>(now - _last_data_at).count();
+    _data_gap_avg_sec = _data_packets == 0 ? gap : 0.9 * _data_gap_avg_sec + 0.1 * gap;
+    _data_packets++;
+    _last_data_at = now;
+}
+
+bool vNerve::bilibili::bilibili_connection::stalled(const std::chrono::steady_clock::time_point now, const std::chrono::seconds timeout) const
+{
+    if (_data_packets < stall_min_packets || _data_gap_avg_sec <= 0)
+        return false;  // no baseline yet.
+    auto silence = std::chrono::duration<double>(now - _last_data_at).count();
+    return silence > std::max(static_cast<double>(timeout.count()), _data_gap_avg_sec * stall_gap_factor);
 }
 
 void vNerve::bilibili::bilibili_connection::on_receive(
@@ -175,16 +251,20 @@ void vNerve::bilibili::bilibili_connection::on_receive(
         spdlog::warn("[conn] [room={}] Error in async recv! err:{}: {}",
                      _room_id, err.value(), err.message());
         close(true);
+        return;
     }
 
     spdlog::debug("[conn] [room={}] Received data block(len={})", _room_id,
                   transferred);
     try
     {
-        auto [new_offset, new_skipping_bytes] =
-            handle_buffer(_read_buffer_ptr.get(), transferred, _read_buffer_size,
-                          _skipping_bytes, std::bind(&bilibili_connection_manager::on_room_data, _session, _room_id, std::placeholders::_1));
-        _read_buffer_offset = new_offset;
+        _read_filled += transferred;
+        // at() 只保证之后有 size() + 1 个连续字节，填充不足时 json 会被复制一份。
+        auto [consumed, new_skipping_bytes] =
+            handle_read(_read_buffer.at(_read_head), _read_filled, _read_buffer.size() + 1 - _read_filled,
+                        _read_buffer.size());
+        _read_head = (_read_head + consumed) % _read_buffer.size();
+        _read_filled -= consumed;
         _skipping_bytes = new_skipping_bytes;
     }
     catch (malformed_packet&)
@@ -195,3 +275,119 @@ void vNerve::bilibili::bilibili_connection::on_receive(
 
     start_read();
 }
+
+void vNerve::bilibili::bilibili_connection::on_readable(const boost::system::error_code& err)
+{
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+        {
+            spdlog::debug("[conn] [room={}] Cancelling async waiting.",
+                          _room_id);
+            return;  // closing socket.
+        }
+        spdlog::warn("[conn] [room={}] Error in async wait! err:{}: {}",
+                     _room_id, err.value(), err.message());
+        close(true);
+        return;
+    }
+
+    // 不完整的数据包能放进共用缓冲区时，把它复制到共用缓冲区开头，之后的数据接着读进来；
+    // 否则（数据包比共用缓冲区还大）直接读进 _tail。
+    size_t pending_length = 0;
+    if (_tail_filled >= sizeof(bilibili_packet_header))
+        pending_length = reinterpret_cast<bilibili_packet_header*>(_tail.data())->length();
+    unsigned char* target;
+    size_t target_size;  // 之后另有 json_padding 个字节。
+    if (pending_length > _shard->get_read_slab_size())
+    {
+        _tail.reserve(pending_length + json_padding, _tail_filled);
+        target = _tail.data();
+        target_size = _tail.capacity() - json_padding;
+    }
+    else
+    {
+        target = _shard->get_read_slab();
+        target_size = _shard->get_read_slab_size();
+        if (_tail_filled)
+            std::memcpy(target, _tail.data(), _tail_filled);
+    }
+
+    boost::system::error_code ec;
+    auto transferred = _socket->read_some(
+        boost::asio::buffer(target + _tail_filled, target_size - _tail_filled), ec);
+    if (ec == boost::asio::error::would_block)
+    {
+        start_wait_readable();
+        return;
+    }
+    if (ec)
+    {
+        spdlog::warn("[conn] [room={}] Error in recv! err:{}: {}",
+                     _room_id, ec.value(), ec.message());
+        close(true);
+        return;
+    }
+
+    spdlog::debug("[conn] [room={}] Received data block(len={}, tail={})", _room_id,
+                  transferred, _tail_filled);
+    auto filled = _tail_filled + transferred;
+    if (handle_shared_read(target, filled, target_size + json_padding - filled))
+        return;
+
+    start_wait_readable();
+}
+
+bool vNerve::bilibili::bilibili_connection::handle_shared_read(unsigned char* target, const size_t filled,
+                                                              const size_t padding)
+{
+    try
+    {
+        auto [consumed, new_skipping_bytes] =
+            handle_read(target, filled, padding, max_spill_packet_size);
+        _skipping_bytes = new_skipping_bytes;
+        _tail_filled = filled - consumed;
+        if (!_tail_filled)
+            _tail.release();
+        else if (target != _tail.data() || consumed)
+            _tail.assign(target + consumed, _tail_filled, _tail_filled + 1);
+        // else: an oversized packet is still being read into _tail.
+    }
+    catch (malformed_packet&)
+    {
+        close(true);
+        return true;
+    }
+    return false;
+}
+
+void vNerve::bilibili::bilibili_connection::on_uring_receive(unsigned char* data, const size_t size)
+{
+    spdlog::debug("[conn] [room={}] Received data block(len={}, tail={})", _room_id,
+                  size, _tail_filled);
+    if (!_tail_filled)
+    {
+        // 缓冲区环中的缓冲区之后留有填充，直接在其中解析，只有不完整的数据包被复制进 _tail。
+        handle_shared_read(data, size, json_padding);
+        return;
+    }
+
+    // 内核不会把数据接在 _tail 后面，只能复制过去。数据包头部已经读到时，一次分配到整个数据包的大小。
+    size_t pending_length = 0;
+    if (_tail_filled >= sizeof(bilibili_packet_header))
+        pending_length = reinterpret_cast<bilibili_packet_header*>(_tail.data())->length();
+    auto filled = _tail_filled + size;
+    _tail.reserve(std::max(pending_length, filled) + json_padding, _tail_filled);
+    std::memcpy(_tail.data() + _tail_filled, data, size);
+    handle_shared_read(_tail.data(), filled, _tail.capacity() - filled);
+}
+
+void vNerve::bilibili::bilibili_connection::on_uring_error(const int err)
+{
+    if (err)
+        spdlog::warn("[conn] [room={}] Error in io_uring! err:{}: {}",
+                     _room_id, err, std::system_category().message(err));
+    else
+        spdlog::warn("[conn] [room={}] Connection closed by server.", _room_id);
+    close(true);
+}
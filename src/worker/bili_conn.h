@@ -1,40 +1,81 @@
 #pragma once
 
+#include "buffer_pool.h"
+#include "mirrored_buffer.h"
+#include "uring_context.h"
+
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <utility>
 
 #include <boost/asio.hpp>
 
 namespace vNerve::bilibili
 {
-class bilibili_connection_manager;
-class bilibili_connection
+class bilibili_shard;
+class bilibili_connection : public uring_receiver
 {
 private:
-    std::unique_ptr<unsigned char[]> _read_buffer_ptr;
-    size_t _read_buffer_size;
-    size_t _read_buffer_offset = 0;
+    ///
+    /// 环形读缓冲区。[_read_head, _read_head + _read_filled) 为尚未处理完的数据。
+    mirrored_buffer _read_buffer;
+    size_t _read_head = 0;
+    size_t _read_filled = 0;
     size_t _skipping_bytes = 0;
+    ///
+    /// shared-read-slab 模式下，数据读入分片共用的缓冲区，连接只在 _tail 中保留不完整的数据包。
+    /// 超出共用缓冲区大小的数据包直接读入 _tail。
+    bool _shared_slab = false;
+    pooled_buffer _tail;
+    size_t _tail_filled = 0;
+    ///
+    /// io-uring 模式下，数据由分片的 uring_context 读入共用的缓冲区环，与 shared-read-slab 一样只保留 _tail。
+    uring_context* _uring = nullptr;
+    uint64_t _uring_token = 0;
 
-    std::shared_ptr<bilibili_connection_manager> _session;
+    bilibili_shard* _shard;
     std::shared_ptr<boost::asio::ip::tcp::socket> _socket;
 
-    std::unique_ptr<boost::asio::deadline_timer> _heartbeat_timer;
-
     int _room_id;
-    int _heartbeat_interval_sec;
 
-    void reschedule_timer();
+    ///
+    /// 用于检测停滞的房间：心跳正常但长时间没有收到消息。
+    /// 收到足够多的消息、有了平常的间隔之后才判断停滞，安静或未开播的房间不会被当作停滞。
+    std::chrono::steady_clock::time_point _last_data_at;
+    double _data_gap_avg_sec = 0;
+    size_t _data_packets = 0;
+
+    void on_data_packet();
+    ///
+    /// 关闭 socket 并归还缓冲区，不通知分片。
+    /// @return 是否是第一次关闭。
+    bool close_socket();
+
     void start_read();
+    void start_wait_readable();
+    ///
+    /// 处理读到的数据：就地解析，或把完整的数据包交给解析线程池。参数与返回值见 handle_buffer。
+    std::pair<size_t, size_t> handle_read(unsigned char* buf, size_t filled, size_t padding, size_t buffer_size);
+    ///
+    /// 处理读进共用缓冲区（或 _tail）的 [target, target + filled)，把不完整的数据包留在 _tail 中。
+    /// @param padding target + filled 之后可读的字节数，见 handle_packet。
+    /// @return 是否因为数据包格式错误而关闭了连接。
+    bool handle_shared_read(unsigned char* target, size_t filled, size_t padding);
 
     void on_join_room_sent(const boost::system::error_code&, size_t,
                            std::string*);
     void on_heartbeat_sent(const boost::system::error_code&, size_t);
-    void on_heartbeat_tick(const boost::system::error_code&);
     void on_receive(const boost::system::error_code&, size_t);
+    void on_readable(const boost::system::error_code&);
+    void on_uring_receive(unsigned char* data, size_t size) override;
+    void on_uring_error(int err) override;
 
 public:
     bilibili_connection(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-                        std::shared_ptr<bilibili_connection_manager> session, int room_id);
+                        bilibili_shard* shard, int room_id);
+    ///
+    /// 只关闭 socket，不回调分片：连接只会在 close() 之后被分片删除，或随分片一起析构。
     ~bilibili_connection();
 
     bilibili_connection(const bilibili_connection& other) = delete;
@@ -42,32 +83,62 @@ public:
 
     bilibili_connection(bilibili_connection&& other) noexcept
     {
-        _read_buffer_ptr = std::move(other._read_buffer_ptr);
-        _read_buffer_size = other._read_buffer_size;
-        _read_buffer_offset = other._read_buffer_offset;
+        _read_buffer = std::move(other._read_buffer);
+        _read_head = other._read_head;
+        _read_filled = other._read_filled;
         _skipping_bytes = other._skipping_bytes;
-        _session = std::move(other._session);
+        _shared_slab = other._shared_slab;
+        _tail = std::move(other._tail);
+        _tail_filled = other._tail_filled;
+        _uring = other._uring;
+        _uring_token = other._uring_token;
+        other._uring_token = 0;
+#ifdef VNERVE_IO_URING
+        if (_uring_token)
+            _uring->rebind(_uring_token, this);
+#endif
+        _shard = other._shard;
         _socket = std::move(other._socket);
-        _heartbeat_timer = std::move(other._heartbeat_timer);
         _room_id = other._room_id;
-        _heartbeat_interval_sec = other._heartbeat_interval_sec;
+        _last_data_at = other._last_data_at;
+        _data_gap_avg_sec = other._data_gap_avg_sec;
+        _data_packets = other._data_packets;
     }
     bilibili_connection& operator=(bilibili_connection&& other) noexcept
     {
         if (this == &other)
             return *this;
-        _read_buffer_ptr = std::move(other._read_buffer_ptr);
-        _read_buffer_size = other._read_buffer_size;
-        _read_buffer_offset = other._read_buffer_offset;
+        _read_buffer = std::move(other._read_buffer);
+        _read_head = other._read_head;
+        _read_filled = other._read_filled;
         _skipping_bytes = other._skipping_bytes;
-        _session = std::move(other._session);
+        _shared_slab = other._shared_slab;
+        _tail = std::move(other._tail);
+        _tail_filled = other._tail_filled;
+        _uring = other._uring;
+        _uring_token = other._uring_token;
+        other._uring_token = 0;
+#ifdef VNERVE_IO_URING
+        if (_uring_token)
+            _uring->rebind(_uring_token, this);
+#endif
+        _shard = other._shard;
         _socket = std::move(other._socket);
-        _heartbeat_timer = std::move(other._heartbeat_timer);
         _room_id = other._room_id;
-        _heartbeat_interval_sec = other._heartbeat_interval_sec;
+        _last_data_at = other._last_data_at;
+        _data_gap_avg_sec = other._data_gap_avg_sec;
+        _data_packets = other._data_packets;
         return *this;
     }
 
+    ///
+    /// 关闭连接并通知分片，分片随即删除本对象。
     void close(bool failed = false);
+    ///
+    /// 发送一次心跳。由 bilibili_shard 的心跳时间轮调用。
+    void send_heartbeat();
+    ///
+    /// @return 距上次收到消息的时间是否远超过平常的间隔，且不短于 timeout。收到的消息太少时总是 false。
+    [[nodiscard]] bool stalled(std::chrono::steady_clock::time_point now, std::chrono::seconds timeout) const;
 };
 }  // namespace vNerve::bilibili
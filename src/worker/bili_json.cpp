@@ -1,29 +1,43 @@
 #include "bili_json.h"
 
 #include "borrowed_message.h"
+#include "field_mapping.h"
+#include "fingerprint.h"
+#include "json_path_handler.h"
+#include "json_path_lookup.h"
+#include "perfect_hash.h"
+#include "utf8_validate.h"
+#include "wire_writer.h"
 #include "vNerve/bilibili/live/room_message.pb.h"
 #include "vNerve/bilibili/live/user_message.pb.h"
 
-#define CRCPP_USE_CPP11
-#include <CRC.h>
-#include <robin_hood.h>
 #include <boost/thread/tss.hpp>
 #include <rapidjson/allocators.h>
 #include <rapidjson/document.h>
 #include <rapidjson/encodings.h>
-#include <google/protobuf/arena.h>
+#include <rapidjson/reader.h>
+#if defined(VNERVE_JSON_SIMDJSON)
+#include <simdjson.h>
+#endif
+#include <google/protobuf/descriptor.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <cstring>
+#include <iterator>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <utility>
-#include <functional>
+#include <vector>
 
-using std::function;
-using std::string;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-using google::protobuf::Arena;
 using vNerve::bilibili::live::RoomMessage;
 
 using MemoryPoolAllocator = rapidjson::MemoryPoolAllocator<>;
@@ -31,75 +45,481 @@ using Document = rapidjson::GenericDocument<rapidjson::UTF8<>, MemoryPoolAllocat
 
 namespace vNerve::bilibili
 {
-class borrowed_bilibili_message : public borrowed_message
+const size_t JSON_BUFFER_SIZE = 128 * 1024;
+const size_t PARSE_BUFFER_SIZE = 32 * 1024;
+const size_t WIRE_BUFFER_SIZE = 8 * 1024;
+// 批量消息中每条 RoomMessage 所在的字段，相当于 repeated RoomMessage messages = 1。
+const int BATCH_ENTRY_FIELD = 1;
+#if defined(VNERVE_JSON_SIMDJSON)
+static_assert(json_padding >= simdjson::SIMDJSON_PADDING, "json_padding is too small for in-place parsing.");
+#endif
+
+// 所有支持的 cmd。新增 cmd 时在这里登记，并在下方定义处理函数：
+// 一般用 SAX(name) 登记，在 name_FIELDS 中写出 json 路径到字段的映射，由 FIELD_MAPPING 生成处理代码，
+// 再用 SAX_CMD(name) 定义处理函数，把取出的字段写成 protobuf；不构建 DOM，一趟扫描取出字段。
+// 映射表无法表达的 cmd 用 DOM(name) 登记、CMD(name) 定义。
+#define BILI_COMMANDS(DOM, SAX) \
+    SAX(DANMU_MSG)              \
+    SAX(SUPER_CHAT_MESSAGE)     \
+    SAX(SEND_GIFT)              \
+    SAX(GUARD_BUY)
+
+class json_input;
+// 处理函数把 RoomMessage.user_message 直接写进 wire_writer，room_id 已经写好。
+using command_handler = bool (*)(const unsigned int&, const Document&, const borrowed_message&, wire_writer&);
+using command_extractor = bool (*)(json_input&, const unsigned int&, const borrowed_message&, wire_writer&);
+
+#define DECLARE_CMD(name) bool cmd_##name(const unsigned int&, const Document&, const borrowed_message&, wire_writer&);
+#define DECLARE_SAX_CMD(name) bool sax_##name(json_input&, const unsigned int&, const borrowed_message&, wire_writer&);
+BILI_COMMANDS(DECLARE_CMD, DECLARE_SAX_CMD)
+#undef DECLARE_CMD
+#undef DECLARE_SAX_CMD
+
+///
+/// cmd 的完美哈希表，见 perfect_hash_table。
+namespace command_table
 {
-public:
-    // 友元必须在函数内声明 没法用宏批量定义
-    // 只好从private挪进public 反正内部类无伤大雅
-    RoomMessage* _message;
-
-    borrowed_bilibili_message(RoomMessage* message)
-        : _message(message) {}
-    ~borrowed_bilibili_message() {}
-    size_t size() override { return _message->ByteSizeLong(); }
-    void write(void* data, int size) override { _message->SerializeToArray(data, size); }
+struct entry
+{
+    std::string_view name;
+    command_handler handler = nullptr;
+    command_extractor extractor = nullptr;
 };
 
-const size_t JSON_BUFFER_SIZE = 128 * 1024;
-const size_t PARSE_BUFFER_SIZE = 32 * 1024;
-const CRC::Table<uint32_t, 32> crc_lookup_table(CRC::CRC_32());
+#define COMMAND_ENTRY(name) entry{#name, cmd_##name, nullptr},
+#define SAX_COMMAND_ENTRY(name) entry{#name, nullptr, sax_##name},
+constexpr entry commands[] = {BILI_COMMANDS(COMMAND_ENTRY, SAX_COMMAND_ENTRY)};
+#undef COMMAND_ENTRY
+#undef SAX_COMMAND_ENTRY
+constexpr size_t command_count = sizeof(commands) / sizeof(entry);
+constexpr perfect_hash_table<entry, command_count> slots(commands);
+constexpr size_t slots_size = decltype(slots)::slot_count();
+
+// 由 set_command_filter 在开始解析前设置，之后只读。
+bool enabled[slots_size];
+bool enabled_inited = (std::fill(std::begin(enabled), std::end(enabled), true), true);
+
+///
+/// @return cmd 对应的表项。不支持或被过滤掉的 cmd 返回 nullptr。
+inline const entry* find(const std::string_view name)
+{
+    auto index = slots.index_of(name);
+    return index != slots.npos && enabled[index] ? &slots.slot(index) : nullptr;
+}
+}  // namespace command_table
 
-robin_hood::unordered_map<string, function<bool(const unsigned int&, const Document&, const borrowed_bilibili_message&, Arena*)>> command;
+void set_command_filter(const std::vector<std::string>& allow, const std::vector<std::string>& deny)
+{
+    for (auto names : {&allow, &deny})
+        for (auto& name : *names)
+            if (std::none_of(std::begin(command_table::commands), std::end(command_table::commands),
+                             [&name](const command_table::entry& command) { return command.name == name; }))
+                spdlog::warn("[bili_json] Unsupported cmd in cmd filter: {}", name);
+
+    for (size_t i = 0; i < command_table::slots_size; i++)
+    {
+        auto name = command_table::slots.slot(i).name;
+        if (name.empty())
+            continue;
+        auto listed = [name](const std::vector<std::string>& names) -> bool {
+            return std::find(names.begin(), names.end(), name) != names.end();
+        };
+        command_table::enabled[i] = (allow.empty() || listed(allow)) && !listed(deny);
+        spdlog::debug("[bili_json] cmd {}: {}", name, command_table::enabled[i] ? "enabled" : "disabled");
+    }
+}
+
+///
+/// 找到 [begin, end) 中第一个引号或反斜杠。
+const char* find_quote_or_escape(const char* begin, const char* end)
+{
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    const auto quote = _mm_set1_epi8('"');
+    const auto escape = _mm_set1_epi8('\\');
+    for (; end - begin >= 16; begin += 16)
+    {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        auto mask = static_cast<unsigned int>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, escape))));
+        if (mask)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return begin + index;
+#else
+            return begin + __builtin_ctz(mask);
+#endif
+        }
+    }
+#endif
+    for (; begin < end; begin++)
+        if (*begin == '"' || *begin == '\\')
+            return begin;
+    return end;
+}
+
+inline bool is_json_whitespace(const char ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+}
+
+inline const char* skip_json_whitespace(const char* begin, const char* end)
+{
+    while (begin < end && is_json_whitespace(*begin))
+        begin++;
+    return begin;
+}
+
+///
+/// 不解析 json，直接从原始数据中取出 cmd 的值。
+/// 只认作为顶层对象第一个键、且不含转义字符的 cmd（bilibili 总是这样发送），其余情况返回 false，需要完整解析。
+bool peek_cmd(const char* buf, const size_t length, std::string_view& cmd)
+{
+    auto end = buf + length;
+    auto key = find_quote_or_escape(buf, end);
+    if (end - key < 5 || std::memcmp(key, "\"cmd\"", 5) != 0)
+        return false;
+    // 第一个引号之前只能有一个 '{'，否则 "cmd" 可能不在顶层。
+    auto prefix = skip_json_whitespace(buf, key);
+    if (prefix == key || *prefix != '{' || skip_json_whitespace(prefix + 1, key) != key)
+        return false;
+
+    auto ptr = skip_json_whitespace(key + 5, end);
+    if (ptr == end || *ptr != ':')
+        return false;
+    ptr = skip_json_whitespace(ptr + 1, end);
+    if (ptr == end || *ptr != '"')
+        return false;
+    auto value_begin = ptr + 1;
+    auto value_end = find_quote_or_escape(value_begin, end);
+    if (value_end == end || *value_end != '"')
+        return false;
+    cmd = std::string_view(value_begin, value_end - value_begin);
+    return true;
+}
+
+///
+/// SAX 处理函数的输入。
+/// 预先取得 cmd 时直接用 Reader 原地解析原始数据；否则 json 已被解析为 DOM，由 Document::Accept 重放事件。
+/// 使用 simdjson 时不产生事件，按映射表中的路径直接从 on-demand 文档中取值。
+class json_input
+{
+private:
+    rapidjson::Reader* _reader = nullptr;
+    char* _buf = nullptr;
+    const Document* _document = nullptr;
+#if defined(VNERVE_JSON_SIMDJSON)
+    simdjson::ondemand::document* _ondemand = nullptr;
+    char* _strings = nullptr;
+    size_t _strings_size = 0;
+#endif
+
+public:
+    json_input(rapidjson::Reader& reader, char* buf) : _reader(&reader), _buf(buf) {}
+    explicit json_input(const Document& document) : _document(&document) {}
+#if defined(VNERVE_JSON_SIMDJSON)
+    ///
+    /// @param strings 存放取出的字符串，见 json_path_lookup。
+    json_input(simdjson::ondemand::document& document, char* strings, const size_t strings_size)
+        : _ondemand(&document), _strings(strings), _strings_size(strings_size)
+    {
+    }
+#endif
+
+    ///
+    /// @return 是否成功取得所需的字段。handler 提前结束时不再检查之后的数据。
+    template <typename Handler>
+    bool parse(Handler& handler)
+    {
+#if defined(VNERVE_JSON_SIMDJSON)
+        if (_ondemand)
+        {
+            json_path_lookup lookup(*_ondemand, _strings, _strings_size);
+            return handler.lookup(lookup);
+        }
+#endif
+        if (_document)
+            _document->Accept(handler);
+        else
+        {
+            rapidjson::InsituStringStream stream(_buf);
+            auto result = _reader->Parse<rapidjson::kParseInsituFlag>(stream, handler);
+            if (result.IsError() && !handler.finished())
+            {
+                SPDLOG_TRACE("[bili_json] bilibili json parse failed: {} at {}", static_cast<int>(result.Code()), result.Offset());
+                return false;
+            }
+        }
+        return !handler.failed();
+    }
+};
 
 class parse_context
 {
 private:
     unsigned char _json_buffer[JSON_BUFFER_SIZE];
     unsigned char _parse_buffer[PARSE_BUFFER_SIZE];
+    unsigned char _wire_buffer[WIRE_BUFFER_SIZE];
     MemoryPoolAllocator _value_allocator;
     MemoryPoolAllocator _stack_allocator;
     Document _document;
-    Arena _arena;
-    borrowed_bilibili_message _borrowed_bilibili_message;
+    rapidjson::Reader _reader;  // 栈在多次解析间复用。
+#if defined(VNERVE_JSON_SIMDJSON)
+    simdjson::ondemand::parser _ondemand_parser;
+    std::vector<char> _padded_buffer;  // 数据之后的填充不足时复制到这里。
+    std::vector<char> _string_buffer;  // 取出的字符串，见 json_path_lookup。
+#endif
+    wire_writer _writer;
+    borrowed_message _borrowed_message;
+    size_t _document_high_water = 0;
+    int _batch_depth = 0;
+    std::vector<checksum_t> _batch_checksum;
+
+    const borrowed_message* borrow()
+    {
+        _borrowed_message._data = _writer.data();
+        _borrowed_message._length = _writer.size();
+        _borrowed_message.count = 1;
+        _borrowed_message.batch_checksum = nullptr;
+        return &_borrowed_message;
+    }
+
+    ///
+    /// 释放上一条消息占用的内存。超出初始内存块的部分在这里归还，每个线程的常驻内存不随运行时间增长。
+    void reset_message()
+    {
+        if (_writer.reset() && _writer.high_water() > WIRE_BUFFER_SIZE)
+            spdlog::debug("[bili_json] Encoded message of {} bytes exceeded the wire buffer.", _writer.high_water());
+#if defined(VNERVE_JSON_SIMDJSON)
+        if (_padded_buffer.size() > JSON_BUFFER_SIZE + simdjson::SIMDJSON_PADDING)
+        {
+            _padded_buffer.resize(JSON_BUFFER_SIZE + simdjson::SIMDJSON_PADDING);
+            _padded_buffer.shrink_to_fit();
+        }
+        if (_string_buffer.size() > JSON_BUFFER_SIZE)
+        {
+            _string_buffer.resize(JSON_BUFFER_SIZE);
+            _string_buffer.shrink_to_fit();
+        }
+#endif
+    }
+
+    ///
+    /// MemoryPoolAllocator 只分配不释放，DOM 用完后必须清空，否则每次解析都会申请新的内存块。
+    void reset_document()
+    {
+        auto used = _value_allocator.Size() + _stack_allocator.Size();
+        if (used > _document_high_water)
+        {
+            _document_high_water = used;
+            SPDLOG_DEBUG("[bili_json] New DOM memory high-water mark: {} bytes.", used);
+        }
+        // 文档的栈在解析结束时已经释放，值则不再被访问，下次解析会覆盖。
+        _value_allocator.Clear();
+        _stack_allocator.Clear();
+    }
 
 public:
     parse_context()
         : _value_allocator(&_json_buffer, JSON_BUFFER_SIZE),
           _stack_allocator(&_parse_buffer, PARSE_BUFFER_SIZE),
           _document(&_value_allocator, PARSE_BUFFER_SIZE, &_stack_allocator),
-          // 类成员按声明顺序初始化
-          // _arena({256, 8192}),
-          _borrowed_bilibili_message(Arena::CreateMessage<RoomMessage>(&_arena))
+          _writer(_wire_buffer, WIRE_BUFFER_SIZE)
     {
+#if defined(VNERVE_JSON_SIMDJSON)
+        _padded_buffer.resize(JSON_BUFFER_SIZE + simdjson::SIMDJSON_PADDING);
+        _string_buffer.resize(JSON_BUFFER_SIZE);
+#endif
     }
     ///
     /// 用于处理拆开数据包获得的json。
     /// @param buf json的缓冲区，将在函数中复用。
-    /// @param length 原始json的长度，生成CRC时使用。
+    /// @param length 原始json的长度，计算指纹时使用。
     /// @param room_id 消息所在的房间号。
-    /// @return json转换为的protobuf序列化后的buffer。
-    const borrowed_bilibili_message* serialize(char* buf, const size_t& length, const unsigned int& room_id)
+    /// @param padding buf + length 之后可读的字节数。
+    /// @return json转换为的 RoomMessage 序列化后的buffer。
+    const borrowed_message* serialize(char* buf, const size_t& length, const unsigned int& room_id, const size_t padding)
+    {
+        // 不需要的 cmd 在解析 json 和计算指纹之前就丢弃。
+        std::string_view peeked_cmd;
+        const command_table::entry* command = nullptr;
+        if (peek_cmd(buf, length, peeked_cmd))
+        {
+            command = command_table::find(peeked_cmd);
+            if (!command)
+            {
+                SPDLOG_TRACE("[bili_json] Skipping cmd: {}", peeked_cmd);
+                return nullptr;
+            }
+        }
+
+        if (!_batch_depth)
+            reset_message();  // 上一条消息已经被回调处理完。
+        auto start = _writer.size();
+        auto entry = _batch_depth ? _writer.begin(BATCH_ENTRY_FIELD) : 0;
+        auto checksum = fingerprint(buf, length, room_id);  // 在解析改写 buf 之前计算。
+        _writer.varint(RoomMessage::kRoomIdFieldNumber, room_id);
+        auto succeeded = parse(buf, length, padding, room_id, command);
+        if (!_batch_depth)
+        {
+            _borrowed_message.checksum = checksum;
+            return succeeded ? borrow() : nullptr;
+        }
+        if (succeeded)
+        {
+            _writer.end(entry);
+            _batch_checksum.push_back(checksum);
+        }
+        else
+            _writer.truncate(start);
+        return nullptr;
+    }
+
+    void begin_batch()
     {
-        _borrowed_bilibili_message._message->Clear();
-        _borrowed_bilibili_message.crc32 = CRC::Calculate(buf, length, crc_lookup_table);  // 这个库又会做多少内存分配呢（已经不在乎了
+        if (_batch_depth++)
+            return;  // 嵌套的压缩包并入外层的批量消息。
+        reset_message();
+        _batch_checksum.clear();
+    }
+
+    const borrowed_message* end_batch()
+    {
+        if (--_batch_depth || _batch_checksum.empty())
+            return nullptr;
+        if (_batch_checksum.size() == 1)
+        {
+            // 只有一条消息时去掉外层的字段头，与单条消息的格式相同。
+            auto data = _writer.data() + 1;  // 字段号 1 的 tag 只占一个字节。
+            while (*data++ & 0x80)
+                ;
+            _borrowed_message._data = data;
+            _borrowed_message._length = _writer.data() + _writer.size() - data;
+            _borrowed_message.checksum = _batch_checksum.front();
+            _borrowed_message.count = 1;
+            _borrowed_message.batch_checksum = nullptr;
+            return &_borrowed_message;
+        }
+        _borrowed_message._data = _writer.data();
+        _borrowed_message._length = _writer.size();
+        _borrowed_message.checksum = 0;  // 每条消息的指纹在 batch_checksum 中。
+        _borrowed_message.count = _batch_checksum.size();
+        _borrowed_message.batch_checksum = _batch_checksum.data();
+        return &_borrowed_message;
+    }
+
+private:
+    ///
+    /// 解析 json，把 RoomMessage 剩余的字段写入 _writer。
+    bool parse(char* buf, const size_t length, const size_t padding, const unsigned int room_id,
+               const command_table::entry* command)
+    {
+#if defined(VNERVE_JSON_SIMDJSON)
+        return serialize_ondemand(buf, length, padding, room_id, command);
+#else
+        // rapidjson 不检查编码，字符串原样写入 RoomMessage，在这里一次性检查整条 json。
+        // simdjson 解析时已经检查过，不需要这一步。
+        if (!is_valid_utf8(buf, length))
+        {
+            SPDLOG_TRACE("[bili_json] bilibili json is not valid UTF-8.");
+            return false;
+        }
+        if (command && command->extractor)
+        {
+            // 不构建 DOM。
+            json_input input(_reader, buf);
+            return command->extractor(input, room_id, _borrowed_message, _writer);
+        }
+
         _document.ParseInsitu(buf);
-        _borrowed_bilibili_message._message->set_room_id(room_id);
-        if (!(_document.HasMember("cmd")
-              && _document["cmd"].IsString()))
+        auto result = serialize_document(room_id);
+        reset_document();  // 消息已经写入 _writer，不再需要 DOM。
+        return result;
+#endif
+    }
+#if !defined(VNERVE_JSON_SIMDJSON)
+    bool serialize_document(const unsigned int room_id)
+    {
+        if (_document.HasParseError()
+            || !(_document.IsObject()
+                 && _document.HasMember("cmd")
+                 && _document["cmd"].IsString()))
         {
             SPDLOG_TRACE("[bili_json] bilibili json cmd type check failed");
-            return nullptr;
+            return false;
         }
-        // TODO: 使用boost::multiindex配合robin_hood::hash魔改robin_hood::unordered_map来避免无意义的内存分配
-        string cmd(_document["cmd"].GetString(), _document["cmd"].GetStringLength());
-        if ((command.find(cmd) != command.end())
-            && command[cmd](room_id, _document, _borrowed_bilibili_message, &_arena))
-            return &_borrowed_bilibili_message;
-        // 下面的代码会拼接字符串 但当编译选项为release时 日志宏不会启用
-        SPDLOG_TRACE("[bili_json] bilibili json unknown cmd field: " + cmd);
-        return nullptr;
+        auto& cmd_value = _document["cmd"];
+        std::string_view cmd(cmd_value.GetString(), cmd_value.GetStringLength());
+        auto command = command_table::find(cmd);
+        if (!command)
+        {
+            SPDLOG_TRACE("[bili_json] bilibili json unknown cmd field: {}", cmd);
+            return false;
+        }
+        if (command->extractor)
+        {
+            json_input input(_document);
+            return command->extractor(input, room_id, _borrowed_message, _writer);
+        }
+        return command->handler(room_id, _document, _borrowed_message, _writer);
+    }
+#else
+    bool serialize_ondemand(const char* buf, const size_t length, const size_t padding, const unsigned int room_id,
+                            const command_table::entry* command)
+    {
+        // simdjson 会读取数据之后的 SIMDJSON_PADDING 个字节（不会写入）。
+        // 读缓冲区与解压缓冲区都留有 json_padding 个字节，通常原地解析；填充不足时才复制一份。
+        auto data = buf;
+        auto capacity = length + padding;
+        if (padding < simdjson::SIMDJSON_PADDING)
+        {
+            if (_padded_buffer.size() < length + simdjson::SIMDJSON_PADDING)
+                _padded_buffer.resize(length + simdjson::SIMDJSON_PADDING);
+            std::memcpy(_padded_buffer.data(), buf, length);
+            data = _padded_buffer.data();
+            capacity = _padded_buffer.size();
+        }
+        simdjson::ondemand::document document;
+        if (_ondemand_parser.iterate(data, length, capacity).get(document))
+        {
+            SPDLOG_TRACE("[bili_json] bilibili json parse failed.");
+            return false;
+        }
+        if (!command)
+        {
+            std::string_view cmd;
+            if (document["cmd"].get_string().get(cmd))
+            {
+                SPDLOG_TRACE("[bili_json] bilibili json cmd type check failed");
+                return false;
+            }
+            command = command_table::find(cmd);
+            if (!command)
+            {
+                SPDLOG_TRACE("[bili_json] bilibili json unknown cmd field: {}", cmd);
+                return false;
+            }
+        }
+        if (!command->extractor)
+        {
+            SPDLOG_TRACE("[bili_json] cmd {} has no SAX handler for simdjson.", command->name);
+            return false;
+        }
+        // 取出的字符串一共不会超过 json 的长度。
+        if (_string_buffer.size() < length)
+            _string_buffer.resize(length);
+        json_input input(document, _string_buffer.data(), _string_buffer.size());
+        return command->extractor(input, room_id, _borrowed_message, _writer);
+    }
+#endif
+
+public:
+    ~parse_context()
+    {
+        spdlog::debug("[bili_json] Parse memory high-water mark: encoded message {} bytes, DOM {} bytes.",
+                      _writer.high_water(), _document_high_water);
     }
-    ~parse_context() {}
 };
 
 boost::thread_specific_ptr<parse_context> _parse_context;
@@ -111,15 +531,27 @@ parse_context* get_parse_context()
     return _parse_context.get();
 }
 
-const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int& room_id)
+const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int& room_id,
+                                         const size_t padding)
+{
+    return get_parse_context()->serialize(buf, length, room_id, padding);
+}
+
+void begin_batch()
 {
-    return get_parse_context()->serialize(buf, length, room_id);
+    get_parse_context()->begin_batch();
 }
 
-#define CMD(name)                                                                                    \
-    bool cmd_##name(const unsigned int&, const Document&, const borrowed_bilibili_message&, Arena*); \
-    bool cmd_##name##_inited = command.emplace(#name, cmd_##name).second;                            \
-    bool cmd_##name(const unsigned int& room_id, const Document& document, const borrowed_bilibili_message& message, Arena* arena)
+const borrowed_message* end_batch()
+{
+    return get_parse_context()->end_batch();
+}
+
+// 处理函数已在 BILI_COMMANDS 中声明并登记。
+#define CMD(name) \
+    bool cmd_##name(const unsigned int& room_id, const Document& document, const borrowed_message& message, wire_writer& writer)
+#define SAX_CMD(name) \
+    bool sax_##name(json_input& input, const unsigned int& room_id, const borrowed_message& message, wire_writer& writer)
 
 #define ASSERT_TRACE(expr)                                                   \
     if (!(expr))                                                             \
@@ -128,349 +560,521 @@ const borrowed_message* serialize_buffer(char* buf, const size_t& length, const
         return false;                                                        \
     }
 
-CMD(DANMU_MSG)
+// 以下结构只记录字段的值，字符串指向 json 解析器的缓冲区，在 commit 时一次性写成 protobuf 线格式。
+// 未设置的字段保持默认值，写出时省略，与 protobuf 消息对象序列化的结果相同。
+
+///
+/// live::MedalInfo 的字段。
+struct medal_fields
 {
-    // TODO: 需要测试message使用完毕清空时embedded message是否会清空
+    std::string_view medal_name;
+    uint32_t medal_level = 0;
+    uint32_t medal_color = 0;
+    uint64_t streamer_uid = 0;
+    std::string_view streamer_name;
+    uint32_t streamer_roomid = 0;
+
+    void write(wire_writer& writer, const int field) const
+    {
+        using live::MedalInfo;
+        auto mark = writer.begin(field);
+        writer.string(MedalInfo::kMedalNameFieldNumber, medal_name);
+        writer.varint(MedalInfo::kMedalLevelFieldNumber, medal_level);
+        writer.varint(MedalInfo::kMedalColorFieldNumber, medal_color);
+        writer.varint(MedalInfo::kStreamerUidFieldNumber, streamer_uid);
+        writer.string(MedalInfo::kStreamerNameFieldNumber, streamer_name);
+        writer.varint(MedalInfo::kStreamerRoomidFieldNumber, streamer_roomid);
+        writer.end(mark);
+    }
+};
 
-    // 尽管所有UserMessage都需要设置UserInfo
-    // 但是不同cmd的数据格式也有所不同
-    // 因此设置UserInfo和设置RMQ的topic都只能强耦合在每个处理函数里
+///
+/// live::UserInfo 的字段。
+struct user_fields
+{
+    uint64_t uid = 0;
+    std::string_view name;
+    bool admin = false;
+    live::LiveVipLevel live_vip_level = static_cast<live::LiveVipLevel>(0);
+    bool regular_user = false;
+    bool phone_verified = false;
+    uint32_t user_level = 0;
+    std::string_view title;
+    std::string_view avatar_url;
+    bool main_vip = false;
+    bool has_medal = false;
+    medal_fields medal;
 
-    // TODO: 设置routing_key
+    void write(wire_writer& writer, const int field) const
+    {
+        using live::UserInfo;
+        auto mark = writer.begin(field);
+        writer.varint(UserInfo::kUidFieldNumber, uid);
+        writer.string(UserInfo::kNameFieldNumber, name);
+        writer.boolean(UserInfo::kAdminFieldNumber, admin);
+        writer.varint(UserInfo::kLiveVipLevelFieldNumber, static_cast<uint64_t>(live_vip_level));
+        writer.boolean(UserInfo::kRegularUserFieldNumber, regular_user);
+        writer.boolean(UserInfo::kPhoneVerifiedFieldNumber, phone_verified);
+        writer.varint(UserInfo::kUserLevelFieldNumber, user_level);
+        writer.string(UserInfo::kTitleFieldNumber, title);
+        writer.string(UserInfo::kAvatarUrlFieldNumber, avatar_url);
+        writer.boolean(UserInfo::kMainVipFieldNumber, main_vip);
+        if (has_medal)
+            medal.write(writer, UserInfo::kMedalFieldNumber);
+        writer.end(mark);
+    }
+};
 
-    // 以下变量均为 rapidjson::GenericArray ?
-    ASSERT_TRACE(document.HasMember("info"))
-    ASSERT_TRACE(document["info"].IsArray())
-    // 数组数量不对是结构性错误
-    // 但b站很有可能在不改变先前字段的情况下添加字段
-    ASSERT_TRACE(document["info"].MemberCount() >= 15);
-    auto const& info = document["info"];  // 或 document["info"].GetArray() ?
-    ASSERT_TRACE(info[0].IsArray())
-    ASSERT_TRACE(info[0].MemberCount() >= 11)
-    auto const& basic_info = info[0];
-    ASSERT_TRACE(info[2].IsArray())
-    ASSERT_TRACE(info[2].MemberCount() >= 8)
-    auto const& user_info = info[2];
-    ASSERT_TRACE(info[3].IsArray())
-    ASSERT_TRACE(info[3].MemberCount() >= 6)
-    auto const& medal_info = info[3];
-    ASSERT_TRACE(info[4].IsArray())
-    ASSERT_TRACE(info[4].MemberCount() >= 4)
-    auto const& user_level = info[4];
-    // 以下变量类型均为 T*
-    auto embedded_user_message = Arena::CreateMessage<live::UserMessage>(arena);
-    auto embedded_user_info = Arena::CreateMessage<live::UserInfo>(arena);
-    auto embedded_danmaku = Arena::CreateMessage<live::DanmakuMessage>(arena);
-    auto embedded_medal_info = Arena::CreateMessage<live::MedalInfo>(arena);
-
-    // user_info
-    // uid
-    ASSERT_TRACE(user_info[0].IsUint64())
-    embedded_user_info->set_uid(user_info[0].GetUint64());
-    // uname
-    ASSERT_TRACE(user_info[1].IsString())
-    embedded_user_info->set_name(user_info[1].GetString(), user_info[1].GetStringLength());
-    // admin
-    ASSERT_TRACE(user_info[2].IsBool())
-    embedded_user_info->set_admin(user_info[2].GetBool());
-    // vip&svip->livevip
-    ASSERT_TRACE(user_info[3].IsBool() && user_info[4].IsBool())
+inline void set_live_vip_level(user_fields& user_info, const bool vip, const bool svip)
+{
     // 这两个字段分别是月费/年费会员
     // 都为假时无会员 都为真时报错
-    if (user_info[3].GetBool() == user_info[4].GetBool())
+    if (vip == svip)
     {
-        if (user_info[3].GetBool())
+        if (vip)
             // 均为真 报错
             // 未设置的protobuf字段会被置为默认值
             SPDLOG_TRACE("[bili_json] both vip and svip are true");
         else  // 均为假 无直播会员
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::NO_VIP);
+            user_info.live_vip_level = live::LiveVipLevel::NO_VIP;
     }
     else
     {
-        if (user_info[3].GetBool())
+        if (vip)
             // 月费会员为真 年费会员为假 月费
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::MONTHLY);
+            user_info.live_vip_level = live::LiveVipLevel::MONTHLY;
         else  // 月费会员为假 年费会员为真 年费
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::YEARLY);
+            user_info.live_vip_level = live::LiveVipLevel::YEARLY;
     }
-    // regular user
-    ASSERT_TRACE(user_info[5].IsNumber())
-    if (10000 == user_info[5].GetInt())
-        embedded_user_info->set_regular_user(true);
-    else if (5000 == user_info[5].GetInt())
-        embedded_user_info->set_regular_user(false);
-    else
-        SPDLOG_TRACE("[bili_json] unknown user rank");
-    // phone_verified
-    ASSERT_TRACE(user_info[6].IsBool())
-    embedded_user_info->set_phone_verified(user_info[6].GetBool());
-    // user_level
-    ASSERT_TRACE(user_level[0].IsUint())
-    embedded_user_info->set_user_level(user_level[0].GetUint());
-    // user_level_border_color
-    ASSERT_TRACE(user_level[2].IsUint())
-    embedded_user_info->set_user_level(user_level[2].GetUint());
-    // title
-    ASSERT_TRACE(info[5].IsArray())
-    ASSERT_TRACE(info[5][1].IsString())
-    embedded_user_info->set_title(info[5][1].GetString(), info[5][1].GetStringLength());
-    // avatar_url
-    // 弹幕没有头像字段 默认置空
-    // main_vip
-    // 弹幕没有主站vip字段 默认置空
-    // user_level[1] unknown
-
-    // medal
-    // medal_name
-    ASSERT_TRACE(medal_info[1].IsString())
-    embedded_medal_info->set_medal_name(medal_info[1].GetString(), medal_info[1].GetStringLength());
-    // medal_level
-    ASSERT_TRACE(medal_info[0].IsUint())
-    embedded_medal_info->set_medal_level(medal_info[0].GetUint());
-    // medal_color
-    ASSERT_TRACE(medal_info[5].IsUint())
-    embedded_medal_info->set_medal_color(medal_info[5].GetUint());
-    // liver user name
-    ASSERT_TRACE(medal_info[2].IsString())
-    embedded_medal_info->set_streamer_name(medal_info[2].GetString(), medal_info[2].GetStringLength());
-    // liver room id
-    ASSERT_TRACE(medal_info[3].IsUint())
-    embedded_medal_info->set_streamer_roomid(medal_info[3].GetUint());
-    // liver user id
-    // 弹幕没有牌子属于的用户的uid的字段
-    // special_medal
-    // medal_info[6] unknown
-    // medal_info[7] unknown
-
-    // danmaku
-    // message
-    // 设置字符串的函数会分配额外的string 并且不通过arena分配内存
-    // 需要考虑tcmalloc等
-    ASSERT_TRACE(info[1].IsString())
-    embedded_danmaku->set_message(info[1].GetString(), info[1].GetStringLength());
-    // danmaku type
-    ASSERT_TRACE(basic_info[9].IsUint())
-    switch (basic_info[9].GetUint())
+}
+
+// 需要换算的值的类型，见 field_mapping.h。
+
+struct guard_level_value
+{
+    static bool check(const json_scalar& value) { return value.is_uint(); }
+    static live::GuardLevel get(const json_scalar& value)
     {
-    case 0:  // 普通弹幕
-        embedded_danmaku->set_lottery_type(live::LotteryDanmakuType::NO_LOTTERY);
-        break;
-    case 1:  // 节奏风暴
-        embedded_danmaku->set_lottery_type(live::LotteryDanmakuType::STORM);
-        break;
-    case 2:  // 抽奖弹幕
-        embedded_danmaku->set_lottery_type(live::LotteryDanmakuType::LOTTERY);
-        break;
-    default:
-        SPDLOG_TRACE("[bili_json] unknown danmaku lottery type");
+        switch (value.uint64)
+        {
+        case 0:  // 无舰队
+            return live::GuardLevel::NO_GUARD;
+        case 1:  // 总督
+            return live::GuardLevel::LEVEL3;
+        case 2:  // 提督
+            return live::GuardLevel::LEVEL2;
+        case 3:  // 舰长
+            return live::GuardLevel::LEVEL1;
+        default:
+            SPDLOG_TRACE("[bili_json] unknown guard level");
+            return static_cast<live::GuardLevel>(0);
+        }
     }
-    // guard level
-    ASSERT_TRACE(info[7].IsUint())
-    switch (info[7].GetUint())
+};
+
+struct lottery_type_value
+{
+    static bool check(const json_scalar& value) { return value.is_uint(); }
+    static live::LotteryDanmakuType get(const json_scalar& value)
     {
-    case 0:  // 无舰队
-        embedded_danmaku->set_guard_level(live::GuardLevel::NO_GUARD);
-        break;
-    case 1:  // 总督
-        embedded_danmaku->set_guard_level(live::GuardLevel::LEVEL3);
-        break;
-    case 2:  // 提督
-        embedded_danmaku->set_guard_level(live::GuardLevel::LEVEL2);
-        break;
-    case 3:  // 舰长
-        embedded_danmaku->set_guard_level(live::GuardLevel::LEVEL1);
-    default:
-        SPDLOG_TRACE("[bili_json] unknown guard level");
+        switch (value.uint64)
+        {
+        case 0:  // 普通弹幕
+            return live::LotteryDanmakuType::NO_LOTTERY;
+        case 1:  // 节奏风暴
+            return live::LotteryDanmakuType::STORM;
+        case 2:  // 抽奖弹幕
+            return live::LotteryDanmakuType::LOTTERY;
+        default:
+            SPDLOG_TRACE("[bili_json] unknown danmaku lottery type");
+            return static_cast<live::LotteryDanmakuType>(0);
+        }
     }
+};
+
+///
+/// 弹幕中的 rank：10000 为正式会员，5000 为非正式会员。
+struct regular_user_value
+{
+    static bool check(const json_scalar& value) { return value.is_number(); }
+    static bool get(const json_scalar& value)
+    {
+        if (value.is_int() && 10000 == value.get_int())
+            return true;
+        if (!(value.is_int() && 5000 == value.get_int()))
+            SPDLOG_TRACE("[bili_json] unknown user rank");
+        return false;
+    }
+};
 
-    embedded_user_info->set_allocated_medal(embedded_medal_info);
-    embedded_user_message->set_allocated_user(embedded_user_info);
-    embedded_user_message->set_allocated_danmaku(embedded_danmaku);
-    message._message->set_allocated_user_message(embedded_user_message);
+struct danmaku_record
+{
+    user_fields user;
+    bool vip = false;
+    bool svip = false;
+    std::string_view message;
+    live::LotteryDanmakuType lottery_type = static_cast<live::LotteryDanmakuType>(0);
+    live::GuardLevel guard_level = static_cast<live::GuardLevel>(0);
+};
+
+///
+/// DANMU_MSG。info 的结构：
+/// [[..., 抽奖类型(9), ...], 弹幕,
+///  [uid, 用户名, 房管, 月费会员, 年费会员, rank, 手机验证, ...],
+///  [牌子等级, 牌子名, 主播名, 主播房间号, ?, 牌子颜色, ...],
+///  [用户等级, ?, 等级边框颜色, ...], [?, 头衔], ?, 舰队等级, ...]
+/// 弹幕没有牌子所属主播的 uid、用户头像与主站会员字段；UserInfo 中没有等级边框颜色字段。
+#define DANMU_MSG_FIELDS(FIELD)                                                            \
+    FIELD(lottery_type, ("info", 0, 9), lottery_type_value, lottery_type, true)            \
+    FIELD(danmaku_message, ("info", 1), string_value, message, true)                       \
+    FIELD(uid, ("info", 2, 0), uint64_value, user.uid, true)                               \
+    FIELD(uname, ("info", 2, 1), string_value, user.name, true)                            \
+    FIELD(admin, ("info", 2, 2), bool_value, user.admin, true)                             \
+    FIELD(vip, ("info", 2, 3), bool_value, vip, true)                                      \
+    FIELD(svip, ("info", 2, 4), bool_value, svip, true)                                    \
+    FIELD(rank, ("info", 2, 5), regular_user_value, user.regular_user, true)               \
+    FIELD(phone_verified, ("info", 2, 6), bool_value, user.phone_verified, true)           \
+    FIELD(medal_level, ("info", 3, 0), uint32_value, user.medal.medal_level, true)         \
+    FIELD(medal_name, ("info", 3, 1), string_value, user.medal.medal_name, true)           \
+    FIELD(streamer_name, ("info", 3, 2), string_value, user.medal.streamer_name, true)     \
+    FIELD(streamer_roomid, ("info", 3, 3), uint32_value, user.medal.streamer_roomid, true) \
+    FIELD(medal_color, ("info", 3, 5), uint32_value, user.medal.medal_color, true)         \
+    FIELD(user_level, ("info", 4, 0), uint32_value, user.user_level, true)                 \
+    FIELD(title, ("info", 5, 1), string_value, user.title, true)                           \
+    FIELD(guard_level, ("info", 7), guard_level_value, guard_level, true)
+FIELD_MAPPING(DANMU_MSG, "info", danmaku_record)
+
+SAX_CMD(DANMU_MSG)
+{
+    // TODO: 设置routing_key
+    mapped_extractor<DANMU_MSG_mapping> extractor;
+    if (!input.parse(extractor))
+        return false;
+    auto danmaku = extractor.result();
+    if (!danmaku)
+        return false;
+    // vip&svip->livevip
+    set_live_vip_level(danmaku->user, danmaku->vip, danmaku->svip);
+    danmaku->user.has_medal = true;
+
+    auto user_message = writer.begin(RoomMessage::kUserMessageFieldNumber);
+    danmaku->user.write(writer, live::UserMessage::kUserFieldNumber);
+    auto body = writer.begin(live::UserMessage::kDanmakuFieldNumber);
+    writer.string(live::DanmakuMessage::kMessageFieldNumber, danmaku->message);
+    writer.varint(live::DanmakuMessage::kLotteryTypeFieldNumber, static_cast<uint64_t>(danmaku->lottery_type));
+    writer.varint(live::DanmakuMessage::kGuardLevelFieldNumber, static_cast<uint64_t>(danmaku->guard_level));
+    writer.end(body);
+    writer.end(user_message);
     return true;
 }
 
-CMD(SUPER_CHAT_MESSAGE)
+struct super_chat_record
 {
-    // TODO: 设置routing_key
+    user_fields user;
+    bool vip = false;
+    bool svip = false;
+    uint32_t id = 0;
+    std::string_view message;
+    uint32_t price = 0;
+    std::string_view token;
+    uint32_t lasting_time_sec = 0;
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+};
 
-    // TODO: 补充SC中的字段
-
-    // 以下变量均为 rapidjson::GenericArray ?
-    ASSERT_TRACE(document.HasMember("data"))
-    ASSERT_TRACE(document["data"].IsObject())
-    auto const& data = document["data"];
-    ASSERT_TRACE(data.HasMember("user_info"))
-    ASSERT_TRACE(data["user_info"].IsObject())
-    auto const& user_info = data["user_info"];
-    ASSERT_TRACE(data.HasMember("medal_info"))
-    ASSERT_TRACE(data["medal_info"].IsObject())
-    auto const& medal_info = data["medal_info"];
-    // 以下变量类型均为 T*
-    auto embedded_user_message = Arena::CreateMessage<live::UserMessage>(arena);
-    auto embedded_user_info = Arena::CreateMessage<live::UserInfo>(arena);
-    auto embedded_medal_info = Arena::CreateMessage<live::MedalInfo>(arena);
-    auto embedded_superchat = Arena::CreateMessage<live::SuperChatMessage>(arena);
-
-    // user_info
-    // uid
-    ASSERT_TRACE(data.HasMember("uid"))
-    ASSERT_TRACE(data["uid"].IsUint64())
-    embedded_user_info->set_uid(data["uid"].GetUint64());
-    // uname
-    ASSERT_TRACE(user_info.HasMember("uname"));
-    ASSERT_TRACE(user_info["uname"].IsString())
-    embedded_user_info->set_name(user_info["uname"].GetString(), user_info["uname"].GetStringLength());
-    // admin
-    ASSERT_TRACE(user_info.HasMember("manager"));
-    ASSERT_TRACE(user_info["manager"].IsBool())
-    embedded_user_info->set_admin(user_info["manager"].GetBool());
+///
+/// SUPER_CHAT_MESSAGE。只关心 data、data.user_info 与 data.medal_info 中的字段。
+/// 值得注意的是 弹幕和礼物的title默认值是空字符串"" 但SC的title默认值是"0"
+/// user_info.face_frame（舰长框）没有对应的字段。
+#define SUPER_CHAT_MESSAGE_FIELDS(FIELD)                                                                       \
+    FIELD(uid, ("data", "uid"), uint64_value, user.uid, true)                                                  \
+    FIELD(id, ("data", "id"), uint32_value, id, true)                                                          \
+    FIELD(superchat_message, ("data", "message"), string_value, message, true)                                 \
+    FIELD(price, ("data", "price"), uint32_value, price, true)                                                 \
+    FIELD(token, ("data", "token"), string_value, token, true)                                                 \
+    FIELD(lasting_time_sec, ("data", "time"), uint32_value, lasting_time_sec, true)                            \
+    FIELD(start_time, ("data", "start_time"), uint64_value, start_time, true)                                  \
+    FIELD(end_time, ("data", "end_time"), uint64_value, end_time, true)                                        \
+    FIELD(uname, ("data", "user_info", "uname"), string_value, user.name, true)                                \
+    FIELD(admin, ("data", "user_info", "manager"), bool_value, user.admin, true)                               \
+    FIELD(vip, ("data", "user_info", "is_vip"), bool_value, vip, true)                                         \
+    FIELD(svip, ("data", "user_info", "is_svip"), bool_value, svip, true)                                      \
+    FIELD(user_level, ("data", "user_info", "user_level"), uint32_value, user.user_level, true)                \
+    FIELD(title, ("data", "user_info", "title"), string_value, user.title, true)                               \
+    FIELD(main_vip, ("data", "user_info", "is_main_vip"), bool_value, user.main_vip, true)                     \
+    FIELD(avatar_url, ("data", "user_info", "face"), string_value, user.avatar_url, true)                      \
+    FIELD(medal_name, ("data", "medal_info", "medal_name"), string_value, user.medal.medal_name, true)         \
+    FIELD(medal_level, ("data", "medal_info", "medal_level"), uint32_value, user.medal.medal_level, true)      \
+    FIELD(medal_color, ("data", "medal_info", "medal_color"), uint32_value, user.medal.medal_color, true)      \
+    FIELD(streamer_uid, ("data", "medal_info", "target_id"), uint64_value, user.medal.streamer_uid, false)     \
+    FIELD(streamer_name, ("data", "medal_info", "anchor_uname"), string_value, user.medal.streamer_name, true) \
+    FIELD(streamer_roomid, ("data", "medal_info", "anchor_roomid"), uint32_value, user.medal.streamer_roomid, true)
+FIELD_MAPPING(SUPER_CHAT_MESSAGE, "data", super_chat_record)
+
+SAX_CMD(SUPER_CHAT_MESSAGE)
+{
+    // TODO: 设置routing_key
+    mapped_extractor<SUPER_CHAT_MESSAGE_mapping> extractor;
+    if (!input.parse(extractor))
+        return false;
+    auto superchat = extractor.result();
+    if (!superchat)
+        return false;
     // vip&svip->livevip
-    ASSERT_TRACE(user_info.HasMember("is_vip")
-                 & user_info.HasMember("is_svip")
-                 & user_info["is_vip"].IsBool()
-                 & user_info["is_svip"].IsBool())
-    // 这两个字段分别是月费/年费会员
-    // 都为假时无会员 都为真时报错
-    if (user_info["is_vip"].GetBool() == user_info["is_svip"].GetBool())
-    {
-        if (user_info["is_vip"].GetBool())
-            // 均为真 报错
-            // 未设置的protobuf字段会被置为默认值
-            SPDLOG_TRACE("[bili_json] both vip and svip are true");
-        else  // 均为假 无直播会员
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::NO_VIP);
-    }
-    else
-    {
-        if (user_info["is_vip"].GetBool())
-            // 月费会员为真 年费会员为假 月费
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::MONTHLY);
-        else  // 月费会员为假 年费会员为真 年费
-            embedded_user_info->set_live_vip_level(live::LiveVipLevel::YEARLY);
-    }
-    // regular user
-    // phone_verified
-    // SC似乎没有这些字段
+    set_live_vip_level(superchat->user, superchat->vip, superchat->svip);
+    // SC似乎没有 regular user 与 phone_verified 字段
     // 但是赠送礼物的理应可以视为正常用户 而不是默认值的非正常用户
-    embedded_user_info->set_regular_user(true);
-    embedded_user_info->set_phone_verified(true);
-    ASSERT_TRACE(user_info[6].IsBool())
-    // user_level
-    ASSERT_TRACE(user_info.HasMember("user_level"))
-    ASSERT_TRACE(user_info["user_level"].IsUint())
-    embedded_user_info->set_user_level(user_info["user_level"].GetUint());
-    // user_level_border_color
-    // SC似乎没有这个字段
-    // title
-    // 值得注意的是 弹幕和礼物的title默认值是空字符串""
-    // 但SC的title默认值是"0"
-    // 需要考虑是否进行处理
-    ASSERT_TRACE(user_info.HasMember("title"))
-    ASSERT_TRACE(user_info["title"].IsString())
-    embedded_user_info->set_title(user_info["title"].GetString(), user_info["title"].GetStringLength());
-    ASSERT_TRACE(user_info.HasMember("is_main_vip"))
-    // avatar_url
-    ASSERT_TRACE(user_info.HasMember("face"))
-    ASSERT_TRACE(user_info["face"].IsString())
-    embedded_user_info->set_avatar_url(user_info["face"].GetString(), user_info["face"].GetStringLength());
-    // user_info["face_frame"] 舰长框
-    // 没有对应的字段
-    // main_vip
-    ASSERT_TRACE(user_info["is_main_vip"].IsBool())
-    embedded_user_info->set_main_vip(user_info["is_main_vip"].GetBool());
-
-    // medal
-    // medal_name
-    ASSERT_TRACE(medal_info.HasMember("medal_name"))
-    ASSERT_TRACE(medal_info["medal_name"].IsString())
-    embedded_medal_info->set_medal_name(medal_info["medal_name"].GetString(), medal_info["medal_name"].GetStringLength());
-    // medal_level
-    ASSERT_TRACE(medal_info.HasMember("medal_level"))
-    ASSERT_TRACE(medal_info["medal_level"].IsUint())
-    embedded_medal_info->set_medal_level(medal_info["medal_level"].GetUint());
-    // medal_color
-    ASSERT_TRACE(medal_info.HasMember("medal_color"))
-    ASSERT_TRACE(medal_info["medal_color"].IsUint())
-    embedded_medal_info->set_medal_color(medal_info["medal_color"].GetUint());
-    // liver user id
-    ASSERT_TRACE(medal_info.HasMember("target_id"))
-    ASSERT_TRACE(medal_info["target_id"].IsUint())  // IsUint->Uint64存疑
-    embedded_medal_info->set_streamer_uid(medal_info["target_id"].GetUint64());
-    // liver user name
-    ASSERT_TRACE(medal_info.HasMember("anchor_uname"))
-    ASSERT_TRACE(medal_info["anchor_uname"].IsString())
-    embedded_medal_info->set_streamer_name(medal_info["anchor_uname"].GetString(), medal_info["anchor_uname"].GetStringLength());
-    // liver room id
-    ASSERT_TRACE(medal_info.HasMember("anchor_roomid"))
-    ASSERT_TRACE(medal_info["anchor_roomid"].IsUint())
-    embedded_medal_info->set_streamer_roomid(medal_info["anchor_roomid"].GetUint());
-    // special_medal
-    // medal_info[6] unknown
-    // medal_info[7] unknown
-
-    // superchat
-    // id
-    ASSERT_TRACE(data.HasMember("id"))
-    ASSERT_TRACE(data["id"].IsUint());
-    embedded_superchat->set_id(data["id"].GetUint());
-    // message
-    ASSERT_TRACE(data.HasMember("message"))
-    ASSERT_TRACE(data["message"].IsString())
-    embedded_superchat->set_message(data["message"].GetString(), data["message"].GetStringLength());
-    // price
-    ASSERT_TRACE(data.HasMember("price"))
-    ASSERT_TRACE(data["price"].IsUint())
-    embedded_superchat->set_price(data["price"].GetUint());
-    // token
-    ASSERT_TRACE(data.HasMember("token"))
-    ASSERT_TRACE(data["token"].IsString())
-    embedded_superchat->set_token(data["token"].GetString(), data["token"].GetStringLength());
-    // lasting_time_sec
-    ASSERT_TRACE(data.HasMember("time"))
-    ASSERT_TRACE(data["time"].IsUint())
-    embedded_superchat->set_lasting_time_sec(data["time"].GetUint());
-    // start_time
-    ASSERT_TRACE(data.HasMember("start_time"))
-    ASSERT_TRACE(data["start_time"].IsUint64())
-    embedded_superchat->set_start_time(data["start_time"].GetUint64());
-    // end_time
-    ASSERT_TRACE(data.HasMember("end_time"))
-    ASSERT_TRACE(data["end_time"].IsUint64())
-    embedded_superchat->set_end_time(data["end_time"].GetUint64());
-
-    embedded_user_info->set_allocated_medal(embedded_medal_info);
-    embedded_user_message->set_allocated_user(embedded_user_info);
-    embedded_user_message->set_allocated_super_chat(embedded_superchat);
-    message._message->set_allocated_user_message(embedded_user_message);
+    superchat->user.regular_user = true;
+    superchat->user.phone_verified = true;
+    superchat->user.has_medal = true;
+
+    using live::SuperChatMessage;
+    auto user_message = writer.begin(RoomMessage::kUserMessageFieldNumber);
+    superchat->user.write(writer, live::UserMessage::kUserFieldNumber);
+    auto body = writer.begin(live::UserMessage::kSuperChatFieldNumber);
+    writer.varint(SuperChatMessage::kIdFieldNumber, superchat->id);
+    writer.string(SuperChatMessage::kMessageFieldNumber, superchat->message);
+    writer.varint(SuperChatMessage::kPriceFieldNumber, superchat->price);
+    writer.string(SuperChatMessage::kTokenFieldNumber, superchat->token);
+    writer.varint(SuperChatMessage::kLastingTimeSecFieldNumber, superchat->lasting_time_sec);
+    writer.varint(SuperChatMessage::kStartTimeFieldNumber, superchat->start_time);
+    writer.varint(SuperChatMessage::kEndTimeFieldNumber, superchat->end_time);
+    writer.end(body);
+    writer.end(user_message);
+    return true;
+}
+
+///
+/// 礼物的货币：coin_type 为 "gold" 时是金瓜子（付费），"silver" 时是银瓜子。
+struct gold_coin_value
+{
+    static bool check(const json_scalar& value) { return value.is_string(); }
+    static bool get(const json_scalar& value) { return value.string == "gold"; }
+};
+
+struct gift_record
+{
+    user_fields user;
+    uint32_t gift_id = 0;
+    std::string_view gift_name;
+    uint32_t amount = 0;
+    uint32_t single_price = 0;
+    bool gold_coin = false;
+    uint32_t total_price = 0;
+};
 
+///
+/// SEND_GIFT。旧版本的礼物消息没有 medal_info。
+/// price 为单个礼物的价格，total_coin 为这次赠送的总价，单位都是瓜子。
+#define SEND_GIFT_FIELDS(FIELD)                                                                                 \
+    FIELD(uid, ("data", "uid"), uint64_value, user.uid, true)                                                   \
+    FIELD(uname, ("data", "uname"), string_value, user.name, true)                                              \
+    FIELD(avatar_url, ("data", "face"), string_value, user.avatar_url, false)                                   \
+    FIELD(gift_id, ("data", "giftId"), uint32_value, gift_id, true)                                             \
+    FIELD(gift_name, ("data", "giftName"), string_value, gift_name, true)                                       \
+    FIELD(amount, ("data", "num"), uint32_value, amount, true)                                                  \
+    FIELD(single_price, ("data", "price"), uint32_value, single_price, false)                                   \
+    FIELD(gold_coin, ("data", "coin_type"), gold_coin_value, gold_coin, false)                                  \
+    FIELD(total_price, ("data", "total_coin"), uint32_value, total_price, false)                                \
+    FIELD(medal_name, ("data", "medal_info", "medal_name"), string_value, user.medal.medal_name, false)         \
+    FIELD(medal_level, ("data", "medal_info", "medal_level"), uint32_value, user.medal.medal_level, false)      \
+    FIELD(medal_color, ("data", "medal_info", "medal_color"), uint32_value, user.medal.medal_color, false)      \
+    FIELD(streamer_uid, ("data", "medal_info", "target_id"), uint64_value, user.medal.streamer_uid, false)      \
+    FIELD(streamer_name, ("data", "medal_info", "anchor_uname"), string_value, user.medal.streamer_name, false) \
+    FIELD(streamer_roomid, ("data", "medal_info", "anchor_roomid"), uint32_value, user.medal.streamer_roomid, false)
+FIELD_MAPPING(SEND_GIFT, "data", gift_record)
+
+SAX_CMD(SEND_GIFT)
+{
+    // TODO: 设置routing_key
+    using live::GiftMessage;
+    mapped_extractor<SEND_GIFT_mapping> extractor;
+    if (!input.parse(extractor))
+        return false;
+    auto gift = extractor.result();
+    if (!gift)
+        return false;
+    // 没有佩戴牌子时 medal_info 中的字段为空
+    gift->user.has_medal = !gift->user.medal.medal_name.empty();
+
+    auto user_message = writer.begin(RoomMessage::kUserMessageFieldNumber);
+    gift->user.write(writer, live::UserMessage::kUserFieldNumber);
+    auto body = writer.begin(live::UserMessage::kGiftFieldNumber);
+    writer.varint(GiftMessage::kGiftIdFieldNumber, gift->gift_id);
+    writer.string(GiftMessage::kGiftNameFieldNumber, gift->gift_name);
+    writer.varint(GiftMessage::kAmountFieldNumber, gift->amount);
+    writer.varint(GiftMessage::kSinglePriceFieldNumber, gift->single_price);
+    writer.boolean(GiftMessage::kGoldCoinFieldNumber, gift->gold_coin);
+    writer.varint(GiftMessage::kTotalPriceFieldNumber, gift->total_price);
+    writer.end(body);
+    writer.end(user_message);
     return true;
 }
 
-CMD(SEND_GIFT)
+struct guard_buy_record
+{
+    user_fields user;
+    live::GuardLevel guard_level = static_cast<live::GuardLevel>(0);
+    uint32_t amount = 0;
+    uint32_t price = 0;
+    uint32_t gift_id = 0;
+    std::string_view gift_name;
+    uint64_t start_time = 0;
+    uint64_t end_time = 0;
+};
+
+///
+/// GUARD_BUY。上舰时发送，num 为购买的月数，price 为总价（金瓜子）。没有用户的其他信息。
+#define GUARD_BUY_FIELDS(FIELD)                                                       \
+    FIELD(uid, ("data", "uid"), uint64_value, user.uid, true)                         \
+    FIELD(uname, ("data", "username"), string_value, user.name, true)                 \
+    FIELD(guard_level, ("data", "guard_level"), guard_level_value, guard_level, true) \
+    FIELD(amount, ("data", "num"), uint32_value, amount, true)                        \
+    FIELD(price, ("data", "price"), uint32_value, price, true)                        \
+    FIELD(gift_id, ("data", "gift_id"), uint32_value, gift_id, false)                 \
+    FIELD(gift_name, ("data", "gift_name"), string_value, gift_name, false)           \
+    FIELD(start_time, ("data", "start_time"), uint64_value, start_time, false)        \
+    FIELD(end_time, ("data", "end_time"), uint64_value, end_time, false)
+FIELD_MAPPING(GUARD_BUY, "data", guard_buy_record)
+
+SAX_CMD(GUARD_BUY)
 {
     // TODO: 设置routing_key
+    using live::GuardBuyMessage;
+    mapped_extractor<GUARD_BUY_mapping> extractor;
+    if (!input.parse(extractor))
+        return false;
+    auto guard = extractor.result();
+    if (!guard)
+        return false;
+    // 舰长一定是付费的正常用户
+    guard->user.regular_user = true;
+    guard->user.phone_verified = true;
 
-    // 以下变量均为 rapidjson::GenericArray ?
-    ASSERT_TRACE(document.HasMember("data"))
-    ASSERT_TRACE(document["data"].IsObject())
-    auto const& data = document["data"];
-    // 以下变量类型均为 T*
-    auto embedded_user_message = Arena::CreateMessage<live::UserMessage>(arena);
-    auto embedded_user_info = Arena::CreateMessage<live::UserInfo>(arena);
-    auto embedded_gift = Arena::CreateMessage<live::GiftMessage>(arena);
-    // 礼物似乎没有牌子信息
-    // auto embedded_medal_info = Arena::CreateMessage<live::MedalInfo>(arena);
-
-    // TODO
-
-    // 礼物似乎没有牌子信息
-    // embedded_user_info->set_allocated_medal(embedded_medal_info);
-    embedded_user_message->set_allocated_user(embedded_user_info);
-    embedded_user_message->set_allocated_gift(embedded_gift);
-    message._message->set_allocated_user_message(embedded_user_message);
+    auto user_message = writer.begin(RoomMessage::kUserMessageFieldNumber);
+    guard->user.write(writer, live::UserMessage::kUserFieldNumber);
+    auto body = writer.begin(live::UserMessage::kGuardBuyFieldNumber);
+    writer.varint(GuardBuyMessage::kGuardLevelFieldNumber, static_cast<uint64_t>(guard->guard_level));
+    writer.varint(GuardBuyMessage::kAmountFieldNumber, guard->amount);
+    writer.varint(GuardBuyMessage::kPriceFieldNumber, guard->price);
+    writer.varint(GuardBuyMessage::kGiftIdFieldNumber, guard->gift_id);
+    writer.string(GuardBuyMessage::kGiftNameFieldNumber, guard->gift_name);
+    writer.varint(GuardBuyMessage::kStartTimeFieldNumber, guard->start_time);
+    writer.varint(GuardBuyMessage::kEndTimeFieldNumber, guard->end_time);
+    writer.end(body);
+    writer.end(user_message);
     return true;
 }
 
+namespace
+{
+enum class wire_field
+{
+    varint,
+    string,
+    message
+};
+
+struct schema_field
+{
+    const google::protobuf::Descriptor* message;
+    int number;
+    wire_field type;
+};
+
+bool matches(const google::protobuf::FieldDescriptor* field, const wire_field type)
+{
+    using google::protobuf::FieldDescriptor;
+    if (!field || field->is_repeated())
+        return false;
+    switch (field->type())
+    {
+    case FieldDescriptor::TYPE_UINT64:
+    case FieldDescriptor::TYPE_UINT32:
+    case FieldDescriptor::TYPE_INT64:
+    case FieldDescriptor::TYPE_INT32:
+    case FieldDescriptor::TYPE_BOOL:
+    case FieldDescriptor::TYPE_ENUM:
+        return type == wire_field::varint;
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+        return type == wire_field::string;
+    case FieldDescriptor::TYPE_MESSAGE:
+        return type == wire_field::message;
+    default:
+        return false;
+    }
+}
+}  // namespace
+
+void check_message_schema()
+{
+    using namespace live;
+    const auto room = RoomMessage::descriptor();
+    const auto user_message = UserMessage::descriptor();
+    const auto user = UserInfo::descriptor();
+    const auto medal = MedalInfo::descriptor();
+    const auto danmaku = DanmakuMessage::descriptor();
+    const auto superchat = SuperChatMessage::descriptor();
+    const auto gift = GiftMessage::descriptor();
+    const auto guard_buy = GuardBuyMessage::descriptor();
+    const schema_field fields[] = {
+        {room, RoomMessage::kRoomIdFieldNumber, wire_field::varint},
+        {room, RoomMessage::kUserMessageFieldNumber, wire_field::message},
+        {user_message, UserMessage::kUserFieldNumber, wire_field::message},
+        {user_message, UserMessage::kDanmakuFieldNumber, wire_field::message},
+        {user_message, UserMessage::kSuperChatFieldNumber, wire_field::message},
+        {user_message, UserMessage::kGiftFieldNumber, wire_field::message},
+        {user_message, UserMessage::kGuardBuyFieldNumber, wire_field::message},
+        {user, UserInfo::kUidFieldNumber, wire_field::varint},
+        {user, UserInfo::kNameFieldNumber, wire_field::string},
+        {user, UserInfo::kAdminFieldNumber, wire_field::varint},
+        {user, UserInfo::kLiveVipLevelFieldNumber, wire_field::varint},
+        {user, UserInfo::kRegularUserFieldNumber, wire_field::varint},
+        {user, UserInfo::kPhoneVerifiedFieldNumber, wire_field::varint},
+        {user, UserInfo::kUserLevelFieldNumber, wire_field::varint},
+        {user, UserInfo::kTitleFieldNumber, wire_field::string},
+        {user, UserInfo::kAvatarUrlFieldNumber, wire_field::string},
+        {user, UserInfo::kMainVipFieldNumber, wire_field::varint},
+        {user, UserInfo::kMedalFieldNumber, wire_field::message},
+        {medal, MedalInfo::kMedalNameFieldNumber, wire_field::string},
+        {medal, MedalInfo::kMedalLevelFieldNumber, wire_field::varint},
+        {medal, MedalInfo::kMedalColorFieldNumber, wire_field::varint},
+        {medal, MedalInfo::kStreamerUidFieldNumber, wire_field::varint},
+        {medal, MedalInfo::kStreamerNameFieldNumber, wire_field::string},
+        {medal, MedalInfo::kStreamerRoomidFieldNumber, wire_field::varint},
+        {danmaku, DanmakuMessage::kMessageFieldNumber, wire_field::string},
+        {danmaku, DanmakuMessage::kLotteryTypeFieldNumber, wire_field::varint},
+        {danmaku, DanmakuMessage::kGuardLevelFieldNumber, wire_field::varint},
+        {superchat, SuperChatMessage::kIdFieldNumber, wire_field::varint},
+        {superchat, SuperChatMessage::kMessageFieldNumber, wire_field::string},
+        {superchat, SuperChatMessage::kPriceFieldNumber, wire_field::varint},
+        {superchat, SuperChatMessage::kTokenFieldNumber, wire_field::string},
+        {superchat, SuperChatMessage::kLastingTimeSecFieldNumber, wire_field::varint},
+        {superchat, SuperChatMessage::kStartTimeFieldNumber, wire_field::varint},
+        {superchat, SuperChatMessage::kEndTimeFieldNumber, wire_field::varint},
+        {gift, GiftMessage::kGiftIdFieldNumber, wire_field::varint},
+        {gift, GiftMessage::kGiftNameFieldNumber, wire_field::string},
+        {gift, GiftMessage::kAmountFieldNumber, wire_field::varint},
+        {gift, GiftMessage::kSinglePriceFieldNumber, wire_field::varint},
+        {gift, GiftMessage::kGoldCoinFieldNumber, wire_field::varint},
+        {gift, GiftMessage::kTotalPriceFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kGuardLevelFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kAmountFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kPriceFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kGiftIdFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kGiftNameFieldNumber, wire_field::string},
+        {guard_buy, GuardBuyMessage::kStartTimeFieldNumber, wire_field::varint},
+        {guard_buy, GuardBuyMessage::kEndTimeFieldNumber, wire_field::varint},
+    };
+    for (auto& field : fields)
+    {
+        // wire_writer 省略默认值，只有 proto3 的标量字段可以这样做。
+        if (field.message->file()->syntax() != google::protobuf::FileDescriptor::SYNTAX_PROTO3)
+            throw std::runtime_error("Message " + field.message->full_name() + " is not proto3.");
+        if (!matches(field.message->FindFieldByNumber(field.number), field.type))
+            throw std::runtime_error("Field " + std::to_string(field.number) + " of " + field.message->full_name()
+                                     + " does not match the wire encoder in bili_json.cpp.");
+    }
+}
 }  // namespace vNerve::bilibili
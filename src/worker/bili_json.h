@@ -2,8 +2,34 @@
 
 #include "borrowed_message.h"
 
+#include <string>
+#include <vector>
+
 namespace vNerve::bilibili
 {
+///
+/// 读缓冲区与解压缓冲区在数据之后额外保留的字节数，与 simdjson 要求的 SIMDJSON_PADDING 相同。
+/// json 之后有这么多字节可读时 serialize_buffer 原地解析，否则先复制一份。
+const size_t json_padding = 64;
+
 // 我寻思这里该写点文档
-const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int& roomid);
+/// @param padding buf + length 之后可读的字节数，第一个字节可写（handle_packet 在此写入 '\0'）。
+const borrowed_message* serialize_buffer(char* buf, const size_t& length, const unsigned int& roomid,
+                                         size_t padding);
+///
+/// 开始收集当前线程的批量消息。此后 serialize_buffer 把消息追加到批量消息中并返回 nullptr，
+/// 直到与之配对的 end_batch。可以嵌套，嵌套的批量消息并入最外层。
+void begin_batch();
+///
+/// 结束批量消息。
+/// @return 最外层返回收集到的全部消息，只有一条时与 serialize_buffer 的结果格式相同；没有消息或不在最外层时返回 nullptr。
+const borrowed_message* end_batch();
+///
+/// 设置需要处理的 cmd。allow 为空时处理所有支持的 cmd；deny 中的 cmd 总是被丢弃。
+/// 被过滤掉的消息不会被解析为 json，也不会计算指纹。必须在开始解析前调用。
+void set_command_filter(const std::vector<std::string>& allow, const std::vector<std::string>& deny);
+///
+/// 核对生成的 protobuf 代码与 bili_json 中手写的编码器是否一致。
+/// @throw std::runtime_error 字段类型不一致时抛出。
+void check_message_schema();
 }  // namespace vNerve::bilibili
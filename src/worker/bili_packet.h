@@ -1,39 +1,28 @@
 #pragma once
 
+#include "bili_json.h"
+#include "decompress_context.h"
+
+#include <cassert>
 #include <cstdint>
+#include <exception>
+#include <utility>
 
 #include <boost/asio.hpp>
+#include <spdlog/spdlog.h>
 
 namespace vNerve::bilibili
 {
 class malformed_packet : public std::exception
 {
+private:
+    const char* _message = "malformed packet";
+
 public:
     malformed_packet() = default;
-    explicit malformed_packet(char const* _Message) : exception(_Message) {}
-    malformed_packet(char const* _Message, int i) : exception(_Message, i) {}
-    explicit malformed_packet(exception const& _Other) : exception(_Other) {}
-    malformed_packet(const malformed_packet& other) : std::exception(other) {}
-    malformed_packet(malformed_packet&& other) noexcept
-        : std::exception(std::move(other))
-    {
-    }
-
-    malformed_packet& operator=(const malformed_packet& other)
-    {
-        if (this == &other)
-            return *this;
-        std::exception::operator=(other);
-        return *this;
-    }
+    explicit malformed_packet(const char* message) : _message(message) {}
 
-    malformed_packet& operator=(malformed_packet&& other) noexcept
-    {
-        if (this == &other)
-            return *this;
-        std::exception::operator=(std::move(other));
-        return *this;
-    }
+    [[nodiscard]] const char* what() const noexcept override { return _message; }
 };
 
 struct bilibili_packet_header
@@ -47,11 +36,11 @@ struct bilibili_packet_header
     inline type1 name() const                                                \
     {                                                                        \
         return boost::asio::detail::socket_ops::network_to_host_##type2(     \
-            _##name##);                                                      \
+            _##name);                                                        \
     }                                                                        \
     inline void name(type1 value)                                            \
     {                                                                        \
-        _##name## =                                                          \
+        _##name =                                                            \
             boost::asio::detail::socket_ops::host_to_network_##type2(value); \
     }
 #define PACKET_ACCESSOR_LONG(name) PACKET_ACCESSOR(name, uint32_t, long)
@@ -74,23 +63,6 @@ struct bilibili_packet_header
     }
 };
 
-class borrowed_message;
-
-///
-/// 用于处理一次读取获得的缓冲区。
-/// 一次缓冲区可能不完整或包含多个数据包。本函数可以处理此种情况。
-/// 本函数断言 *buf* 的最开始为一个完整的数据包头部。
-/// @param buf *整个*缓冲区
-/// @param transferred 本次读取到的字节数
-/// @param buffer_size 整个缓冲区的大小
-/// @param skipping_size 上次调用获得的返回值的第二项，标识应该跳过的大小
-/// @param data_handler 用于处理发送给 Supervisor 的数据的回调函数。
-/// @return 下次读取结果应该存放的偏移量以及需要传入下一次调用最后一个参数的偏移量。如果本结果含有不完整的数据包，本函数将会将该数据包的一部分复制到 `buf` 开头，则返回的就是数据包片段的尾部位置 + 1.
-std::pair<size_t, size_t> handle_buffer(unsigned char* buf, size_t transferred,
-                                        size_t buffer_size,
-                                        size_t skipping_size,
-                                        std::function<void(borrowed_message*)> data_handler);
-
 std::string generate_heartbeat_packet();
 std::string generate_join_room_packet(int room_id, int proto_ver);
 
@@ -109,5 +81,246 @@ enum bilibili_packet_protocol_version : uint16_t
     json_protocol = 0,
     popularity = 1,
     zlib_compressed = 2,
+    brotli_compressed = 3,
 };
+
+///
+/// 解压一个压缩包，把其中的全部消息作为一条批量消息交给 data_handler。
+/// 解压失败或抛出异常时，已经解析出的消息仍会交出。
+/// @return 是否解压成功。
+template <typename Handler>
+bool decompress_batch(decompress_context* context, const unsigned char* buf, const size_t size,
+                      const int room_id, Handler&& data_handler)
+{
+    begin_batch();
+    bool succeeded;
+    try
+    {
+        succeeded = context->decompress(buf, size, room_id, data_handler);
+    }
+    catch (...)
+    {
+        if (auto batch = end_batch())
+            data_handler(batch);
+        throw;
+    }
+    if (auto batch = end_batch())
+        data_handler(batch);
+    return succeeded;
+}
+
+///
+/// 处理一个完整的数据包。压缩的数据包会被解压，其中的数据包再交给 handle_buffer。
+/// @param buf 数据包的起始位置，[buf, buf + length) 为一个完整的数据包
+/// @param padding 数据包之后可读的字节数，至少为 1 且第一个字节可写。不少于 json_padding 时 json 原地解析。
+/// @param room_id 数据包所在的房间号
+/// @param data_handler 用于处理发送给 Supervisor 的数据的回调，以 `const borrowed_message*` 调用。
+template <typename Handler>
+void handle_packet(unsigned char* buf, const size_t padding, const int room_id, Handler&& data_handler)
+{
+    auto header = reinterpret_cast<bilibili_packet_header*>(buf);
+    if (header->header_length() != sizeof(bilibili_packet_header))
+    {
+        spdlog::warn(
+            "[packet] [{:p}] Malformed packet: Bad header length(!=16): {}",
+            buf, header->header_length());
+        throw malformed_packet();
+    }
+    if (header->length() < sizeof(bilibili_packet_header))
+    {
+        spdlog::warn(
+            "[packet] [{:p}] Malformed packet: Length shorter than header(<16): {}",
+            buf, header->length());
+        throw malformed_packet();
+    }
+
+    auto payload_size = header->length() - sizeof(bilibili_packet_header);
+    spdlog::trace(
+        "[packet] [{:p}] Packet header: len={}, proto_ver={}, op_code={}, seq_id={}",
+        buf, header->length(), header->protocol_version(),
+        header->op_code(), header->sequence_id());
+
+    switch (header->protocol_version())
+    {
+    case zlib_compressed:
+    {
+        spdlog::trace("[packet] [{:p}] Decompressing zlib-zipped packet.", buf);
+        // 解压得到的数据包会被逐块交给 handle_buffer，无需等待整个数据包解压完成；
+        // 其中的消息合并为一条批量消息，在解压结束后交出。
+        auto context = get_inflate_context();
+        if (!decompress_batch(context, buf + sizeof(bilibili_packet_header), payload_size, room_id, data_handler))
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing zlib-zipped packet! {}",
+                buf, context->error_message());
+    }
+    break;
+    case brotli_compressed:
+    {
+        spdlog::trace("[packet] [{:p}] Decompressing brotli-compressed packet.", buf);
+        auto context = get_brotli_context();
+        if (!decompress_batch(context, buf + sizeof(bilibili_packet_header), payload_size, room_id, data_handler))
+            spdlog::warn(
+                "[packet] [{:p}] Failed decompressing brotli-compressed packet! {}",
+                buf, context->error_message());
+    }
+    break;
+    default:
+        switch (header->op_code())
+        {
+        case json_message:
+        {
+            spdlog::trace("[packet] [{:p}] Received JSON data. len={}",
+                          buf, payload_size);
+            auto payload = reinterpret_cast<char*>(buf + sizeof(bilibili_packet_header));
+            // ParseInsitu 需要以 '\0' 结尾的字符串，临时借用数据包之后的一个字节。
+            // 调用者保证数据包之后至少还有一个可写的字节。
+            auto terminator = payload[payload_size];
+            payload[payload_size] = '\0';
+            auto message = serialize_buffer(payload, payload_size, room_id, padding);
+            payload[payload_size] = terminator;
+            if (message)
+                data_handler(message);
+        }
+        break;
+        case heartbeat_resp:
+        {
+            if (payload_size != sizeof(uint32_t))
+            {
+                spdlog::warn(
+                    "[packet] [{:p}] Malformed heartbeat response: Bad payload size(!=4): {}",
+                    buf, payload_size);
+                return;
+            }
+            auto popularity =
+                boost::asio::detail::socket_ops::network_to_host_long(
+                    *reinterpret_cast<uint32_t*>(
+                        buf + sizeof(bilibili_packet_header)));
+            spdlog::trace("[packet] [{:p}] Heartbeat response: Popularity={}",
+                          buf, popularity);
+            break;
+            // TODO send
+        }
+        case join_room_resp:
+            // TODO notification?
+            spdlog::trace("[packet] [{:p}] Successfully joined room.", buf);
+            break;
+        default:
+            spdlog::warn("[packet] [{:p}] Unknown packet type! op_code={}",
+                         buf, header->op_code());
+            break;
+        }
+    }
+}
+
+///
+/// 把一次读取获得的缓冲区切分为完整的数据包。
+/// 一次缓冲区可能不完整或包含多个数据包。本函数可以处理此种情况。
+/// 本函数断言 *buf* 的最开始为一个完整的数据包头部。
+/// 本函数不会搬运数据：不完整的数据包留在原处，调用者应在读取到更多数据后从同一位置再次调用。
+/// @param buf 待处理数据的起始位置，其后至少有 *transferred* + 1 个连续的可写字节
+/// @param transferred 自 buf 起可用的字节数
+/// @param buffer_size 整个缓冲区的大小，即允许的最大数据包长度
+/// @param skipping_size 上次调用获得的返回值的第二项，标识应该跳过的大小
+/// @param packet_handler 以 `(unsigned char* packet, size_t length)` 对每个完整的数据包调用。
+/// @return 本次消费（处理或跳过）的字节数，以及需要传入下一次调用最后一个参数的偏移量。未消费的字节为不完整数据包的开头。
+template <typename PacketHandler>
+std::pair<size_t, size_t> split_buffer(unsigned char* buf, const size_t transferred,
+                                       const size_t buffer_size,
+                                       const size_t skipping_size,
+                                       PacketHandler&& packet_handler)
+{
+    spdlog::trace(
+        "[bili_buffer] [{:p}] Handling buffer: transferred={}, buffer_size={}, skipping_size={}.",
+        buf, transferred, buffer_size, skipping_size);
+    if (skipping_size > transferred)
+    {
+        auto next_skipping_size = skipping_size - transferred;
+        spdlog::trace(
+            "[bili_buffer] [{:p}] Continue skipping message... Next skipping size={}",
+            buf, next_skipping_size);
+        return std::pair<size_t, size_t>(
+            transferred, next_skipping_size);  // continue disposing
+    }
+    long long remaining = transferred - skipping_size;
+    auto begin = buf + skipping_size;
+
+    while (remaining > 0)
+    {
+        spdlog::trace("[bili_buffer] [{:p}] Decoding message, remaining={}",
+                      buf, remaining);
+        assert(remaining <= buffer_size && remaining <= transferred);
+        if (remaining < sizeof(bilibili_packet_header))
+        {
+            // the remaining bytes can't even form a header, so leave them in place and wait for more data.
+            spdlog::trace(
+                "[bili_buffer] [{:p}] Remaining bytes can't form a header. Waiting for more data, remaining={}.",
+                buf, remaining);
+            return std::pair<size_t, size_t>(begin - buf, 0);
+        }
+        auto header = reinterpret_cast<bilibili_packet_header*>(begin);
+        auto length = header->length();
+        if (header->header_length() != sizeof(bilibili_packet_header))
+        {
+            spdlog::warn(
+                "[bili_buffer] [{:p}] Malformed packet: Bad header length(!=16): {}",
+                buf, header->header_length());
+            throw malformed_packet();
+        }
+        if (length < sizeof(bilibili_packet_header))
+        {
+            // a zero length would never advance, and a shorter one would underflow the payload size.
+            spdlog::warn(
+                "[bili_buffer] [{:p}] Malformed packet: Length shorter than header(<16): {}",
+                buf, length);
+            throw malformed_packet();
+        }
+        if (length > buffer_size)
+        {
+            spdlog::info(
+                "[bili_buffer] [{:p}] Packet too big: {} > max size({}). Disposing and skipping next {} bytes.",
+                buf, length, buffer_size, header->length() - remaining);
+            assert(header->length() > transferred);
+            // The packet is too big, dispose it.
+            return std::pair<size_t, size_t>(
+                transferred, header->length() - remaining);  // skip the remaining bytes.
+        }
+
+        if (length > remaining)
+        {
+            // need more data.
+            spdlog::trace(
+                "[bili_buffer] [{:p}] Packet not complete. Waiting for more data, remaining={}.",
+                buf, remaining);
+            return std::pair<size_t, size_t>(begin - buf, 0);
+        }
+
+        // 到此处我们拥有一个完整的数据包：[begin, begin + length)
+
+        packet_handler(begin, static_cast<size_t>(length));
+        remaining -= length;
+        begin += length;
+    }
+
+    return std::pair<size_t, size_t>(transferred, 0);  // all consumed, and skip no bytes.
+}
+///
+/// 用于处理一次读取获得的缓冲区：切分出完整的数据包，并在当前线程上逐个交给 handle_packet。
+/// 参数与返回值见 split_buffer。
+/// @param padding buf + transferred 之后可读的字节数，见 handle_packet。
+/// @param room_id 数据所在的房间号
+/// @param data_handler 用于处理发送给 Supervisor 的数据的回调，以 `const borrowed_message*` 调用。
+template <typename Handler>
+std::pair<size_t, size_t> handle_buffer(unsigned char* buf, const size_t transferred,
+                                        const size_t padding,
+                                        const size_t buffer_size,
+                                        const size_t skipping_size,
+                                        const int room_id, Handler&& data_handler)
+{
+    auto end = buf + transferred + padding;
+    return split_buffer(buf, transferred, buffer_size, skipping_size,
+                        [end, room_id, &data_handler](unsigned char* packet, const size_t length) {
+                            // 之后的数据包也可以作为填充读取。
+                            handle_packet(packet, end - (packet + length), room_id, data_handler);
+                        });
+}
 }  // namespace vNerve::bilibili
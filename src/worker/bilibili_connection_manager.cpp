@@ -1,131 +1,74 @@
 #include "bilibili_connection_manager.h"
 
+#include "bili_json.h"
 #include "bili_packet.h"
+#include "decompress_context.h"
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <string>
 #include <utility>
+#include <vector>
 #include <spdlog/spdlog.h>
 
 vNerve::bilibili::bilibili_connection_manager::bilibili_connection_manager(const config::config_t options, room_event_handler on_room_failed, room_data_handler on_room_data)
-    : _context((*_options)["threads"].as<int>()),
-      _guard(_context.get_executor()),
-      _resolver(_context),
-      _max_connections((*_options)["max-rooms"].as<int>()),
+    : _options(options),
+      _max_connections((*options)["max-rooms"].as<int>()),
       _on_room_failed(std::move(on_room_failed)),
       _on_room_data(std::move(on_room_data)),
-      _options(options),
       _shared_heartbeat_buffer_str(generate_heartbeat_packet()),
       _shared_heartbeat_buffer(
           boost::asio::buffer(_shared_heartbeat_buffer_str))
 {
-    int threads = (*_options)["threads"].as<int>();
-    spdlog::info("[session] Creating session with thread pool size={}",
-                 threads);
+    int threads = std::max((*_options)["threads"].as<int>(), 1);
+    bool pin = (*_options)["pin-threads"].as<bool>();
+    spdlog::info("[session] Creating session with {} shards, pin threads={}",
+                 threads, pin);
+#if defined(VNERVE_JSON_SIMDJSON)
+    spdlog::info("[session] Using simdjson for parsing bilibili messages.");
+#endif
+#if defined(VNERVE_IO_URING)
+    if ((*_options)["io-uring"].as<bool>())
+        spdlog::info("[session] Using io_uring for receiving from bilibili connections.");
+#endif
+    set_decompress_buffer_size((*_options)["zlib-buffer"].as<size_t>());
+    check_message_schema();
+    set_command_filter((*_options)["cmd-allow"].as<std::vector<std::string>>(),
+                       (*_options)["cmd-deny"].as<std::vector<std::string>>());
+    int parse_threads = (*_options)["parse-threads"].as<int>();
+    if (parse_threads > 0)
+        _parse_pool = std::make_unique<parse_pool>(*this, parse_threads);
     for (int i = 0; i < threads; i++)
+        _shards.emplace_back(std::make_unique<bilibili_shard>(*this, i));
+    for (auto& shard : _shards)
         _pool.create_thread(
-            boost::bind(&boost::asio::io_context::run, &_context));
+            boost::bind(&bilibili_shard::run, shard.get(), pin));
 }
 
 vNerve::bilibili::bilibili_connection_manager::~bilibili_connection_manager()
 {
-    try
-    {
-        _context.stop();
-    }
-    catch (boost::system::system_error& ex)
-    {
-        spdlog::critical(
-            "[session] Failed shutting down session IO Context! err:{}:{}:{}",
-            ex.code().value(), ex.code().message(), ex.what());
-    }
-}
-void vNerve::bilibili::bilibili_connection_manager::open_connection(const int room_id)
-{
-    auto& server_addr = (*_options)["chat-server"].as<std::string>();
-    auto port = std::to_string((*_options)["chat-server-port"].as<int>());
-
-    spdlog::info("[session] Connecting room {}", room_id);
-    spdlog::debug(
-        "[session] Connecting room {} with server {}:{}, resolving DN.",
-        room_id, server_addr, port);
-    _resolver.async_resolve(
-        server_addr, port,
-        boost::bind(&bilibili_connection_manager::on_resolved, this,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::iterator, room_id));
+    for (auto& shard : _shards)
+        shard->stop();
+    _pool.join_all();
+    _parse_pool.reset();  // the parse threads still call _on_room_data.
 }
 
-void vNerve::bilibili::bilibili_connection_manager::close_connection(int room_id)
+vNerve::bilibili::bilibili_shard& vNerve::bilibili::bilibili_connection_manager::shard_of(const int room_id)
 {
-    spdlog::info("[session] Disconnecting room {}", room_id);
-    auto iter = _connections.find(room_id);
-    if (iter == _connections.end())
-    {
-        spdlog::debug("[session] Room {} not found.", room_id);
-        return;
-    }
-
-    iter->second.close();
+    // Fibonacci hashing: 房间号不一定均匀分布，乘以黄金分割常数打散。
+    // 乘积的低位只取决于房间号的低位，因此取高位：把 32 位的散列值按比例映射到 [0, 分片数)。
+    auto hash = static_cast<uint32_t>(room_id) * UINT32_C(2654435769);
+    return *_shards[(static_cast<uint64_t>(hash) * _shards.size()) >> 32];
 }
 
-void vNerve::bilibili::bilibili_connection_manager::on_resolved(
-    const boost::system::error_code& err,
-    const boost::asio::ip::tcp::resolver::iterator endpoint_iterator,
-    const int room_id)
-{
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted)
-        {
-            spdlog::debug(
-                "[session] Cancelling connecting(resolving) to room {}.",
-                room_id);
-            return;
-        }
-        spdlog::warn(
-            "[session] Failed resolving DN connecting to room {}! err: {}:{}",
-            room_id, err.value(), err.message());
-        on_room_failed(room_id);
-        return;
-    }
-
-    spdlog::debug(
-        "[session] Connecting room {}: server DN resolved, connecting to endpoints.",
-        room_id);
-    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(_context);
-    async_connect(
-        *socket, endpoint_iterator,
-        boost::bind(&bilibili_connection_manager::on_connected, this,
-                    boost::asio::placeholders::error, socket, room_id));
-}
-
-void vNerve::bilibili::bilibili_connection_manager::on_connected(
-    const boost::system::error_code& err,
-    std::shared_ptr<boost::asio::ip::tcp::socket> socket, int room_id)
+void vNerve::bilibili::bilibili_connection_manager::open_connection(const int room_id)
 {
-    if (err)
-    {
-        if (err.value() == boost::asio::error::operation_aborted)
-        {
-            spdlog::debug("[session] Cancelling connecting to room {}.",
-                          room_id);
-            return;
-        }
-        spdlog::warn("[session] Failed connecting to room {}! err: {}:{}",
-                     room_id, err.value(), err.message());
-        on_room_failed(room_id);
-        return;
-    }
-
-    spdlog::debug("[session] Connected to room {}. Setting up connection protocol.", room_id);
-    _connections.emplace(
-        std::piecewise_construct,
-        std::forward_as_tuple(room_id),
-        std::forward_as_tuple(socket, shared_from_this(), room_id)); // Construct connection obj.
+    shard_of(room_id).open_connection(room_id);
 }
 
-void vNerve::bilibili::bilibili_connection_manager::on_room_closed(int room_id)
+void vNerve::bilibili::bilibili_connection_manager::close_connection(const int room_id)
 {
-    _connections.erase(room_id);
+    shard_of(room_id).close_connection(room_id);
 }
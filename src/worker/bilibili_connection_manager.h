@@ -4,10 +4,12 @@
 #include <boost/thread.hpp>
 
 #include "config.h"
-#include "bili_conn.h"
+#include "bilibili_shard.h"
+#include "parse_pool.h"
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -18,43 +20,38 @@ namespace vNerve::bilibili
 class borrowed_message;
 
 using room_event_handler = std::function<void(int)>;
-using room_data_handler = std::function<void(int, borrowed_message*)>;
+using room_data_handler = std::function<void(int, const borrowed_message*)>;
 
 ///
 /// Global network session for Bilibili Livestream chat crawling.
 /// This should be created only once through the whole program.
+/// 每个线程运行一个 bilibili_shard，房间按房间号散列到固定的分片上。
 class bilibili_connection_manager : public std::enable_shared_from_this<bilibili_connection_manager>
 {
-    friend class bilibili_connection;
+    friend class bilibili_shard;
+    friend class parse_pool;
 private:
-    boost::asio::io_context _context;
-    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _guard;
+    config::config_t _options;
+
+    /// null if parsing inline on the shard threads.
+    std::unique_ptr<parse_pool> _parse_pool;
+    std::vector<std::unique_ptr<bilibili_shard>> _shards;
     boost::thread_group _pool;
-    boost::asio::ip::tcp::resolver _resolver;
 
-    std::unordered_map<int, bilibili_connection> _connections;
     int _max_connections;
 
     room_event_handler _on_room_failed;
     room_data_handler _on_room_data;
 
-    config::config_t _options;
-
-    void on_resolved(const boost::system::error_code& err,
-                     boost::asio::ip::tcp::resolver::iterator endpoint_iterator,
-                     int room_id);
-    void on_connected(
-        const boost::system::error_code& err,
-        std::shared_ptr<boost::asio::ip::tcp::socket>, int);
-
+    // called on the shard threads, or the parse threads.
     void on_room_failed(int room_id) { _on_room_failed(room_id); }
-    void on_room_data(int room_id, borrowed_message* msg) { _on_room_data(room_id, msg); }
-    /// called on a room normally closes (usually by an unassignment)
-    void on_room_closed(int room_id);
+    void on_room_data(int room_id, const borrowed_message* msg) { _on_room_data(room_id, msg); }
 
     std::string _shared_heartbeat_buffer_str;
     boost::asio::const_buffer _shared_heartbeat_buffer; // binary string :)
 
+    bilibili_shard& shard_of(int room_id);
+
 public:
     bilibili_connection_manager(config::config_t, room_event_handler on_room_failed, room_data_handler on_room_data);
     ~bilibili_connection_manager();
@@ -62,12 +59,12 @@ public:
     void open_connection(int room_id);
     void close_connection(int room_id);
 
-    const boost::asio::const_buffer& get_heartbeat_buffer()
+    const boost::asio::const_buffer& get_heartbeat_buffer() const
     {
         return _shared_heartbeat_buffer;
     }
 
     boost::program_options::variables_map& get_options() { return *_options; }
-    boost::asio::io_context& get_io_context() { return _context; }
+    parse_pool* get_parse_pool() const { return _parse_pool.get(); }
 };
 } // namespace vNerve::bilibili
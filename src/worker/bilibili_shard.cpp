@@ -0,0 +1,550 @@
+#include "bilibili_shard.h"
+
+#include "bili_json.h"
+#include "bilibili_connection_manager.h"
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace vNerve::bilibili
+{
+// 在此时间内失败过的房间，再次分配时排在新房间之后。
+const auto recent_failure_window = std::chrono::seconds(60);
+// 退避时间从 1s 开始翻倍，最长 60s，实际等待其中 50%~100% 的时间。
+const auto retry_base_delay = std::chrono::milliseconds(1000);
+const auto retry_max_delay = std::chrono::milliseconds(60 * 1000);
+// 距上次失败超过此时间时，重试次数重新计算。
+const auto retry_reset_window = std::chrono::minutes(5);
+#ifdef VNERVE_IO_URING
+// io_uring 提交队列的大小。一轮事件处理中排队的操作超过此数量时分多次提交。
+const unsigned uring_entries = 4096;
+#endif
+}
+
+vNerve::bilibili::bilibili_shard::bilibili_shard(bilibili_connection_manager& manager, const int index)
+    : _manager(manager),
+      _index(index),
+      _context(1),  // 每个分片只有一个线程
+      _guard(_context.get_executor()),
+      _endpoints(_context,
+                 manager.get_options()["chat-server"].as<std::vector<std::string>>(),
+                 std::to_string(manager.get_options()["chat-server-port"].as<int>()),
+                 std::chrono::seconds(manager.get_options()["dns-ttl-sec"].as<int>())),
+      _parse_pool(manager.get_parse_pool()),
+      _parse_producer(_parse_pool ? _parse_pool->create_producer() : nullptr),
+      _heartbeat_timer(_context),
+      _heartbeat_slots(std::max(manager.get_options()["heartbeat-timeout"].as<int>(), 1)),
+      _warm_target(std::max(manager.get_options()["warm-sockets"].as<int>(), 0)),
+      _warm_max_idle(manager.get_options()["warm-socket-idle-sec"].as<int>()),
+      // 并发数与速率按分片平分。
+      _max_connecting(std::max<size_t>(manager.get_options()["max-connecting"].as<int>() / std::max(manager.get_options()["threads"].as<int>(), 1), 1)),
+      _connect_rate(std::max(manager.get_options()["connect-rate"].as<double>() / std::max(manager.get_options()["threads"].as<int>(), 1), 0.001)),
+      _connect_tokens(std::max(_connect_rate, 1.0)),
+      _tokens_updated_at(std::chrono::steady_clock::now()),
+      _admission_timer(_context),
+      _retry_budget(manager.get_options()["retry-budget"].as<int>()),
+      _stall_timeout(manager.get_options()["stall-timeout-sec"].as<int>()),
+      _random(std::random_device()())
+{
+#ifdef VNERVE_IO_URING
+    if (manager.get_options()["io-uring"].as<bool>())
+    {
+        try
+        {
+            _uring = std::make_unique<uring_context>(
+                _context, uring_entries,
+                manager.get_options()["io-uring-buffer-size"].as<size_t>(),
+                std::max(manager.get_options()["io-uring-buffers"].as<int>(), 1));
+        }
+        catch (std::system_error& ex)
+        {
+            spdlog::warn("[shard] [{}] Failed setting up io_uring, using the reactor instead! err:{}", _index, ex.what());
+        }
+    }
+#endif
+    if (manager.get_options()["shared-read-slab"].as<bool>() && !get_uring())
+    {
+        _read_slab_size = manager.get_options()["read-buffer"].as<size_t>();
+        _read_slab.reset(new unsigned char[_read_slab_size + json_padding]);
+    }
+    _heartbeat_timer.expires_from_now(boost::posix_time::seconds(1));
+    start_heartbeat_tick();
+    if (_warm_target)
+        boost::asio::post(_context, [this]() { refill_warm_sockets(); });
+}
+
+vNerve::bilibili::bilibili_shard::~bilibili_shard()
+{
+    stop();
+    // 在其他成员析构之前关闭全部连接。连接析构时不回调分片，只把缓冲区还给 _buffer_pool。
+    _connections.clear();
+}
+
+void vNerve::bilibili::bilibili_shard::run(const bool pin)
+{
+    if (pin)
+    {
+#ifdef _WIN32
+        auto result = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (_index % (sizeof(DWORD_PTR) * 8)));
+        if (!result)
+            spdlog::warn("[shard] [{}] Failed pinning thread to CPU! err:{}", _index, GetLastError());
+#else
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_index % CPU_SETSIZE, &cpus);
+        auto result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (result)
+            spdlog::warn("[shard] [{}] Failed pinning thread to CPU! err:{}", _index, result);
+#endif
+    }
+    spdlog::debug("[shard] [{}] Running shard IO context.", _index);
+    _context.run();
+}
+
+void vNerve::bilibili::bilibili_shard::stop()
+{
+    try
+    {
+        _context.stop();
+    }
+    catch (boost::system::system_error& ex)
+    {
+        spdlog::critical(
+            "[shard] [{}] Failed shutting down shard IO Context! err:{}:{}:{}",
+            _index, ex.code().value(), ex.code().message(), ex.what());
+    }
+}
+
+void vNerve::bilibili::bilibili_shard::open_connection(const int room_id)
+{
+    boost::asio::post(_context, [this, room_id]() { do_open_connection(room_id); });
+}
+
+void vNerve::bilibili::bilibili_shard::close_connection(const int room_id)
+{
+    boost::asio::post(_context, [this, room_id]() { do_close_connection(room_id); });
+}
+
+void vNerve::bilibili::bilibili_shard::do_open_connection(const int room_id)
+{
+    // 重复的分配不能再发起一次连接：否则两次连接完成时会争抢 _connections 中的同一项。
+    auto connecting = _connecting.find(room_id);
+    if (connecting != _connecting.end())
+    {
+        connecting->second = false;  // assigned again before the connect completes.
+        spdlog::debug("[shard] [{}] Room {} is already connecting.", _index, room_id);
+        return;
+    }
+    if (_connections.find(room_id) != _connections.end())
+    {
+        spdlog::debug("[shard] [{}] Room {} is already connected.", _index, room_id);
+        return;
+    }
+    auto retry = _retries.find(room_id);
+    if (retry != _retries.end() && retry->second.waiting)
+    {
+        spdlog::debug("[shard] [{}] Room {} is waiting for a retry.", _index, room_id);
+        return;
+    }
+    for (auto queue : {&_admission_fresh, &_admission_retry})
+        if (std::find(queue->begin(), queue->end(), room_id) != queue->end())
+        {
+            spdlog::debug("[shard] [{}] Room {} is already queued for connecting.", _index, room_id);
+            return;
+        }
+
+    if (_admission_fresh.empty() && _admission_retry.empty() && _connecting.empty())
+    {
+        _admission_started_at = std::chrono::steady_clock::now();
+        _admission_connected = 0;
+        _admission_failed = 0;
+    }
+
+    auto failure = _recent_failures.find(room_id);
+    if (failure != _recent_failures.end()
+        && std::chrono::steady_clock::now() - failure->second < recent_failure_window)
+        _admission_retry.push_back(room_id);
+    else
+        _admission_fresh.push_back(room_id);
+    admit();
+}
+
+void vNerve::bilibili::bilibili_shard::admit()
+{
+    if (_admitting)
+        return;  // a warm socket connects synchronously and gets back here.
+    _admitting = true;
+
+    auto now = std::chrono::steady_clock::now();
+    auto burst = std::max(_connect_rate, 1.0);
+    _connect_tokens = std::min(burst, _connect_tokens + std::chrono::duration<double>(now - _tokens_updated_at).count() * _connect_rate);
+    _tokens_updated_at = now;
+
+    while (!(_admission_fresh.empty() && _admission_retry.empty())
+           || _warm_sockets.size() + _warm_connecting < _warm_target)
+    {
+        auto rooms_waiting = !(_admission_fresh.empty() && _admission_retry.empty());
+        if (rooms_waiting && !_warm_sockets.empty())
+        {
+            // 预热的 socket 已经连接好，不会新建连接，不消耗令牌。
+            auto& queue = _admission_fresh.empty() ? _admission_retry : _admission_fresh;
+            auto room_id = queue.front();
+            queue.pop_front();
+            _connecting.emplace(room_id, false);
+            start_connection(room_id);
+            continue;
+        }
+        if (_connecting.size() + _warm_connecting >= _max_connecting)
+            break;
+        if (_connect_tokens < 1)
+        {
+            if (!_admission_timer_armed)
+            {
+                _admission_timer_armed = true;
+                _admission_timer.expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>((1 - _connect_tokens) / _connect_rate)));
+                _admission_timer.async_wait([this](const boost::system::error_code& err) {
+                    _admission_timer_armed = false;
+                    if (!err)
+                        admit();
+                });
+            }
+            break;
+        }
+        _connect_tokens -= 1;
+        if (!rooms_waiting)
+        {
+            // 补充预热 socket 的连接排在房间之后。
+            start_warm_connection();
+            continue;
+        }
+        auto& queue = _admission_fresh.empty() ? _admission_retry : _admission_fresh;
+        auto room_id = queue.front();
+        queue.pop_front();
+        _connecting.emplace(room_id, false);
+        start_connection(room_id);
+    }
+    _admitting = false;
+
+    if (_admission_fresh.empty() && _admission_retry.empty() && _connecting.empty()
+        && _admission_connected + _admission_failed)
+    {
+        spdlog::info("[shard] [{}] Connected {} rooms ({} failed) in {} ms.",
+                     _index, _admission_connected, _admission_failed,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _admission_started_at).count());
+        _admission_connected = 0;
+        _admission_failed = 0;
+    }
+}
+
+bool vNerve::bilibili::bilibili_shard::on_connect_finished(const int room_id, const bool succeeded)
+{
+    auto connecting = _connecting.find(room_id);
+    auto closing = connecting != _connecting.end() && connecting->second;
+    if (connecting != _connecting.end())
+        _connecting.erase(connecting);
+    if (succeeded)
+        _admission_connected++;
+    else
+        _admission_failed++;
+    admit();
+    return closing;
+}
+
+void vNerve::bilibili::bilibili_shard::start_connection(const int room_id)
+{
+    if (!_warm_sockets.empty())
+    {
+        auto socket = std::move(_warm_sockets.back().socket);
+        _warm_sockets.pop_back();
+        spdlog::info("[shard] [{}] Connecting room {} with a warm socket, {} left.",
+                     _index, room_id, _warm_sockets.size());
+        on_connected(boost::system::error_code(), std::move(socket), room_id);
+        refill_warm_sockets();
+        return;
+    }
+
+    spdlog::info("[shard] [{}] Connecting room {}", _index, room_id);
+    _endpoints.async_connect(
+        [this, room_id](const boost::system::error_code& err, std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+            on_connected(err, std::move(socket), room_id);
+        });
+}
+
+void vNerve::bilibili::bilibili_shard::do_close_connection(const int room_id)
+{
+    spdlog::info("[shard] [{}] Disconnecting room {}", _index, room_id);
+    auto retry = _retries.find(room_id);
+    if (retry != _retries.end())
+    {
+        auto waiting = retry->second.waiting;
+        _retries.erase(retry);
+        if (waiting)
+            return;  // not connected.
+    }
+    auto connecting = _connecting.find(room_id);
+    if (connecting != _connecting.end())
+    {
+        connecting->second = true;  // closed by on_connected.
+        return;
+    }
+    for (auto queue : {&_admission_fresh, &_admission_retry})
+    {
+        auto queued = std::find(queue->begin(), queue->end(), room_id);
+        if (queued != queue->end())
+        {
+            queue->erase(queued);
+            return;  // not connected yet.
+        }
+    }
+    auto iter = _connections.find(room_id);
+    if (iter == _connections.end())
+    {
+        spdlog::debug("[shard] [{}] Room {} not found.", _index, room_id);
+        return;
+    }
+
+    iter->second.close();
+}
+
+void vNerve::bilibili::bilibili_shard::on_connected(
+    const boost::system::error_code& err,
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket, int room_id)
+{
+    auto closing = on_connect_finished(room_id, !err);
+    if (closing)
+    {
+        spdlog::info("[shard] [{}] Room {} was unassigned while connecting. Dropping the connection.",
+                     _index, room_id);
+        if (socket)
+        {
+            boost::system::error_code ec;
+            socket->close(ec);
+        }
+        return;
+    }
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+        {
+            spdlog::debug("[shard] [{}] Cancelling connecting to room {}.",
+                          _index, room_id);
+            return;
+        }
+        spdlog::warn("[shard] [{}] Failed connecting to room {}! err: {}:{}",
+                     _index, room_id, err.value(), err.message());
+        on_room_failed(room_id);
+        return;
+    }
+
+    spdlog::debug("[shard] [{}] Connected to room {}. Setting up connection protocol.", _index, room_id);
+    _connections.emplace(
+        std::piecewise_construct,
+        std::forward_as_tuple(room_id),
+        std::forward_as_tuple(socket, this, room_id)); // Construct connection obj.
+}
+
+void vNerve::bilibili::bilibili_shard::refill_warm_sockets()
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!_warm_sockets.empty() && now - _warm_sockets.front().connected_at > _warm_max_idle)
+    {
+        boost::system::error_code ec;
+        _warm_sockets.front().socket->close(ec);
+        _warm_sockets.pop_front();
+    }
+
+    // 新的连接与房间的连接一样经过令牌桶。
+    admit();
+}
+
+void vNerve::bilibili::bilibili_shard::start_warm_connection()
+{
+    _warm_connecting++;
+    SPDLOG_DEBUG("[shard] [{}] Connecting a warm socket, {} ready, {} connecting.",
+                 _index, _warm_sockets.size(), _warm_connecting);
+    _endpoints.async_connect(
+        [this](const boost::system::error_code& err, std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+            on_warm_connected(err, std::move(socket));
+        });
+}
+
+void vNerve::bilibili::bilibili_shard::on_warm_connected(
+    const boost::system::error_code& err,
+    std::shared_ptr<boost::asio::ip::tcp::socket> socket)
+{
+    _warm_connecting--;
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+            return;
+        spdlog::warn("[shard] [{}] Failed connecting warm socket! err: {}:{}",
+                     _index, err.value(), err.message());
+    }
+    else
+        _warm_sockets.push_back(warm_socket{std::move(socket), std::chrono::steady_clock::now()});
+    admit();  // a queued room can take the new socket, or the freed slot; a failed one is retried at the token rate.
+}
+
+void vNerve::bilibili::bilibili_shard::on_room_failed(const int room_id)
+{
+    auto now = std::chrono::steady_clock::now();
+    _recent_failures[room_id] = now;
+
+    auto& retry = _retries[room_id];
+    if (now - retry.last_failure > retry_reset_window)
+        retry.attempts = 0;
+    retry.last_failure = now;
+    if (retry.attempts >= _retry_budget)
+    {
+        spdlog::warn("[shard] [{}] Room {} failed after {} retries. Reporting to supervisor.",
+                     _index, room_id, retry.attempts);
+        _retries.erase(room_id);
+        _manager.on_room_failed(room_id);
+        return;
+    }
+
+    auto delay = std::min<std::chrono::milliseconds>(retry_base_delay * (1 << std::min(retry.attempts, 16)), retry_max_delay);
+    auto jittered = std::chrono::duration_cast<std::chrono::milliseconds>(
+        delay * std::uniform_real_distribution<double>(0.5, 1.0)(_random));
+    retry.attempts++;
+    retry.due = now + jittered;
+    retry.waiting = true;
+    spdlog::info("[shard] [{}] Room {} failed. Retrying in {} ms ({}/{}).",
+                 _index, room_id, jittered.count(), retry.attempts, _retry_budget);
+}
+
+void vNerve::bilibili::bilibili_shard::retry_due_rooms(const std::chrono::steady_clock::time_point now)
+{
+    std::vector<int> due;
+    for (auto& [room_id, retry] : _retries)
+        if (retry.waiting && retry.due <= now)
+        {
+            retry.waiting = false;
+            due.push_back(room_id);
+        }
+    for (auto room_id : due)
+        do_open_connection(room_id);
+}
+
+void vNerve::bilibili::bilibili_shard::close_stalled_rooms(const std::vector<int>& slot, const std::chrono::steady_clock::time_point now)
+{
+    std::vector<int> stalled;
+    for (auto room_id : slot)
+    {
+        auto iter = _connections.find(room_id);
+        if (iter != _connections.end() && iter->second.stalled(now, _stall_timeout))
+            stalled.push_back(room_id);
+    }
+    // closing removes the room from the slot, so don't do it while iterating.
+    for (auto room_id : stalled)
+    {
+        spdlog::warn("[shard] [{}] Room {} stalled: no message for a long time. Reconnecting.", _index, room_id);
+        auto iter = _connections.find(room_id);
+        if (iter != _connections.end())
+            iter->second.close(true);
+    }
+}
+
+void vNerve::bilibili::bilibili_shard::on_room_data(const int room_id, const borrowed_message* msg)
+{
+    _manager.on_room_data(room_id, msg);
+}
+
+void vNerve::bilibili::bilibili_shard::submit_packet(const int room_id, const unsigned char* packet, const size_t length)
+{
+    _parse_pool->submit(*_parse_producer, room_id, packet, length);
+}
+
+void vNerve::bilibili::bilibili_shard::on_room_closed(const int room_id)
+{
+    unschedule_heartbeat(room_id);
+    _connections.erase(room_id);
+}
+
+void vNerve::bilibili::bilibili_shard::schedule_heartbeat(const int room_id)
+{
+    auto& slot = _heartbeat_slots[static_cast<unsigned int>(room_id) % _heartbeat_slots.size()];
+    if (std::find(slot.begin(), slot.end(), room_id) == slot.end())
+        slot.push_back(room_id);
+}
+
+void vNerve::bilibili::bilibili_shard::unschedule_heartbeat(const int room_id)
+{
+    auto& slot = _heartbeat_slots[static_cast<unsigned int>(room_id) % _heartbeat_slots.size()];
+    auto iter = std::find(slot.begin(), slot.end(), room_id);
+    if (iter == slot.end())
+        return;
+    *iter = slot.back();
+    slot.pop_back();
+}
+
+void vNerve::bilibili::bilibili_shard::start_heartbeat_tick()
+{
+    _heartbeat_timer.async_wait(
+        boost::bind(&bilibili_shard::on_heartbeat_tick, this,
+                    boost::asio::placeholders::error));
+}
+
+void vNerve::bilibili::bilibili_shard::on_heartbeat_tick(const boost::system::error_code& err)
+{
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+        {
+            spdlog::debug("[shard] [{}] Cancelling heartbeat timer.", _index);
+            return;
+        }
+        spdlog::warn("[shard] [{}] Error in heartbeat tick! err:{}: {}",
+                     _index, err.value(), err.message());
+    }
+
+    auto& slot = _heartbeat_slots[_heartbeat_cursor];
+    if (!slot.empty())
+        spdlog::debug("[shard] [{}] Sending heartbeat to {} rooms in slot {}.",
+                      _index, slot.size(), _heartbeat_cursor);
+    for (auto room_id : slot)
+    {
+        auto iter = _connections.find(room_id);
+        if (iter != _connections.end())
+            iter->second.send_heartbeat();
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (_stall_timeout.count())
+        close_stalled_rooms(slot, now);
+    retry_due_rooms(now);
+    _heartbeat_cursor = (_heartbeat_cursor + 1) % _heartbeat_slots.size();
+    if (!_heartbeat_cursor)
+    {
+        // once per cycle is enough for forgetting old failures.
+        for (auto iter = _recent_failures.begin(); iter != _recent_failures.end();)
+            iter = now - iter->second >= recent_failure_window ? _recent_failures.erase(iter) : std::next(iter);
+    }
+    if (_warm_target)
+        refill_warm_sockets();
+
+    // 以上次的到期时间为基准，避免误差累积。
+    _heartbeat_timer.expires_at(_heartbeat_timer.expires_at() + boost::posix_time::seconds(1));
+    start_heartbeat_tick();
+}
+
+const boost::asio::const_buffer& vNerve::bilibili::bilibili_shard::get_heartbeat_buffer() const
+{
+    return _manager.get_heartbeat_buffer();
+}
+
+boost::program_options::variables_map& vNerve::bilibili::bilibili_shard::get_options()
+{
+    return _manager.get_options();
+}
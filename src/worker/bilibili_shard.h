@@ -0,0 +1,190 @@
+#pragma once
+
+#include "bili_conn.h"
+#include "buffer_pool.h"
+#include "endpoint_pool.h"
+#include "parse_pool.h"
+#include "uring_context.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+namespace vNerve::bilibili
+{
+class borrowed_message;
+class bilibili_connection_manager;
+
+///
+/// 一个分片：一个 io_context 和一个线程，以及散列到本分片的全部房间。
+/// 房间的 socket、心跳、解析上下文（线程局部）和连接表都只在本分片的线程上访问，因此无需加锁。
+/// 除 open_connection/close_connection 外，其他成员函数都只能在本分片的线程上调用。
+class bilibili_shard
+{
+    friend class bilibili_connection;
+private:
+    bilibili_connection_manager& _manager;
+    int _index;
+
+    boost::asio::io_context _context;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _guard;
+    endpoint_pool _endpoints;
+
+    ///
+    /// shared-read-slab 模式下本分片所有连接共用的读缓冲区，以及存放各连接不完整数据包的缓冲区池。
+    /// 须在 _connections 之前声明，连接析构时才能把缓冲区还给池。
+    std::unique_ptr<unsigned char[]> _read_slab;
+    size_t _read_slab_size = 0;
+    buffer_pool _buffer_pool;
+#ifdef VNERVE_IO_URING
+    ///
+    /// io-uring 模式下本分片的 io_uring。同样须在 _connections 之前声明，连接析构时要取消其中的接收。
+    std::unique_ptr<uring_context> _uring;
+#endif
+
+    std::unordered_map<int, bilibili_connection> _connections;
+
+    parse_pool* _parse_pool;
+    std::unique_ptr<parse_producer> _parse_producer;
+
+    ///
+    /// 心跳时间轮。每秒前进一格，转一圈恰好为一个心跳周期。
+    /// 房间按房间号散列到各格，同一秒连接上的大量房间不会在同一秒发送心跳。
+    boost::asio::deadline_timer _heartbeat_timer;
+    std::vector<std::vector<int>> _heartbeat_slots;
+    size_t _heartbeat_cursor = 0;
+
+    ///
+    /// 预先连接好、尚未加入房间的 socket。分配房间时直接发送加入房间的数据包，省去解析与握手。
+    /// 最早连接的在队首，空闲太久的会被关闭重连，以免被服务器断开。
+    struct warm_socket
+    {
+        std::shared_ptr<boost::asio::ip::tcp::socket> socket;
+        std::chrono::steady_clock::time_point connected_at;
+    };
+    std::deque<warm_socket> _warm_sockets;
+    size_t _warm_target;
+    size_t _warm_connecting = 0;
+    std::chrono::seconds _warm_max_idle;
+
+    /// drops stale warm sockets and lets admit() connect new ones until the pool is full.
+    void refill_warm_sockets();
+    void start_warm_connection();
+    void on_warm_connected(const boost::system::error_code& err,
+                           std::shared_ptr<boost::asio::ip::tcp::socket>);
+
+    ///
+    /// 连接准入控制。新分配的房间先进入队列，由令牌桶限制每秒新建的连接数，并限制同时进行中的连接数，
+    /// 避免大量房间同时分配时集中发起连接。最近失败过的房间排在新房间之后。
+    /// 补充预热 socket 的连接同样受令牌桶与并发数限制，排在房间之后；使用预热 socket 的房间不新建连接，不消耗令牌。
+    std::deque<int> _admission_fresh;
+    std::deque<int> _admission_retry;
+    std::unordered_map<int, std::chrono::steady_clock::time_point> _recent_failures;
+    ///
+    /// 正在连接的房间。值为连接期间是否收到了关闭请求，连接完成时据此直接关闭 socket，而不是建立连接。
+    std::unordered_map<int, bool> _connecting;
+    size_t _max_connecting;
+    double _connect_rate;
+    double _connect_tokens;
+    std::chrono::steady_clock::time_point _tokens_updated_at;
+    boost::asio::steady_timer _admission_timer;
+    bool _admission_timer_armed = false;
+    bool _admitting = false;
+    /// for measuring time-to-all-connected of a batch of assignments.
+    std::chrono::steady_clock::time_point _admission_started_at;
+    size_t _admission_connected = 0;
+    size_t _admission_failed = 0;
+
+    ///
+    /// 本地重连。连接失败的房间按带抖动的指数退避在本分片内重连，重试次数用尽后才报告给 Supervisor。
+    /// 到期的重连由心跳时间轮每秒检查一次。
+    struct retry_state
+    {
+        int attempts = 0;
+        std::chrono::steady_clock::time_point last_failure;
+        std::chrono::steady_clock::time_point due;
+        bool waiting = false;
+    };
+    std::unordered_map<int, retry_state> _retries;
+    int _retry_budget;
+    std::chrono::seconds _stall_timeout;
+    std::minstd_rand _random;
+
+    void retry_due_rooms(std::chrono::steady_clock::time_point now);
+    void close_stalled_rooms(const std::vector<int>& slot, std::chrono::steady_clock::time_point now);
+
+    void admit();
+    ///
+    /// @return 连接期间是否收到了关闭请求。
+    bool on_connect_finished(int room_id, bool succeeded);
+    void start_connection(int room_id);
+
+    void do_open_connection(int room_id);
+    void do_close_connection(int room_id);
+
+    void on_connected(
+        const boost::system::error_code& err,
+        std::shared_ptr<boost::asio::ip::tcp::socket>, int);
+
+    ///
+    /// 连接或房间出错时调用。重试次数未用尽时安排本地重连，否则报告给 Supervisor。
+    void on_room_failed(int room_id);
+    void on_room_data(int room_id, const borrowed_message* msg);
+    ///
+    /// 把一个完整的数据包交给解析线程池。只在 parse-threads 不为 0 时调用。
+    void submit_packet(int room_id, const unsigned char* packet, size_t length);
+    /// called on a room normally closes (usually by an unassignment)
+    void on_room_closed(int room_id);
+
+    /// called when the room has joined, its connection will receive heartbeats until closed.
+    void schedule_heartbeat(int room_id);
+    void unschedule_heartbeat(int room_id);
+    void start_heartbeat_tick();
+    void on_heartbeat_tick(const boost::system::error_code&);
+
+public:
+    bilibili_shard(bilibili_connection_manager& manager, int index);
+    ///
+    /// 关闭本分片的全部连接。调用前本分片的线程必须已经退出。
+    ~bilibili_shard();
+
+    bilibili_shard(const bilibili_shard& other) = delete;
+    bilibili_shard& operator=(const bilibili_shard& other) = delete;
+
+    ///
+    /// 线程入口。在当前线程上运行本分片的 io_context，直到 stop()。
+    /// @param pin 是否把当前线程绑定到第 index 个 CPU 上。
+    void run(bool pin);
+    void stop();
+
+    /// Thread-safe.
+    void open_connection(int room_id);
+    /// Thread-safe.
+    void close_connection(int room_id);
+
+    [[nodiscard]] int index() const { return _index; }
+    const boost::asio::const_buffer& get_heartbeat_buffer() const;
+    boost::program_options::variables_map& get_options();
+    boost::asio::io_context& get_io_context() { return _context; }
+    ///
+    /// 共用读缓冲区。其后另有 json_padding 个字节，json 可以原地解析。未开启 shared-read-slab 时为空。
+    [[nodiscard]] unsigned char* get_read_slab() const { return _read_slab.get(); }
+    [[nodiscard]] size_t get_read_slab_size() const { return _read_slab_size; }
+    buffer_pool& get_buffer_pool() { return _buffer_pool; }
+    ///
+    /// 本分片的 io_uring。未开启 io-uring 或初始化失败时为空。
+#ifdef VNERVE_IO_URING
+    [[nodiscard]] uring_context* get_uring() const { return _uring.get(); }
+#else
+    [[nodiscard]] uring_context* get_uring() const { return nullptr; }
+#endif
+    [[nodiscard]] bool parses_inline() const { return _parse_pool == nullptr; }
+};
+}  // namespace vNerve::bilibili
@@ -1,14 +1,38 @@
 #pragma once
 
-namespace vNerve
+#include "type.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace vNerve::bilibili
 {
+///
+/// 解析得到的消息，即 live::RoomMessage 序列化后的字节，或者一批这样的消息。
+/// 数据归解析线程的 parse_context 所有，只在回调期间有效。
+/// 其中的字符串字段都已确认是合法的 UTF-8，转发前不必再逐个检查。
 class borrowed_message
 {
 public:
-    int crc32;
+    // 友元必须在函数内声明 没法用宏批量定义
+    // 只好从private挪进public 反正内部类无伤大雅
+    const unsigned char* _data = nullptr;
+    size_t _length = 0;
+    ///
+    /// 原始 json 的指纹，见 fingerprint()。count 大于 1 时为 0。
+    checksum_t checksum = 0;
+    ///
+    /// 消息条数。大于 1 时数据为同一个压缩包中的全部消息，
+    /// 每条消息是 repeated RoomMessage messages = 1 的一项，见 begin_batch()。
+    /// 此时以批量数据包（BATCH DATA）转发给 Supervisor，见 simple_worker_proto.h。
+    size_t count = 1;
+    ///
+    /// count 大于 1 时每条消息原始 json 的指纹，顺序与消息相同。Supervisor 按条去重。
+    const checksum_t* batch_checksum = nullptr;
     // TODO: use size constant from shared folder
-    char routing_key[24];
-    virtual size_t size() = 0;
-    virtual void write(void* data, int size) = 0;
+    char routing_key[24] = {};
+
+    [[nodiscard]] size_t size() const { return _length; }
+    void write(void* data, int size) const { std::memcpy(data, _data, static_cast<size_t>(size) < _length ? size : _length); }
 };
-}  // namespace vNerve
+}  // namespace vNerve::bilibili
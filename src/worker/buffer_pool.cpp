@@ -0,0 +1,98 @@
+#include "buffer_pool.h"
+
+#include <cstring>
+#include <utility>
+
+namespace vNerve::bilibili
+{
+const size_t buffer_pool_min_shift = 8;    // 256 B
+const size_t buffer_pool_max_shift = 25;   // 32 MiB
+const size_t buffer_pool_cache_bytes = 1024 * 1024;  // 每级缓存的上限，至少缓存一块。
+
+size_t size_class_of(const size_t size)
+{
+    size_t shift = buffer_pool_min_shift;
+    while ((size_t(1) << shift) < size)
+        shift++;
+    return shift;
+}
+
+buffer_pool::buffer_pool()
+    : _free_blocks(buffer_pool_max_shift + 1)
+{
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (auto& blocks : _free_blocks)
+        for (auto block : blocks)
+            delete[] block;
+}
+
+std::pair<unsigned char*, size_t> buffer_pool::allocate(const size_t min_size)
+{
+    auto shift = size_class_of(min_size);
+    if (shift > buffer_pool_max_shift)
+        return std::pair(new unsigned char[min_size], min_size);  // not pooled.
+
+    auto size = size_t(1) << shift;
+    auto& blocks = _free_blocks[shift];
+    if (blocks.empty())
+        return std::pair(new unsigned char[size], size);
+    auto block = blocks.back();
+    blocks.pop_back();
+    return std::pair(block, size);
+}
+
+void buffer_pool::deallocate(unsigned char* block, const size_t size)
+{
+    auto shift = size_class_of(size);
+    if (shift > buffer_pool_max_shift || (size_t(1) << shift) != size)
+    {
+        delete[] block;
+        return;
+    }
+    auto& blocks = _free_blocks[shift];
+    if (blocks.empty() || (blocks.size() + 1) * size <= buffer_pool_cache_bytes)
+        blocks.push_back(block);
+    else
+        delete[] block;
+}
+
+void pooled_buffer::reserve(const size_t min_size, const size_t keep)
+{
+    if (_capacity >= min_size)
+        return;
+    auto [block, size] = _pool->allocate(min_size);
+    if (keep)
+        std::memcpy(block, _data, keep);
+    release();
+    _data = block;
+    _capacity = size;
+}
+
+void pooled_buffer::assign(const unsigned char* src, const size_t size, const size_t min_size)
+{
+    if (_data && _capacity >= min_size && _capacity / 2 < min_size)
+    {
+        // already the right size class.
+        if (size && src != _data)
+            std::memmove(_data, src, size);
+        return;
+    }
+    auto [block, capacity] = _pool->allocate(min_size);
+    if (size)
+        std::memcpy(block, src, size);
+    release();
+    _data = block;
+    _capacity = capacity;
+}
+
+void pooled_buffer::release()
+{
+    if (_data)
+        _pool->deallocate(_data, _capacity);
+    _data = nullptr;
+    _capacity = 0;
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace vNerve::bilibili
+{
+///
+/// 按 2 的幂分级的缓冲区池。
+/// 不加锁，只能在一个线程（一个分片）上使用。每级缓存的总大小有上限，超出的缓冲区直接释放。
+class buffer_pool
+{
+private:
+    std::vector<std::vector<unsigned char*>> _free_blocks;
+
+public:
+    buffer_pool();
+    ~buffer_pool();
+
+    buffer_pool(const buffer_pool& other) = delete;
+    buffer_pool& operator=(const buffer_pool& other) = delete;
+
+    ///
+    /// @return 至少 min_size 字节的缓冲区及其实际大小。
+    std::pair<unsigned char*, size_t> allocate(size_t min_size);
+    void deallocate(unsigned char* block, size_t size);
+};
+
+///
+/// 从 buffer_pool 借出的缓冲区。析构时归还。
+class pooled_buffer
+{
+private:
+    buffer_pool* _pool = nullptr;
+    unsigned char* _data = nullptr;
+    size_t _capacity = 0;
+
+public:
+    pooled_buffer() = default;
+    explicit pooled_buffer(buffer_pool* pool) : _pool(pool) {}
+    ~pooled_buffer() { release(); }
+
+    pooled_buffer(const pooled_buffer& other) = delete;
+    pooled_buffer& operator=(const pooled_buffer& other) = delete;
+
+    pooled_buffer(pooled_buffer&& other) noexcept
+        : _pool(other._pool),
+          _data(other._data),
+          _capacity(other._capacity)
+    {
+        other._data = nullptr;
+        other._capacity = 0;
+    }
+    pooled_buffer& operator=(pooled_buffer&& other) noexcept
+    {
+        if (this == &other)
+            return *this;
+        release();
+        _pool = other._pool;
+        _data = other._data;
+        _capacity = other._capacity;
+        other._data = nullptr;
+        other._capacity = 0;
+        return *this;
+    }
+
+    [[nodiscard]] unsigned char* data() const { return _data; }
+    [[nodiscard]] size_t capacity() const { return _capacity; }
+
+    ///
+    /// 保证容量不小于 min_size，保留前 keep 个字节。
+    void reserve(size_t min_size, size_t keep);
+    ///
+    /// 换成一块刚好能容纳 min_size 字节的缓冲区（当前缓冲区大小合适时沿用），并复制 [src, src + size)。
+    /// src 可以指向本缓冲区内部。
+    void assign(const unsigned char* src, size_t size, size_t min_size);
+    void release();
+};
+}  // namespace vNerve::bilibili
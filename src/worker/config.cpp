@@ -1,20 +1,35 @@
 #include "config.h"
 
+#include <string>
+#include <vector>
+
 namespace vNerve::bilibili::config
 {
 // Default options.
 const int DEFAULT_HEARTBEAT_TIMEOUT_SEC = 40;
 const std::string DEFAULT_CHAT_SERVER = "broadcastlv.chat.bilibili.com";
 const int DEFAULT_CHAT_SERVER_PORT = 2243;
+const int DEFAULT_DNS_TTL_SEC = 300;
 const int DEFAULT_CHAT_SERVER_PROTOCOL_VER = 2;
+const int DEFAULT_WARM_SOCKETS = 0;
+const int DEFAULT_MAX_CONNECTING = 64;
+const int DEFAULT_RETRY_BUDGET = 5;
+const int DEFAULT_STALL_TIMEOUT_SEC = 300;
+const double DEFAULT_CONNECT_RATE = 100;
+const int DEFAULT_WARM_SOCKET_IDLE_SEC = 20;
 
 const int DEFAULT_READ_BUFFER = 128 * 1024;
+const int DEFAULT_DECOMPRESS_BUFFER = 256 * 1024;
 const int DEFAULT_THREADS = 1;
+const int DEFAULT_PARSE_THREADS = 0;
+const int DEFAULT_IO_URING_BUFFERS = 1024;
+const int DEFAULT_IO_URING_BUFFER_SIZE = 16 * 1024;
 
 const std::string DEFAULT_SUPERVISOR_HOST = "localhost";
 const int DEFAULT_SUPERVISOR_PORT = 2434;
 const int DEFAULT_MAX_ROOMS = 500;
 const int DEFAULT_MAX_RETRY_SEC = 60;
+const int DEFAULT_SHUTDOWN_TIMEOUT_SEC = 5;
 
 boost::program_options::options_description create_description()
 {
@@ -28,16 +43,33 @@ boost::program_options::options_description create_description()
     auto descNetworking = options_description("Networking parameters");
     descNetworking.add_options()
         ("read-buffer,b", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) of sockets to bilibili server.")
-        ("zlib-buffer", value<size_t>()->default_value(DEFAULT_READ_BUFFER), "Reading buffer size(bytes) for storing unzipped bilibili chat packet.")
-        ("threads", value<int>()->default_value(DEFAULT_THREADS), "Thread numbers for communicating with bilibili server.")
+        ("shared-read-slab", bool_switch(), "Read into one buffer per thread and keep only incomplete packets per connection, instead of a read-buffer per connection.")
+        ("zlib-buffer", value<size_t>()->default_value(DEFAULT_DECOMPRESS_BUFFER), "Initial size(bytes) of the per-thread window for decompressed bilibili chat packets. Grows up to 16 MiB when a single packet does not fit.")
+        ("threads", value<int>()->default_value(DEFAULT_THREADS), "Thread numbers for communicating with bilibili server. Each thread runs its own shard of rooms.")
+        ("pin-threads", bool_switch(), "Pin each communicating thread to a CPU core.")
+        ("parse-threads", value<int>()->default_value(DEFAULT_PARSE_THREADS), "Thread numbers for decompressing and parsing packets. 0 to parse on the communicating threads.")
+#ifdef VNERVE_IO_URING
+        ("io-uring", bool_switch(), "Receive with io_uring multishot recv into a provided buffer ring per thread, and submit heartbeats in batches. Needs Linux 6.0+. Overrides shared-read-slab.")
+        ("io-uring-buffers", value<int>()->default_value(DEFAULT_IO_URING_BUFFERS), "Receive buffers in the io_uring buffer ring of each communicating thread. Rounded up to a power of 2.")
+        ("io-uring-buffer-size", value<size_t>()->default_value(DEFAULT_IO_URING_BUFFER_SIZE), "Size(bytes) of each io_uring receive buffer.")
+#endif
     ;
 
     auto descBili = options_description("Bilibili Livestream Interface options");
     descBili.add_options()
         ("heartbeat-timeout,t", value<int>()->default_value(DEFAULT_HEARTBEAT_TIMEOUT_SEC), "Timeout(secs) between heartbeat packets to Bilibili server.")
-        ("chat-server,s", value<std::string>()->default_value(DEFAULT_CHAT_SERVER), "Bilibili live chat server in TCP mode.")
+        ("chat-server,s", value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{DEFAULT_CHAT_SERVER}, DEFAULT_CHAT_SERVER), "Bilibili live chat servers in TCP mode. New rooms go to the fastest healthy one.")
+        ("dns-ttl-sec", value<int>()->default_value(DEFAULT_DNS_TTL_SEC), "Interval(secs) between re-resolving chat servers.")
         ("chat-server-port,p", value<int>()->default_value(DEFAULT_CHAT_SERVER_PORT), "Bilibili live chat server port.")
-        ("protocol-ver,V", value<int>()->default_value(DEFAULT_CHAT_SERVER_PROTOCOL_VER),"Bilibili live chat server protocol version.")
+        ("max-connecting", value<int>()->default_value(DEFAULT_MAX_CONNECTING), "Max concurrent connecting rooms and warm sockets. Shared evenly between communicating threads.")
+        ("connect-rate", value<double>()->default_value(DEFAULT_CONNECT_RATE), "Max new connections (rooms and warm sockets) per second. Rooms assigned to a warm socket don't count. Shared evenly between communicating threads.")
+        ("retry-budget", value<int>()->default_value(DEFAULT_RETRY_BUDGET), "Local reconnecting attempts for a failed room before reporting to supervisor.")
+        ("stall-timeout-sec", value<int>()->default_value(DEFAULT_STALL_TIMEOUT_SEC), "Reconnect a room receiving no message for this long(secs), and far longer than usual. Only rooms that have received messages before are checked. 0 to disable.")
+        ("warm-sockets", value<int>()->default_value(DEFAULT_WARM_SOCKETS), "Connected idle sockets kept by each communicating thread, so that an assigned room only needs to send the join packet.")
+        ("warm-socket-idle-sec", value<int>()->default_value(DEFAULT_WARM_SOCKET_IDLE_SEC), "Max idle time(secs) of a warm socket before reconnecting it.")
+        ("cmd-allow", value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{}, ""), "Only forward these cmds. Empty to forward all supported cmds.")
+        ("cmd-deny", value<std::vector<std::string>>()->multitoken()->default_value(std::vector<std::string>{}, ""), "Never forward these cmds.")
+        ("protocol-ver,V", value<int>()->default_value(DEFAULT_CHAT_SERVER_PROTOCOL_VER),"Bilibili live chat server protocol version. 2 for zlib-compressed, 3 for brotli-compressed messages.")
     ;
 
     auto descSupervisor = options_description("vNerve bilibili chat supervisor options");
@@ -46,6 +78,7 @@ boost::program_options::options_description create_description()
         ("supervisor-port,P", value<int>()->default_value(DEFAULT_SUPERVISOR_PORT), "vNerve Bilibili chat supervisor host. Default to 2434")
         ("max-rooms,M", value<int>()->default_value(DEFAULT_MAX_ROOMS), "Max concurrent connecting rooms.")
         ("retry-interval-sec,R", value<int>()->default_value(DEFAULT_MAX_RETRY_SEC), "Interval between retrying to connect to supervisor. In seconds.")
+        ("shutdown-timeout-sec", value<int>()->default_value(DEFAULT_SHUTDOWN_TIMEOUT_SEC), "Max time(sec) for flushing messages to supervisor when shutting down.")
     ;
 
     auto desc = options_description("vNerve Bilibili Livestream chat crawling worker");
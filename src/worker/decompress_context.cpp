@@ -0,0 +1,306 @@
+#include "decompress_context.h"
+
+#include <boost/thread/tss.hpp>
+#include <spdlog/spdlog.h>
+
+#if defined(VNERVE_INFLATE_LIBDEFLATE)
+#include <libdeflate.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace vNerve::bilibili
+{
+const size_t decompress_min_buffer_size = 4 * 1024;
+const size_t decompress_max_buffer_size = 16 * 1024 * 1024;
+const size_t decompress_chunk_size = 64 * 1024;
+// 由 set_decompress_buffer_size 在开始解压前设置，之后只读。
+size_t decompress_initial_buffer_size = 256 * 1024;
+
+void set_decompress_buffer_size(const size_t size)
+{
+    decompress_initial_buffer_size = std::clamp(size, decompress_min_buffer_size, decompress_max_buffer_size);
+}
+
+// brotli 解码器每次创建时申请的内存块大小基本固定，缓存少量即可命中。
+const size_t brotli_max_cached_blocks = 32;
+const size_t brotli_block_header_size = 16;  // 保持 malloc 的对齐。
+
+decompress_output::decompress_output(const size_t initial_capacity, const size_t max_capacity)
+    : _buffer(new unsigned char[initial_capacity + json_padding]),
+      _capacity(initial_capacity),
+      _max_capacity(max_capacity)
+{
+}
+
+size_t decompress_output::on_flushed(const size_t consumed, const size_t skipping_bytes)
+{
+    _skipping_bytes = skipping_bytes;
+    _filled -= consumed;
+    if (_filled && consumed)
+        std::memmove(_buffer.get(), _buffer.get() + consumed, _filled);  // only the incomplete tail.
+    if (_filled == _capacity)
+        grow();  // a single packet is larger than the window.
+    return consumed;
+}
+
+bool decompress_output::grow()
+{
+    if (_capacity >= _max_capacity)
+        return false;
+    auto new_capacity = std::min(_capacity * 2, _max_capacity);
+    SPDLOG_DEBUG("[decomp] Growing decompress buffer {} -> {}", _capacity, new_capacity);
+    auto new_buffer = std::unique_ptr<unsigned char[]>(new unsigned char[new_capacity + json_padding]);
+    std::memcpy(new_buffer.get(), _buffer.get(), _filled);
+    _buffer = std::move(new_buffer);
+    _capacity = new_capacity;
+    return true;
+}
+
+size_t decompress_output::reset()
+{
+    auto dropped = _filled;
+    _filled = 0;
+    _skipping_bytes = 0;
+    return dropped;
+}
+
+// =============================== decompress_context ===============================
+
+bool decompress_context::enter()
+{
+    if (_busy)
+        return false;  // nested compressed packet.
+    _busy = true;
+    return true;
+}
+
+void decompress_context::leave(const bool succeeded)
+{
+    end();
+    auto dropped = _output.reset();
+    if (succeeded && dropped)
+        spdlog::warn("[decomp] Decompressed data ends with an incomplete packet. Dropping {} bytes.", dropped);
+    _busy = false;
+}
+
+// =============================== inflate_context ===============================
+
+#if defined(VNERVE_INFLATE_LIBDEFLATE)
+inflate_context::inflate_context()
+    : decompress_context(decompress_initial_buffer_size, decompress_max_buffer_size),
+      _decompressor(libdeflate_alloc_decompressor())
+{
+}
+
+inflate_context::~inflate_context()
+{
+    libdeflate_free_decompressor(_decompressor);
+}
+
+void inflate_context::begin(const unsigned char* buf, const size_t size)
+{
+    _input = buf;
+    _input_size = size;
+    _error = Z_OK;
+}
+
+decompress_status inflate_context::step()
+{
+    // libdeflate only supports whole-buffer decompression, so grow the window until the packet fits.
+    libdeflate_result result;
+    size_t out_size = 0;
+    while ((result = libdeflate_zlib_decompress(_decompressor, _input, _input_size,
+                                                _output.write_ptr(), _output.write_available(), &out_size))
+               == LIBDEFLATE_INSUFFICIENT_SPACE
+           && _output.grow())
+        ;
+    if (result != LIBDEFLATE_SUCCESS)
+    {
+        _error = result == LIBDEFLATE_INSUFFICIENT_SPACE ? Z_BUF_ERROR : Z_DATA_ERROR;
+        return decompress_status::failed;
+    }
+    _output.commit(out_size);
+    return decompress_status::done;
+}
+#else
+inflate_context::inflate_context()
+    : decompress_context(decompress_initial_buffer_size, decompress_max_buffer_size)
+{
+    auto result = inflateInit(&_stream);
+    if (result != Z_OK)
+        spdlog::critical("[decomp] Failed initializing zlib stream! err={}", result);
+}
+
+inflate_context::~inflate_context()
+{
+    inflateEnd(&_stream);
+}
+
+void inflate_context::begin(const unsigned char* buf, const size_t size)
+{
+    inflateReset(&_stream);
+    _stream.next_in = const_cast<unsigned char*>(buf);
+    _stream.avail_in = static_cast<uInt>(size);
+    _error = Z_OK;
+}
+
+decompress_status inflate_context::step()
+{
+    // Z_BUF_ERROR if the window is full of one incomplete packet and can't grow any more.
+    auto available = std::min(_output.write_available(), decompress_chunk_size);
+    _stream.next_out = _output.write_ptr();
+    _stream.avail_out = static_cast<uInt>(available);
+    _error = inflate(&_stream, Z_NO_FLUSH);
+    _output.commit(available - _stream.avail_out);
+    switch (_error)
+    {
+    case Z_OK:
+        return decompress_status::more;
+    case Z_STREAM_END:
+        return decompress_status::done;
+    default:
+        return decompress_status::failed;
+    }
+}
+#endif
+
+const char* inflate_context::error_message() const
+{
+    switch (_error)
+    {
+    case Z_BUF_ERROR:
+        return "Packet too big or truncated.";
+    case Z_DATA_ERROR:
+        return "Malformed data.";
+    default:
+        return zError(_error);
+    }
+}
+
+// =============================== brotli_context ===============================
+
+brotli_context::brotli_context()
+    : decompress_context(decompress_initial_buffer_size, decompress_max_buffer_size)
+{
+}
+
+brotli_context::~brotli_context()
+{
+    end();
+    for (auto [_, block] : _free_blocks)
+        std::free(block);
+}
+
+void* brotli_context::allocate(void* opaque, const size_t size)
+{
+    auto self = static_cast<brotli_context*>(opaque);
+    auto& blocks = self->_free_blocks;
+    auto iter = std::find_if(blocks.begin(), blocks.end(), [size](auto& block) { return block.first == size; });
+    unsigned char* block;
+    if (iter != blocks.end())
+    {
+        block = static_cast<unsigned char*>(iter->second);
+        *iter = blocks.back();
+        blocks.pop_back();
+    }
+    else
+    {
+        block = static_cast<unsigned char*>(std::malloc(size + brotli_block_header_size));
+        if (!block)
+            return nullptr;
+        *reinterpret_cast<size_t*>(block) = size;
+    }
+    return block + brotli_block_header_size;
+}
+
+void brotli_context::deallocate(void* opaque, void* address)
+{
+    if (!address)
+        return;
+    auto self = static_cast<brotli_context*>(opaque);
+    auto block = static_cast<unsigned char*>(address) - brotli_block_header_size;
+    if (self->_free_blocks.size() < brotli_max_cached_blocks)
+        self->_free_blocks.emplace_back(*reinterpret_cast<size_t*>(block), block);
+    else
+        std::free(block);
+}
+
+void brotli_context::begin(const unsigned char* buf, const size_t size)
+{
+    _state = BrotliDecoderCreateInstance(allocate, deallocate, this);
+    _next_in = buf;
+    _avail_in = size;
+    _error = BROTLI_DECODER_NO_ERROR;
+    _too_big = false;
+    _truncated = false;
+}
+
+decompress_status brotli_context::step()
+{
+    if (!_state)
+    {
+        _error = BROTLI_DECODER_ERROR_ALLOC_CONTEXT_MODES;
+        return decompress_status::failed;
+    }
+    auto available = std::min(_output.write_available(), decompress_chunk_size);
+    if (available == 0)
+    {
+        // the window is full of one incomplete packet and can't grow any more.
+        _too_big = true;
+        return decompress_status::failed;
+    }
+    auto next_out = reinterpret_cast<uint8_t*>(_output.write_ptr());
+    auto avail_out = available;
+    auto result = BrotliDecoderDecompressStream(_state, &_avail_in, &_next_in, &avail_out, &next_out, nullptr);
+    _output.commit(available - avail_out);
+    switch (result)
+    {
+    case BROTLI_DECODER_RESULT_SUCCESS:
+        return decompress_status::done;
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+        return decompress_status::more;
+    case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+        _truncated = true;
+        return decompress_status::failed;
+    default:
+        _error = BrotliDecoderGetErrorCode(_state);
+        return decompress_status::failed;
+    }
+}
+
+void brotli_context::end()
+{
+    if (_state)
+        BrotliDecoderDestroyInstance(_state);  // blocks go back to _free_blocks.
+    _state = nullptr;
+}
+
+const char* brotli_context::error_message() const
+{
+    if (_too_big)
+        return "Packet too big.";
+    if (_truncated)
+        return "Truncated data.";
+    return BrotliDecoderErrorString(_error);
+}
+
+boost::thread_specific_ptr<inflate_context> _inflate_context;
+boost::thread_specific_ptr<brotli_context> _brotli_context;
+
+inflate_context* get_inflate_context()
+{
+    if (!_inflate_context.get())
+        _inflate_context.reset(new inflate_context);
+    return _inflate_context.get();
+}
+
+brotli_context* get_brotli_context()
+{
+    if (!_brotli_context.get())
+        _brotli_context.reset(new brotli_context);
+    return _brotli_context.get();
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "bili_json.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <brotli/decode.h>
+#include <zlib.h>
+
+#if defined(VNERVE_INFLATE_LIBDEFLATE)
+struct libdeflate_decompressor;
+#endif
+
+namespace vNerve::bilibili
+{
+// 定义见 bili_packet.h。
+template <typename Handler>
+std::pair<size_t, size_t> handle_buffer(unsigned char* buf, size_t transferred, size_t padding,
+                                        size_t buffer_size, size_t skipping_size,
+                                        int room_id, Handler&& data_handler);
+
+///
+/// 解压输出窗口。
+/// 解压得到的数据分块写入本窗口，每写入一块就交给 handle_buffer 处理；
+/// 不完整的数据包保留在窗口开头，窗口不足以容纳单个数据包时自动扩容。
+/// 窗口之后另有 json_padding 个字节，json 可以原地解析。
+class decompress_output
+{
+private:
+    std::unique_ptr<unsigned char[]> _buffer;
+    size_t _capacity;
+    size_t _max_capacity;
+    size_t _filled = 0;
+    size_t _skipping_bytes = 0;
+
+    size_t on_flushed(size_t consumed, size_t skipping_bytes);
+
+public:
+    decompress_output(size_t initial_capacity, size_t max_capacity);
+
+    [[nodiscard]] unsigned char* write_ptr() const { return _buffer.get() + _filled; }
+    [[nodiscard]] size_t write_available() const { return _capacity - _filled; }
+    [[nodiscard]] size_t capacity() const { return _capacity; }
+    [[nodiscard]] size_t max_capacity() const { return _max_capacity; }
+    void commit(size_t size) { _filled += size; }
+
+    ///
+    /// 把已写入的数据交给 handle_buffer，保留不完整的数据包。
+    /// @return 本次交出的字节数。
+    template <typename Handler>
+    size_t flush(const int room_id, Handler&& data_handler)
+    {
+        if (_filled == 0)
+            return 0;
+        auto [consumed, skipping_bytes] = handle_buffer(_buffer.get(), _filled, _capacity + json_padding - _filled,
+                                                        _max_capacity, _skipping_bytes, room_id, data_handler);
+        return on_flushed(consumed, skipping_bytes);
+    }
+    ///
+    /// 将容量扩大一倍（不超过最大容量），保留已写入的数据。
+    /// @return 是否扩容成功。
+    bool grow();
+    ///
+    /// 丢弃窗口中残留的数据，准备解压下一个数据包。
+    /// @return 被丢弃的字节数。
+    size_t reset();
+};
+
+enum class decompress_status
+{
+    more,
+    done,
+    failed
+};
+
+///
+/// 每线程一个的解压上下文的公共部分。
+/// 子类每次 step() 向输出窗口解压一块数据，本类负责把每一块交给 handle_buffer。
+class decompress_context
+{
+private:
+    bool _busy = false;
+
+    bool enter();
+    void leave(bool succeeded);
+
+protected:
+    decompress_output _output;
+
+    decompress_context(size_t initial_capacity, size_t max_capacity)
+        : _output(initial_capacity, max_capacity) {}
+
+    virtual void begin(const unsigned char* buf, size_t size) = 0;
+    ///
+    /// 向输出窗口解压下一块数据。窗口已满且无法扩容时应返回 failed。
+    virtual decompress_status step() = 0;
+    virtual void end() {}
+
+public:
+    virtual ~decompress_context() = default;
+
+    decompress_context(const decompress_context& other) = delete;
+    decompress_context& operator=(const decompress_context& other) = delete;
+
+    ///
+    /// 解压一个数据包，并将解压得到的数据包逐块交给 handle_buffer。
+    /// @return 是否成功。失败原因见 error_message()。
+    template <typename Handler>
+    bool decompress(const unsigned char* buf, const size_t size, const int room_id, Handler&& data_handler)
+    {
+        if (!enter())
+            return false;
+        auto status = decompress_status::failed;
+        try
+        {
+            begin(buf, size);
+            while ((status = step()) == decompress_status::more)
+                _output.flush(room_id, data_handler);
+            if (status == decompress_status::done)
+                _output.flush(room_id, data_handler);
+        }
+        catch (...)
+        {
+            leave(false);
+            throw;
+        }
+        leave(status == decompress_status::done);
+        return status == decompress_status::done;
+    }
+    [[nodiscard]] virtual const char* error_message() const = 0;
+};
+
+///
+/// zlib 解压上下文。
+/// 复用同一个解压流（或 libdeflate 解压器），避免每个数据包都重新初始化。
+class inflate_context : public decompress_context
+{
+private:
+#if defined(VNERVE_INFLATE_LIBDEFLATE)
+    libdeflate_decompressor* _decompressor;
+    const unsigned char* _input = nullptr;
+    size_t _input_size = 0;
+#else
+    z_stream _stream{};
+#endif
+    int _error = Z_OK;
+
+protected:
+    void begin(const unsigned char* buf, size_t size) override;
+    decompress_status step() override;
+
+public:
+    inflate_context();
+    ~inflate_context() override;
+
+    [[nodiscard]] const char* error_message() const override;
+};
+
+///
+/// brotli 解压上下文。
+/// brotli 没有重置解码器的接口，因此每个数据包都会重新创建解码器，
+/// 但解码器使用的内存块由本上下文缓存复用，创建与销毁不会触及全局堆。
+class brotli_context : public decompress_context
+{
+private:
+    std::vector<std::pair<size_t, void*>> _free_blocks;
+    BrotliDecoderState* _state = nullptr;
+    const uint8_t* _next_in = nullptr;
+    size_t _avail_in = 0;
+    BrotliDecoderErrorCode _error = BROTLI_DECODER_NO_ERROR;
+    bool _too_big = false;
+    bool _truncated = false;
+
+    static void* allocate(void* opaque, size_t size);
+    static void deallocate(void* opaque, void* address);
+
+protected:
+    void begin(const unsigned char* buf, size_t size) override;
+    decompress_status step() override;
+    void end() override;
+
+public:
+    brotli_context();
+    ~brotli_context() override;
+
+    [[nodiscard]] const char* error_message() const override;
+};
+
+///
+/// 设置每个线程解压窗口的初始大小。窗口放不下单个数据包时仍会扩容，最大 16 MiB。必须在开始解压前调用。
+void set_decompress_buffer_size(size_t size);
+inflate_context* get_inflate_context();
+brotli_context* get_brotli_context();
+}  // namespace vNerve::bilibili
@@ -0,0 +1,212 @@
+#include "endpoint_pool.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+namespace vNerve::bilibili
+{
+// Happy Eyeballs 建议的连接尝试间隔。
+const auto race_attempt_delay = std::chrono::milliseconds(250);
+const size_t race_max_attempts = 2;
+// 滑动平均的权重，越大越看重最近的结果。
+const double endpoint_score_alpha = 0.2;
+// 失败率为 1 时相当于多出的连接耗时。
+const double endpoint_failure_penalty_ms = 1000;
+
+using boost::asio::ip::tcp;
+
+double endpoint_pool::endpoint_state::score() const
+{
+    return rtt_ms + failure_rate * endpoint_failure_penalty_ms;
+}
+
+struct endpoint_pool::race
+{
+    connect_handler handler;
+    std::vector<tcp::endpoint> candidates;
+    std::vector<std::shared_ptr<tcp::socket>> sockets;
+    std::vector<std::chrono::steady_clock::time_point> started_at;
+    boost::asio::steady_timer timer;
+    size_t failed = 0;
+    bool done = false;
+
+    race(boost::asio::io_context& context, connect_handler handler)
+        : handler(std::move(handler)), timer(context) {}
+};
+
+endpoint_pool::endpoint_pool(boost::asio::io_context& context, std::vector<std::string> hosts, std::string port, const std::chrono::seconds ttl)
+    : _context(context),
+      _resolver(context),
+      _hosts(std::move(hosts)),
+      _port(std::move(port)),
+      _ttl(ttl)
+{
+}
+
+void endpoint_pool::async_connect(connect_handler handler)
+{
+    auto expired = std::chrono::steady_clock::now() - _resolved_at > _ttl;
+    if (_endpoints.empty())
+    {
+        // nothing to connect to until resolved.
+        _waiting.push_back(std::move(handler));
+        if (!_resolving)
+            resolve();
+        return;
+    }
+    if (expired && !_resolving)
+        resolve();  // keep using the old endpoints meanwhile.
+    start_race(std::move(handler));
+}
+
+void endpoint_pool::resolve()
+{
+    SPDLOG_DEBUG("[endpoint] Resolving {} chat server hosts.", _hosts.size());
+    for (auto& endpoint : _endpoints)
+        endpoint.stale = true;
+    _resolve_error = boost::system::error_code();
+    _resolving = _hosts.size();
+    for (auto& host : _hosts)
+        _resolver.async_resolve(
+            host, _port,
+            [this](const boost::system::error_code& err, const tcp::resolver::results_type& results) {
+                on_resolved(err, results);
+            });
+}
+
+void endpoint_pool::on_resolved(const boost::system::error_code& err, const tcp::resolver::results_type& results)
+{
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+            return;
+        spdlog::warn("[endpoint] Failed resolving chat server! err: {}:{}", err.value(), err.message());
+        _resolve_error = err;
+    }
+    else
+    {
+        for (auto& entry : results)
+        {
+            auto iter = std::find_if(_endpoints.begin(), _endpoints.end(),
+                                     [&](auto& state) { return state.endpoint == entry.endpoint(); });
+            if (iter != _endpoints.end())
+                iter->stale = false;  // keep its statistics.
+            else
+                _endpoints.push_back(endpoint_state{entry.endpoint()});
+        }
+    }
+    if (--_resolving)
+        return;
+
+    // 全部解析失败时沿用旧的地址。
+    if (std::any_of(_endpoints.begin(), _endpoints.end(), [](auto& state) { return !state.stale; }))
+        _endpoints.erase(std::remove_if(_endpoints.begin(), _endpoints.end(), [](auto& state) { return state.stale; }),
+                         _endpoints.end());
+    for (auto& endpoint : _endpoints)
+        endpoint.stale = false;
+    _resolved_at = std::chrono::steady_clock::now();
+    spdlog::debug("[endpoint] Chat server resolved, {} endpoints.", _endpoints.size());
+
+    auto waiting = std::move(_waiting);
+    _waiting.clear();
+    for (auto& handler : waiting)
+    {
+        if (_endpoints.empty())
+            handler(_resolve_error ? _resolve_error : boost::asio::error::host_not_found, nullptr);
+        else
+            start_race(std::move(handler));
+    }
+}
+
+void endpoint_pool::start_race(connect_handler handler)
+{
+    std::vector<size_t> order(_endpoints.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto count = std::min(order.size(), race_max_attempts);
+    std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                      [this](size_t a, size_t b) { return _endpoints[a].score() < _endpoints[b].score(); });
+
+    auto new_race = std::make_shared<race>(_context, std::move(handler));
+    for (size_t i = 0; i < count; i++)
+        new_race->candidates.push_back(_endpoints[order[i]].endpoint);
+    start_attempt(new_race, 0);
+}
+
+void endpoint_pool::start_attempt(const std::shared_ptr<race>& race, const size_t index)
+{
+    auto socket = std::make_shared<tcp::socket>(_context);
+    race->sockets.push_back(socket);
+    race->started_at.push_back(std::chrono::steady_clock::now());
+    socket->async_connect(
+        race->candidates[index],
+        [this, race, index](const boost::system::error_code& err) { on_attempt_finished(race, index, err); });
+
+    auto next = index + 1;
+    if (next >= race->candidates.size())
+        return;
+    // 本次尝试在一段时间内没有结果时，向下一个地址发起竞速连接。
+    race->timer.expires_after(race_attempt_delay);
+    race->timer.async_wait([this, race, next](const boost::system::error_code& err) {
+        if (!err && !race->done && race->sockets.size() == next)
+            start_attempt(race, next);
+    });
+}
+
+void endpoint_pool::on_attempt_finished(const std::shared_ptr<race>& race, const size_t index, const boost::system::error_code& err)
+{
+    auto& endpoint = race->candidates[index];
+    auto rtt = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - race->started_at[index]).count();
+    if (err.value() != boost::asio::error::operation_aborted)
+        record(endpoint, !err, rtt);
+
+    if (race->done)
+    {
+        // lost the race.
+        boost::system::error_code ec;
+        race->sockets[index]->close(ec);
+        return;
+    }
+
+    if (err)
+    {
+        SPDLOG_DEBUG("[endpoint] Failed connecting to {}:{}! err: {}:{}",
+                     endpoint.address().to_string(), endpoint.port(), err.value(), err.message());
+        race->failed++;
+        if (race->sockets.size() < race->candidates.size())
+        {
+            race->timer.cancel();
+            start_attempt(race, race->sockets.size());  // don't wait for the delay.
+        }
+        else if (race->failed == race->candidates.size())
+        {
+            race->done = true;
+            race->handler(err, nullptr);
+        }
+        return;
+    }
+
+    race->done = true;
+    race->timer.cancel();
+    for (size_t i = 0; i < race->sockets.size(); i++)
+    {
+        boost::system::error_code ec;
+        if (i != index)
+            race->sockets[i]->close(ec);
+    }
+    race->handler(err, race->sockets[index]);
+}
+
+void endpoint_pool::record(const tcp::endpoint& endpoint, const bool succeeded, const double rtt_ms)
+{
+    auto iter = std::find_if(_endpoints.begin(), _endpoints.end(),
+                             [&](auto& state) { return state.endpoint == endpoint; });
+    if (iter == _endpoints.end())
+        return;  // removed by re-resolving.
+    iter->failure_rate = (1 - endpoint_score_alpha) * iter->failure_rate + endpoint_score_alpha * (succeeded ? 0 : 1);
+    if (succeeded)
+        iter->rtt_ms = iter->rtt_ms == 0 ? rtt_ms : (1 - endpoint_score_alpha) * iter->rtt_ms + endpoint_score_alpha * rtt_ms;
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+namespace vNerve::bilibili
+{
+///
+/// 弹幕服务器的地址池。
+/// 解析结果按 TTL 缓存，大量房间同时分配时只解析一次。每个地址记录连接耗时与失败率的滑动平均，
+/// 新连接优先选择得分最好的地址，并按 Happy Eyeballs 的方式在稍后向次优的地址发起竞速连接，先连上的胜出。
+/// 不加锁，只能在所属 io_context 的线程上使用。
+class endpoint_pool
+{
+public:
+    using connect_handler = std::function<void(const boost::system::error_code&, std::shared_ptr<boost::asio::ip::tcp::socket>)>;
+
+private:
+    struct endpoint_state
+    {
+        boost::asio::ip::tcp::endpoint endpoint;
+        double rtt_ms = 0;  // 0 for never connected, so that new endpoints get tried first.
+        double failure_rate = 0;
+        bool stale = false;
+
+        [[nodiscard]] double score() const;
+    };
+    struct race;
+
+    boost::asio::io_context& _context;
+    boost::asio::ip::tcp::resolver _resolver;
+    std::vector<std::string> _hosts;
+    std::string _port;
+    std::chrono::seconds _ttl;
+
+    std::vector<endpoint_state> _endpoints;
+    std::chrono::steady_clock::time_point _resolved_at;
+    size_t _resolving = 0;
+    boost::system::error_code _resolve_error;
+    std::vector<connect_handler> _waiting;
+
+    void resolve();
+    void on_resolved(const boost::system::error_code& err, const boost::asio::ip::tcp::resolver::results_type& results);
+    void start_race(connect_handler handler);
+    void start_attempt(const std::shared_ptr<race>& race, size_t index);
+    void on_attempt_finished(const std::shared_ptr<race>& race, size_t index, const boost::system::error_code& err);
+    void record(const boost::asio::ip::tcp::endpoint& endpoint, bool succeeded, double rtt_ms);
+
+public:
+    endpoint_pool(boost::asio::io_context& context, std::vector<std::string> hosts, std::string port, std::chrono::seconds ttl);
+
+    endpoint_pool(const endpoint_pool& other) = delete;
+    endpoint_pool& operator=(const endpoint_pool& other) = delete;
+
+    ///
+    /// 连接到当前最快的健康地址。解析结果过期时先重新解析。
+    void async_connect(connect_handler handler);
+};
+}  // namespace vNerve::bilibili
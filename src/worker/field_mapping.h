@@ -0,0 +1,146 @@
+#pragma once
+
+#include "json_path_handler.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdint>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+// 值的类型。check 检查 json 中的值，get 转换为记录中字段的类型。
+// 需要换算的值（枚举等）照此另行定义。
+
+struct uint32_value
+{
+    static bool check(const json_scalar& value) { return value.is_uint(); }
+    static uint32_t get(const json_scalar& value) { return static_cast<uint32_t>(value.uint64); }
+};
+
+struct uint64_value
+{
+    static bool check(const json_scalar& value) { return value.is_uint64(); }
+    static uint64_t get(const json_scalar& value) { return value.uint64; }
+};
+
+///
+/// 布尔值。bilibili 的标志位大多以 0/1 发送，也一并接受。
+struct bool_value
+{
+    static bool check(const json_scalar& value) { return value.is_bool() || (value.is_uint64() && value.uint64 <= 1); }
+    static bool get(const json_scalar& value) { return value.is_bool() ? value.boolean : value.uint64 != 0; }
+};
+
+struct string_value
+{
+    static bool check(const json_scalar& value) { return value.is_string(); }
+    static std::string_view get(const json_scalar& value) { return value.string; }
+};
+
+///
+/// 由 FIELD_MAPPING 生成的映射表驱动的 SAX 处理函数。
+/// 取得全部字段后提前结束解析；result() 在缺少必需字段时返回 nullptr。
+template <typename Mapping>
+class mapped_extractor : public json_path_handler<mapped_extractor<Mapping>>
+{
+private:
+    static const uint32_t all_fields = ~0u >> (32 - Mapping::field_count);
+
+    typename Mapping::record _record;
+    uint32_t _fields = 0;
+
+public:
+    bool on_value(const json_scalar& value)
+    {
+        if (this->depth() < 2 || !this->at(0, Mapping::root))
+            return true;
+        if (!Mapping::map(*this, value, _record, _fields))
+            return false;
+        if (_fields == all_fields)
+            this->finish();  // 不再关心之后的数据。
+        return true;
+    }
+
+    ///
+    /// 不经过 SAX 事件，按映射表中的路径直接取值。source 提供 find(路径) 与 failed()，见 json_path_lookup。
+    /// @return 数据是否合法。
+    template <typename Source>
+    bool lookup(Source& source)
+    {
+        return Mapping::lookup(source, _record, _fields);
+    }
+
+    [[nodiscard]] typename Mapping::record* result()
+    {
+        if ((_fields & Mapping::required_fields) != Mapping::required_fields)
+        {
+            SPDLOG_TRACE("[bili_json] {} missing fields: {:x}", Mapping::command,
+                         Mapping::required_fields & ~_fields);
+            return nullptr;
+        }
+        return &_record;
+    }
+};
+
+// 映射表的每一项：FIELD(名字, json 路径, 值的类型, 记录中的字段, 是否必需)
+// json 路径为 at_path 的参数表，从根对象的键开始，例如 ("info", 2, 0)。
+#define FIELD_MAPPING_INDEX(name, path, type, target, required) name,
+#define FIELD_MAPPING_REQUIRED(name, path, type, target, required) | ((required) ? 1u << name : 0u)
+#define FIELD_MAPPING_MATCH(name, path, type, target, required)                              \
+    if (handler.at_path path)                                                                \
+    {                                                                                        \
+        if (!type::check(value))                                                             \
+        {                                                                                    \
+            SPDLOG_TRACE("[bili_json] bilibili json type check failed: {}." #name, command); \
+            return false;                                                                    \
+        }                                                                                    \
+        out.target = type::get(value);                                                       \
+        fields |= 1u << name;                                                                \
+        return true;                                                                         \
+    }
+#define FIELD_MAPPING_LOOKUP(name, path, type, target, required)                             \
+    if (auto value = source.find path)                                                       \
+    {                                                                                        \
+        if (!type::check(*value))                                                            \
+        {                                                                                    \
+            SPDLOG_TRACE("[bili_json] bilibili json type check failed: {}." #name, command); \
+            return false;                                                                    \
+        }                                                                                    \
+        out.target = type::get(*value);                                                      \
+        fields |= 1u << name;                                                                \
+    }                                                                                        \
+    else if (source.failed())                                                                \
+        return false;
+
+///
+/// 由 cmd##_FIELDS 映射表生成 cmd##_mapping，交给 mapped_extractor 使用。
+/// map 用于 SAX：每个值依次与表中的路径比较，比较代码在编译时展开，不查表。
+/// lookup 用于可以按路径取值的解析器：按表中的顺序逐个取出字段，表按文档顺序书写时最快。
+/// @param root_key 所有路径共同的第一个键，不在其中的值直接跳过。
+#define FIELD_MAPPING(cmd, root_key, record_type)                                                        \
+    struct cmd##_mapping                                                                                 \
+    {                                                                                                    \
+        using record = record_type;                                                                      \
+        static constexpr const char* command = #cmd;                                                     \
+        static constexpr std::string_view root = root_key;                                               \
+        enum field_index : uint32_t                                                                      \
+        {                                                                                                \
+            cmd##_FIELDS(FIELD_MAPPING_INDEX) field_count                                                \
+        };                                                                                               \
+        static_assert(field_count > 0 && field_count <= 32, #cmd "_FIELDS must have 1 to 32 fields.");      \
+        static constexpr uint32_t required_fields = 0u cmd##_FIELDS(FIELD_MAPPING_REQUIRED);             \
+                                                                                                         \
+        template <typename Handler>                                                                      \
+        static bool map(const Handler& handler, const json_scalar& value, record& out, uint32_t& fields) \
+        {                                                                                                \
+            cmd##_FIELDS(FIELD_MAPPING_MATCH) return true;                                               \
+        }                                                                                                \
+                                                                                                         \
+        template <typename Source>                                                                       \
+        static bool lookup(Source& source, record& out, uint32_t& fields)                                \
+        {                                                                                                \
+            cmd##_FIELDS(FIELD_MAPPING_LOOKUP) return true;                                              \
+        }                                                                                                \
+    };
+}  // namespace vNerve::bilibili
@@ -0,0 +1,86 @@
+#include "fingerprint.h"
+
+#include <cstdint>
+
+#if defined(VNERVE_FINGERPRINT_CRC32C)
+#define CRCPP_USE_CPP11
+#define CRCPP_INCLUDE_ESOTERIC_CRC_DEFINITIONS  // CRC_32_C
+#include <CRC.h>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#define VNERVE_CRC32C_SSE42
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+#else
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#endif
+
+// 同 utf8_validate.cpp，只在用到 crc32 指令的函数上启用 SSE4.2。
+#if defined(VNERVE_CRC32C_SSE42) && defined(__GNUC__)
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define CRC32C_TARGET_SSE42
+#endif
+
+namespace vNerve::bilibili
+{
+#if defined(VNERVE_FINGERPRINT_CRC32C)
+namespace
+{
+const CRC::Table<uint32_t, 32> crc32c_lookup_table(CRC::CRC_32_C());
+
+#if defined(VNERVE_CRC32C_SSE42)
+CRC32C_TARGET_SSE42 uint32_t crc32c_sse42(const unsigned char* data, const size_t length)
+{
+    uint64_t crc = 0xFFFFFFFFu;
+    size_t i = 0;
+    for (; length - i >= 8; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        crc = _mm_crc32_u64(crc, word);
+    }
+    auto crc32 = static_cast<uint32_t>(crc);
+    for (; i < length; i++)
+        crc32 = _mm_crc32_u8(crc32, data[i]);
+    return crc32 ^ 0xFFFFFFFFu;
+}
+
+bool has_sse42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif
+
+uint32_t crc32c(const char* data, const size_t length)
+{
+#if defined(VNERVE_CRC32C_SSE42)
+    static const bool sse42 = has_sse42();
+    if (sse42)
+        return crc32c_sse42(reinterpret_cast<const unsigned char*>(data), length);
+#endif
+    return CRC::Calculate(data, length, crc32c_lookup_table);
+}
+}  // namespace
+
+checksum_t fingerprint(const char* data, const size_t length, const unsigned int room_id)
+{
+    return static_cast<checksum_t>(room_id) << 32 | crc32c(data, length);
+}
+#else
+checksum_t fingerprint(const char* data, const size_t length, const unsigned int room_id)
+{
+    return XXH3_64bits_withSeed(data, length, room_id);
+}
+#endif
+}  // namespace vNerve::bilibili
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "type.h"
+
+#include <cstddef>
+
+namespace vNerve::bilibili
+{
+///
+/// 计算原始 json 的 64 位指纹，供 Supervisor 去重。
+/// 同一房间的相同消息得到相同的指纹；房间号参与计算，不同房间的消息不会互相误判为重复。
+/// 算法在编译时由 VNERVE_FINGERPRINT 选择：
+/// xxh3（默认）为以房间号为种子的 XXH3-64；
+/// crc32c 为高 32 位房间号、低 32 位 CRC-32C，支持 SSE4.2 的处理器上由 crc32 指令计算。
+checksum_t fingerprint(const char* data, size_t length, unsigned int room_id);
+}  // namespace vNerve::bilibili
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <rapidjson/rapidjson.h>
+
+#include <cstdint>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+enum class json_type
+{
+    null,
+    boolean,
+    int64,
+    uint64,
+    number,
+    string
+};
+
+///
+/// SAX 事件中的一个标量值。
+struct json_scalar
+{
+    json_type type;
+    bool boolean = false;
+    int64_t int64 = 0;
+    uint64_t uint64 = 0;
+    double number = 0;
+    std::string_view string;
+
+    [[nodiscard]] bool is_bool() const { return type == json_type::boolean; }
+    [[nodiscard]] bool is_string() const { return type == json_type::string; }
+    [[nodiscard]] bool is_uint64() const { return type == json_type::uint64; }
+    [[nodiscard]] bool is_uint() const { return type == json_type::uint64 && uint64 <= UINT32_MAX; }
+    [[nodiscard]] bool is_int() const
+    {
+        return (type == json_type::int64 && int64 >= INT32_MIN) || (type == json_type::uint64 && uint64 <= INT32_MAX);
+    }
+    [[nodiscard]] bool is_number() const
+    {
+        return type == json_type::int64 || type == json_type::uint64 || type == json_type::number;
+    }
+    [[nodiscard]] int get_int() const { return type == json_type::int64 ? static_cast<int>(int64) : static_cast<int>(uint64); }
+};
+
+///
+/// 容器中当前位置：数组中的下标，或对象中的键。
+struct json_level
+{
+    bool array;
+    int index;
+    std::string_view key;
+};
+
+///
+/// 记录当前路径的 rapidjson SAX handler，供 rapidjson::Reader 与 Document::Accept 使用。
+/// 子类实现 bool on_value(const json_scalar&)，在其中通过 depth() 与 level() 判断标量所在的位置；
+/// 需要知道对象或数组本身时可以再实现 bool on_start(bool array)，在进入容器之前调用。
+/// 返回 false 表示数据不合法；需要的字段取完后调用 finish() 提前结束解析。
+template <typename Derived>
+class json_path_handler
+{
+public:
+    static const int max_depth = 8;
+
+private:
+    json_level _levels[max_depth];
+    int _depth = 0;
+    bool _finished = false;
+    bool _failed = false;
+
+    bool value(const json_scalar& value)
+    {
+        if (_depth <= max_depth && !static_cast<Derived*>(this)->on_value(value))
+            _failed = true;
+        advance();
+        return !_failed && !_finished;
+    }
+
+    void advance()
+    {
+        if (_depth > 0 && _depth <= max_depth && _levels[_depth - 1].array)
+            _levels[_depth - 1].index++;
+    }
+
+    bool start(const bool array)
+    {
+        if (_depth <= max_depth && !static_cast<Derived*>(this)->on_start(array))
+            _failed = true;
+        if (_failed || _finished)
+            return false;
+        if (_depth < max_depth)
+            _levels[_depth] = json_level{array, 0, {}};
+        _depth++;  // 超过 max_depth 的层级不记录，其中的值也不会交给子类。
+        return true;
+    }
+
+    bool end()
+    {
+        _depth--;
+        advance();
+        return !_finished;
+    }
+
+protected:
+    ///
+    /// 当前所在容器的层数。根对象中的值为 1。
+    [[nodiscard]] int depth() const { return _depth; }
+    ///
+    /// 第 i 层容器中的当前位置，0 为根。
+    [[nodiscard]] const json_level& level(const int i) const { return _levels[i]; }
+    [[nodiscard]] bool at(const int i, const int index) const { return _levels[i].array && _levels[i].index == index; }
+    [[nodiscard]] bool at(const int i, const std::string_view key) const { return !_levels[i].array && _levels[i].key == key; }
+
+    void finish() { _finished = true; }
+
+    bool on_start(bool) { return true; }
+
+public:
+    ///
+    /// 当前的值是否恰好位于 steps 描述的路径上。每一步为对象的键或数组的下标，例如 at_path("info", 2, 0)。
+    template <typename... Steps>
+    [[nodiscard]] bool at_path(const Steps&... steps) const
+    {
+        if (_depth != static_cast<int>(sizeof...(Steps)))
+            return false;
+        int i = 0;
+        return (at(i++, steps) && ...);
+    }
+
+    [[nodiscard]] bool finished() const { return _finished; }
+    [[nodiscard]] bool failed() const { return _failed; }
+
+    bool Null() { return value(json_scalar{json_type::null}); }
+    bool Bool(const bool b)
+    {
+        json_scalar scalar{json_type::boolean};
+        scalar.boolean = b;
+        return value(scalar);
+    }
+    bool Int(const int i) { return Int64(i); }
+    bool Uint(const unsigned u) { return Uint64(u); }
+    bool Int64(const int64_t i)
+    {
+        if (i >= 0)
+            return Uint64(static_cast<uint64_t>(i));
+        json_scalar scalar{json_type::int64};
+        scalar.int64 = i;
+        return value(scalar);
+    }
+    bool Uint64(const uint64_t u)
+    {
+        json_scalar scalar{json_type::uint64};
+        scalar.uint64 = u;
+        return value(scalar);
+    }
+    bool Double(const double d)
+    {
+        json_scalar scalar{json_type::number};
+        scalar.number = d;
+        return value(scalar);
+    }
+    bool RawNumber(const char*, rapidjson::SizeType, bool) { return value(json_scalar{json_type::number}); }
+    bool String(const char* str, const rapidjson::SizeType length, bool)
+    {
+        json_scalar scalar{json_type::string};
+        scalar.string = std::string_view(str, length);
+        return value(scalar);
+    }
+    bool StartObject() { return start(false); }
+    bool Key(const char* str, const rapidjson::SizeType length, bool)
+    {
+        if (_depth > 0 && _depth <= max_depth)
+            _levels[_depth - 1].key = std::string_view(str, length);
+        return true;
+    }
+    bool EndObject(rapidjson::SizeType) { return end(); }
+    bool StartArray() { return start(true); }
+    bool EndArray(rapidjson::SizeType) { return end(); }
+};
+}  // namespace vNerve::bilibili
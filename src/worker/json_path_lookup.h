@@ -0,0 +1,242 @@
+#pragma once
+
+#if defined(VNERVE_JSON_SIMDJSON)
+#include "json_path_handler.h"
+
+#include <simdjson.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+///
+/// 路径中的一步：对象的键，或数组的下标。
+struct json_step
+{
+    bool index_step;
+    int index = 0;
+    std::string_view key;
+
+    json_step(const std::string_view key) : index_step(false), key(key) {}
+    json_step(const int index) : index_step(true), index(index) {}
+
+    bool operator==(const json_step& other) const
+    {
+        return index_step == other.index_step && (index_step ? index == other.index : key == other.key);
+    }
+};
+
+///
+/// 按路径直接从 simdjson on-demand 文档中取出标量，供 FIELD_MAPPING 生成的 lookup 使用。
+/// 路径之外的值只被跳过，不会被解析或重放。
+/// 上一次查找打开的容器保持打开：下一条路径与它共享前缀、且在数组中向后时接着读取，
+/// 映射表按文档顺序书写时整条消息只扫描一遍；否则从根对象重新开始。
+/// 重新开始会覆盖 simdjson 的字符串缓冲区，因此取出的字符串复制到调用者提供的缓冲区中。
+class json_path_lookup
+{
+public:
+    static const int max_depth = 8;
+
+private:
+    struct level
+    {
+        bool array = false;
+        json_step step = json_step(0);  // 在本层容器中所在的位置。
+        simdjson::ondemand::object object;
+        simdjson::ondemand::array array_value;
+        simdjson::ondemand::array_iterator element;
+    };
+
+    simdjson::ondemand::document& _document;
+    char* _strings;
+    size_t _strings_available;
+    level _levels[max_depth];
+    int _open = 0;  // 打开的容器层数，0 表示需要从根对象重新开始。
+    bool _failed = false;
+    json_scalar _value{json_type::null};
+
+    ///
+    /// 找不到、类型不符时返回 false；其他错误（数据不合法）还会设置 _failed。
+    bool check(const simdjson::error_code error)
+    {
+        switch (error)
+        {
+        case simdjson::SUCCESS:
+            return true;
+        case simdjson::NO_SUCH_FIELD:
+        case simdjson::INCORRECT_TYPE:
+        case simdjson::OUT_OF_BOUNDS:
+        case simdjson::INDEX_OUT_OF_BOUNDS:
+            return false;
+        default:
+            SPDLOG_TRACE("[bili_json] bilibili json parse failed: {}", simdjson::error_message(error));
+            _failed = true;
+            return false;
+        }
+    }
+
+    ///
+    /// 把 value 作为第 depth 层容器打开，并移动到 step。
+    bool open(const int depth, simdjson::ondemand::value& value, const json_step& step)
+    {
+        auto& container = _levels[depth];
+        container.array = step.index_step;
+        if (container.array)
+        {
+            if (!check(value.get_array().get(container.array_value))
+                || !check(container.array_value.begin().get(container.element)))
+                return false;
+            container.step = json_step(0);
+        }
+        else if (!check(value.get_object().get(container.object)))
+            return false;
+        _open = depth + 1;
+        return move(depth, step, value);
+    }
+
+    ///
+    /// 在已经打开的第 depth 层容器中移动到 step，取出其中的值。
+    bool move(const int depth, const json_step& step, simdjson::ondemand::value& value)
+    {
+        auto& container = _levels[depth];
+        if (step.index_step != container.array || (container.array && step.index < container.step.index))
+            return false;
+        if (container.array)
+        {
+            for (; container.step.index < step.index; container.step.index++)
+                ++container.element;
+            return container.element != container.array_value.end() && check((*container.element).get(value));
+        }
+        if (!check(container.object.find_field_unordered(step.key).get(value)))
+            return false;
+        container.step = step;
+        return true;
+    }
+
+    bool scalar(simdjson::ondemand::value& value)
+    {
+        simdjson::ondemand::json_type type;
+        if (!check(value.type().get(type)))
+            return false;
+        switch (type)
+        {
+        case simdjson::ondemand::json_type::number:
+        {
+            simdjson::ondemand::number_type number_type;
+            if (!check(value.get_number_type().get(number_type)))
+                return false;
+            if (number_type == simdjson::ondemand::number_type::signed_integer)
+            {
+                int64_t number;
+                if (!check(value.get_int64().get(number)))
+                    return false;
+                // 与 json_path_handler 相同：非负整数一律作为无符号数。
+                _value = json_scalar{number >= 0 ? json_type::uint64 : json_type::int64};
+                _value.int64 = number;
+                _value.uint64 = static_cast<uint64_t>(number);
+            }
+            else if (number_type == simdjson::ondemand::number_type::unsigned_integer)
+            {
+                _value = json_scalar{json_type::uint64};
+                if (!check(value.get_uint64().get(_value.uint64)))
+                    return false;
+            }
+            else
+            {
+                _value = json_scalar{json_type::number};
+                if (!check(value.get_double().get(_value.number)))
+                    return false;
+            }
+            return true;
+        }
+        case simdjson::ondemand::json_type::string:
+        {
+            std::string_view string;
+            if (!check(value.get_string().get(string)))
+                return false;
+            if (string.size() > _strings_available)
+            {
+                _failed = true;  // 每个字符串只取一次，不会超过 json 的长度。
+                return false;
+            }
+            std::memcpy(_strings, string.data(), string.size());
+            _value = json_scalar{json_type::string};
+            _value.string = std::string_view(_strings, string.size());
+            _strings += string.size();
+            _strings_available -= string.size();
+            return true;
+        }
+        case simdjson::ondemand::json_type::boolean:
+            _value = json_scalar{json_type::boolean};
+            return check(value.get_bool().get(_value.boolean));
+        case simdjson::ondemand::json_type::null:
+            _value = json_scalar{json_type::null};
+            return true;
+        default:
+            return false;  // 容器不是标量，与 SAX 中一样视为没有这个值。
+        }
+    }
+
+    bool find_path(const json_step* path, const int length)
+    {
+        // 与上一条路径的公共前缀上的容器仍然打开，从第一个不同的位置接着读取。
+        int depth = 0;
+        while (depth + 1 < _open && depth + 1 < length && _levels[depth].step == path[depth])
+            depth++;
+        if (_open)
+        {
+            auto& container = _levels[depth];
+            if (container.step == path[depth] || (container.array && path[depth].index_step && path[depth].index < container.step.index))
+                _open = 0;  // 这个值已经读过，或者在它之前。
+        }
+
+        simdjson::ondemand::value value;
+        if (!_open)
+        {
+            _document.rewind();
+            depth = 0;
+            _levels[0].array = false;
+            _levels[0].step = json_step(std::string_view());
+            if (!check(_document.get_object().get(_levels[0].object)))
+                return false;
+        }
+        _open = depth + 1;
+        if (!move(depth, path[depth], value))
+            return false;
+        for (depth++; depth < length; depth++)
+            if (!open(depth, value, path[depth]))
+                return false;
+        return scalar(value);
+    }
+
+public:
+    ///
+    /// @param strings 存放取出的字符串，至少与 json 一样长，直到记录被写出之前有效。
+    json_path_lookup(simdjson::ondemand::document& document, char* strings, const size_t strings_size)
+        : _document(document), _strings(strings), _strings_available(strings_size)
+    {
+    }
+
+    ///
+    /// 取出 steps 描述的路径上的标量，例如 find("info", 2, 0)。
+    /// @return 路径上的值；没有这个值、或不是标量时返回 nullptr，数据不合法时还会使 failed() 为真。
+    template <typename... Steps>
+    const json_scalar* find(const Steps&... steps)
+    {
+        static_assert(sizeof...(Steps) > 0 && sizeof...(Steps) <= max_depth, "Bad json path length.");
+        if (_failed)
+            return nullptr;
+        const json_step path[] = {json_step(steps)...};
+        if (find_path(path, static_cast<int>(sizeof...(Steps))))
+            return &_value;
+        _open = 0;  // 失败的查找可能停在任意位置，下次从头开始。
+        return nullptr;
+    }
+
+    [[nodiscard]] bool failed() const { return _failed; }
+};
+}  // namespace vNerve::bilibili
+#endif
@@ -1,15 +1,31 @@
 #include "bilibili_connection_manager.h"
 #include "config.h"
 
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <spdlog/spdlog.h>
 
+#include <csignal>
+
 int main(int argc, char** argv)
 {
     // TODO main.
     spdlog::set_level(spdlog::level::trace);
     auto opt = vNerve::bilibili::config::parse_options(argc, argv);
-    auto session = std::make_shared<vNerve::bilibili::bilibili_connection_manager>(opt, [](int room_id) -> void {  }, [](int room_id, vNerve::bilibili::borrowed_message* msg) -> void {  });
+    auto session = std::make_shared<vNerve::bilibili::bilibili_connection_manager>(opt, [](int room_id) -> void {  }, [](int room_id, const vNerve::bilibili::borrowed_message* msg) -> void {  });
     session->open_connection(21752681);
-    while (true)
-        ;
+
+    // Sleep until asked to exit, then shut down in order.
+    boost::asio::io_context signal_context;
+    boost::asio::signal_set signals(signal_context, SIGINT, SIGTERM);
+    signals.async_wait([](const boost::system::error_code& ec, int signal) -> void
+    {
+        if (!ec)
+            spdlog::info("[main] Received signal {}. Shutting down.", signal);
+    });
+    signal_context.run();
+
+    session.reset();  // stops the shards and joins the IO threads.
+    spdlog::info("[main] Bye.");
+    return 0;
 }
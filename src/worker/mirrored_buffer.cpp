@@ -0,0 +1,132 @@
+#include "mirrored_buffer.h"
+
+#include <cerrno>
+#include <system_error>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace vNerve::bilibili
+{
+#ifdef _WIN32
+const int MIRROR_MAP_RETRY = 16;
+
+mirrored_buffer::mirrored_buffer(const size_t min_size)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const size_t granularity = info.dwAllocationGranularity;
+    _size = (min_size + granularity - 1) / granularity * granularity;
+
+    _mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                  static_cast<DWORD>(static_cast<unsigned long long>(_size) >> 32),
+                                  static_cast<DWORD>(_size & 0xFFFFFFFFu), nullptr);
+    if (!_mapping)
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "CreateFileMapping");
+
+    // 先保留 2 * size 的地址空间再释放，然后把两份视图映射到这段地址上。
+    // 释放与映射之间地址可能被其他线程占用，所以需要重试。
+    for (int i = 0; i < MIRROR_MAP_RETRY; i++)
+    {
+        auto reserved = static_cast<unsigned char*>(VirtualAlloc(nullptr, _size * 2, MEM_RESERVE, PAGE_NOACCESS));
+        if (!reserved)
+            break;
+        VirtualFree(reserved, 0, MEM_RELEASE);
+
+        auto first = MapViewOfFileEx(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size, reserved);
+        if (!first)
+            continue;
+        auto second = MapViewOfFileEx(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, _size, reserved + _size);
+        if (!second)
+        {
+            UnmapViewOfFile(first);
+            continue;
+        }
+        _base = reserved;
+        return;
+    }
+
+    auto err = GetLastError();
+    CloseHandle(_mapping);
+    _mapping = nullptr;
+    throw std::system_error(static_cast<int>(err), std::system_category(), "MapViewOfFileEx");
+}
+
+void mirrored_buffer::release() noexcept
+{
+    if (_base)
+    {
+        UnmapViewOfFile(_base + _size);
+        UnmapViewOfFile(_base);
+        _base = nullptr;
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+        _mapping = nullptr;
+    }
+    _size = 0;
+}
+#else
+mirrored_buffer::mirrored_buffer(const size_t min_size)
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    _size = (min_size + page - 1) / page * page;
+
+#if defined(__linux__)
+    int fd = memfd_create("vnerve-read-buffer", MFD_CLOEXEC);
+#else
+    char name[] = "/tmp/vnerve-read-buffer-XXXXXX";
+    int fd = mkstemp(name);
+    if (fd >= 0)
+        unlink(name);
+#endif
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "memfd_create");
+    if (ftruncate(fd, static_cast<off_t>(_size)) != 0)
+    {
+        auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "ftruncate");
+    }
+
+    // 保留 2 * size 的地址空间，然后用 MAP_FIXED 把同一个文件映射到前后两半。
+    auto reserved = static_cast<unsigned char*>(
+        mmap(nullptr, _size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (reserved == MAP_FAILED)
+    {
+        auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap");
+    }
+    if (mmap(reserved, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(reserved + _size, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        auto err = errno;
+        munmap(reserved, _size * 2);
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap");
+    }
+    ::close(fd);  // 映射会保持文件存活。
+    _base = reserved;
+}
+
+void mirrored_buffer::release() noexcept
+{
+    if (_base)
+        munmap(_base, _size * 2);
+    _base = nullptr;
+    _size = 0;
+}
+#endif
+
+mirrored_buffer::~mirrored_buffer()
+{
+    release();
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vNerve::bilibili
+{
+///
+/// 双重映射的环形缓冲区。
+/// 同一段内存被紧挨着映射两次，因此从任意偏移开始的 size() 个字节总是连续可访问的。
+/// 跨越缓冲区末尾的数据包不需要搬运，可以直接作为一段连续内存交给解析器。
+class mirrored_buffer
+{
+private:
+    unsigned char* _base = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void* _mapping = nullptr;
+#endif
+
+    void release() noexcept;
+
+public:
+    mirrored_buffer() = default;
+    ///
+    /// @param min_size 最小容量。实际容量会向上取整到页大小（Windows 下为分配粒度）。
+    /// @throw std::system_error 映射失败时抛出。
+    explicit mirrored_buffer(size_t min_size);
+    ~mirrored_buffer();
+
+    mirrored_buffer(const mirrored_buffer& other) = delete;
+    mirrored_buffer& operator=(const mirrored_buffer& other) = delete;
+
+    mirrored_buffer(mirrored_buffer&& other) noexcept
+        : _base(other._base),
+          _size(other._size)
+#ifdef _WIN32
+          ,
+          _mapping(other._mapping)
+#endif
+    {
+        other._base = nullptr;
+        other._size = 0;
+#ifdef _WIN32
+        other._mapping = nullptr;
+#endif
+    }
+
+    mirrored_buffer& operator=(mirrored_buffer&& other) noexcept
+    {
+        if (this == &other)
+            return *this;
+        release();
+        _base = other._base;
+        _size = other._size;
+        other._base = nullptr;
+        other._size = 0;
+#ifdef _WIN32
+        _mapping = other._mapping;
+        other._mapping = nullptr;
+#endif
+        return *this;
+    }
+
+    [[nodiscard]] size_t size() const { return _size; }
+    ///
+    /// 环形偏移处的指针。offset 会对 size() 取模，返回的指针之后至少有 size() + 1 个连续字节。
+    [[nodiscard]] unsigned char* at(size_t offset) const { return _base + offset % _size; }
+};
+}  // namespace vNerve::bilibili
@@ -0,0 +1,153 @@
+#include "parse_pool.h"
+
+#include "bili_packet.h"
+#include "bilibili_connection_manager.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+
+#include <boost/bind.hpp>
+#include <spdlog/spdlog.h>
+
+namespace vNerve::bilibili
+{
+// 空闲的解析线程等待自己的运行队列的时长，超时后去其他线程的运行队列中接手房间，并检查是否需要退出。
+const auto parse_steal_interval = std::chrono::milliseconds(1);
+
+parse_pool::parse_pool(bilibili_connection_manager& manager, const int threads)
+    : _manager(manager)
+{
+    spdlog::info("[parse] Creating parse pool with {} threads.", threads);
+    for (int i = 0; i < threads; i++)
+        _queues.emplace_back(std::make_unique<moodycamel::BlockingConcurrentQueue<std::shared_ptr<parse_room>>>());
+    for (size_t i = 0; i < _queues.size(); i++)
+        _threads.create_thread(boost::bind(&parse_pool::run, this, i));
+}
+
+parse_pool::~parse_pool()
+{
+    // 网络线程已经停止，不会再有新的数据包。解析线程处理完所有运行队列后退出。
+    _running = false;
+    _threads.join_all();
+}
+
+std::unique_ptr<parse_producer> parse_pool::create_producer()
+{
+    auto producer = std::make_unique<parse_producer>();
+    producer->tokens.reserve(_queues.size());
+    for (auto& queue : _queues)
+        producer->tokens.emplace_back(*queue);
+    return producer;
+}
+
+void parse_pool::submit(parse_producer& producer, const int room_id, const unsigned char* packet, const size_t length)
+{
+    auto& room = producer.rooms[room_id];
+    if (!room)
+    {
+        room = std::make_shared<parse_room>();
+        // 与分片的散列使用不同的常数（MurmurHash3 的 c1），分片数与解析线程数相同时，一个分片的房间也会分散到各个解析线程。
+        auto hash = static_cast<uint32_t>(room_id) * UINT32_C(0xcc9e2d51);
+        room->home = static_cast<size_t>((static_cast<uint64_t>(hash) * _queues.size()) >> 32);
+    }
+
+    std::unique_ptr<unsigned char[]> copy(new unsigned char[length + json_padding]);
+    std::memcpy(copy.get(), packet, length);
+    size_t home;
+    {
+        std::lock_guard<std::mutex> guard(room->lock);
+        room->pending.push_back(parse_job{room_id, std::move(copy), length});
+        if (room->scheduled)
+            return;  // 房间已在运行队列中或正在被处理，处理它的线程会看到这个数据包。
+        room->scheduled = true;
+        home = room->home;
+    }
+    _queues[home]->enqueue(producer.tokens[home], room);
+}
+
+void parse_pool::run(const size_t index)
+{
+    SPDLOG_DEBUG("[parse] [{}] Parse thread started.", index);
+    std::shared_ptr<parse_room> room;
+    std::vector<parse_job> batch;
+    while (true)
+    {
+        // 先读取退出标志再检查队列：退出前提交的房间一定会被看到。
+        auto stopping = !_running.load();
+        if (try_take(index, room))
+        {
+            process_room(index, room, batch);
+            continue;
+        }
+        if (stopping)
+            break;
+        if (_queues[index]->wait_dequeue_timed(room, parse_steal_interval))
+            process_room(index, room, batch);
+    }
+    SPDLOG_DEBUG("[parse] [{}] Parse thread exited.", index);
+}
+
+bool parse_pool::try_take(const size_t index, std::shared_ptr<parse_room>& room)
+{
+    if (_queues[index]->try_dequeue(room))
+        return true;
+    // 运行队列中的房间没有正在处理的数据包，可以整个交给另一个线程。
+    for (size_t i = 1; i < _queues.size(); i++)
+    {
+        auto victim = (index + i) % _queues.size();
+        if (_queues[victim]->try_dequeue(room))
+        {
+            SPDLOG_TRACE("[parse] [{}] Took over a room from parse thread {}.", index, victim);
+            return true;
+        }
+    }
+    return false;
+}
+
+void parse_pool::process_room(const size_t index, std::shared_ptr<parse_room>& room, std::vector<parse_job>& batch)
+{
+    {
+        std::lock_guard<std::mutex> guard(room->lock);
+        room->home = index;
+        batch.swap(room->pending);
+    }
+    for (auto& job : batch)
+        process(job);
+    batch.clear();
+
+    bool more;
+    {
+        std::lock_guard<std::mutex> guard(room->lock);
+        more = !room->pending.empty();
+        if (!more)
+            room->scheduled = false;
+    }
+    // 处理期间又有数据包到达：放回队尾，让同一线程上的其他房间先处理。
+    if (more)
+        _queues[index]->enqueue(room);
+    room.reset();
+}
+
+void parse_pool::process(parse_job& job)
+{
+    auto room_id = job.room_id;
+    auto packet = std::move(job.packet);
+    try
+    {
+        handle_packet(packet.get(), json_padding, room_id,
+                      [this, room_id](const borrowed_message* message) { _manager.on_room_data(room_id, message); });
+    }
+    catch (malformed_packet&)
+    {
+        // the header has been checked by split_buffer, so only a nested packet can get here.
+        spdlog::warn("[parse] [room={}] Dropping malformed packet.", room_id);
+    }
+    catch (std::exception& ex)
+    {
+        // 不能让异常离开解析线程，否则整个 worker 都会退出。
+        spdlog::error("[parse] [room={}] Failed handling packet! Dropping. err:{}", room_id, ex.what());
+    }
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <blockingconcurrentqueue.h>
+#include <boost/thread.hpp>
+
+namespace vNerve::bilibili
+{
+class bilibili_connection_manager;
+
+///
+/// 等待解析的数据包。packet 的长度为 length + json_padding，json 可以原地解析。
+struct parse_job
+{
+    int room_id;
+    std::unique_ptr<unsigned char[]> packet;
+    size_t length;
+};
+
+///
+/// 一个房间等待解析的数据包。同一时刻至多在一个运行队列中、至多被一个解析线程处理，因此房间内的顺序不变。
+struct parse_room
+{
+    std::mutex lock;
+    std::vector<parse_job> pending;
+    bool scheduled = false;  // 在运行队列中或正在被处理。
+    size_t home;             // 下一次被调度时放入的运行队列：最近处理它的解析线程。
+};
+
+///
+/// 每个网络线程持有一个，包含每个解析线程队列的 ProducerToken，入队时不与其他网络线程竞争；
+/// 以及本网络线程的房间，只在网络线程上访问。
+struct parse_producer
+{
+    std::vector<moodycamel::ProducerToken> tokens;
+    std::unordered_map<int, std::shared_ptr<parse_room>> rooms;
+};
+
+///
+/// 解析线程池。
+/// 网络线程只负责切分数据包，完整的数据包复制一份放进房间的待解析列表；解析线程在自己的线程上解压、解析
+/// （各自持有线程局部的 parse_context 与 protobuf arena）。
+/// 有数据包等待的房间整个放进一个解析线程的运行队列，一次处理它积压的全部数据包：同一房间的数据包按到达顺序处理，
+/// 不同房间仍然并行解析。房间默认留在上次处理它的线程上（最初按房间号散列）；
+/// 线程空闲时从其他线程的运行队列中接手整个房间，此后该房间归它处理。
+class parse_pool
+{
+private:
+    bilibili_connection_manager& _manager;
+    std::vector<std::unique_ptr<moodycamel::BlockingConcurrentQueue<std::shared_ptr<parse_room>>>> _queues;
+    boost::thread_group _threads;
+    std::atomic<bool> _running = true;
+
+    void run(size_t index);
+    bool try_take(size_t index, std::shared_ptr<parse_room>& room);
+    void process_room(size_t index, std::shared_ptr<parse_room>& room, std::vector<parse_job>& batch);
+    void process(parse_job& job);
+
+public:
+    parse_pool(bilibili_connection_manager& manager, int threads);
+    ///
+    /// 等待解析线程处理完已提交的全部数据包。调用前必须停止所有网络线程。
+    ~parse_pool();
+
+    parse_pool(const parse_pool& other) = delete;
+    parse_pool& operator=(const parse_pool& other) = delete;
+
+    std::unique_ptr<parse_producer> create_producer();
+    ///
+    /// 复制数据包并放入该房间的待解析列表。同一房间的数据包必须用同一个 producer 提交。
+    void submit(parse_producer& producer, int room_id, const unsigned char* packet, size_t length);
+};
+}  // namespace vNerve::bilibili
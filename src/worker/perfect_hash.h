@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+///
+/// 编译期生成的字符串完美哈希表。
+/// 编译时搜索一个使所有键互不冲突的种子，查找时只需一次哈希和一次字符串比较，不做任何内存分配。
+/// Entry 需要有 std::string_view 类型的成员 name；默认构造的 Entry 表示空槽，其 name 为空。
+template <typename Entry, size_t Count>
+class perfect_hash_table
+{
+public:
+    static constexpr size_t slot_count()
+    {
+        size_t size = 1;
+        while (size < Count * 2)
+            size <<= 1;
+        return size;
+    }
+    static constexpr size_t npos = slot_count();
+
+private:
+    static constexpr size_t slots_mask = slot_count() - 1;
+
+    Entry _slots[slot_count()] = {};
+    uint32_t _seed = 0;
+
+    static constexpr uint32_t find_seed(const Entry (&entries)[Count])
+    {
+        for (uint32_t seed = 0;; seed++)
+        {
+            bool used[slot_count()] = {};
+            bool collided = false;
+            for (auto& entry : entries)
+            {
+                auto& slot = used[hash(entry.name, seed) & slots_mask];
+                collided |= slot;
+                slot = true;
+            }
+            if (!collided)
+                return seed;
+        }
+    }
+
+public:
+    // FNV-1a
+    static constexpr uint32_t hash(const std::string_view name, const uint32_t seed)
+    {
+        uint32_t result = 2166136261u ^ seed;
+        for (auto ch : name)
+        {
+            result ^= static_cast<unsigned char>(ch);
+            result *= 16777619u;
+        }
+        return result;
+    }
+
+    constexpr explicit perfect_hash_table(const Entry (&entries)[Count])
+        : _seed(find_seed(entries))
+    {
+        for (auto& entry : entries)
+            _slots[hash(entry.name, _seed) & slots_mask] = entry;
+    }
+
+    ///
+    /// @return name 所在的槽位，不存在时返回 npos。
+    [[nodiscard]] constexpr size_t index_of(const std::string_view name) const
+    {
+        auto index = hash(name, _seed) & slots_mask;
+        // empty slots never match a non-empty name.
+        return _slots[index].name == name ? index : npos;
+    }
+    [[nodiscard]] constexpr const Entry& slot(const size_t index) const { return _slots[index]; }
+};
+}  // namespace vNerve::bilibili
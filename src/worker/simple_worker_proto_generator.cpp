@@ -1,8 +1,13 @@
 #include "simple_worker_proto_generator.h"
 
 #include "simple_worker_proto.h"
+#include "borrowed_message.h"
 #include <boost/asio/detail/socket_ops.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
 namespace vNerve::bilibili::worker_supervisor
 {
 
@@ -30,4 +35,50 @@ std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms)
     pair.first[simple_message_header_length] = worker_ready_code;
     return pair;
 }
+
+std::pair<unsigned char*, size_t> generate_data_packet(room_id_t room_id, const borrowed_message& message)
+{
+    using boost::asio::detail::socket_ops::host_to_network_long;
+    auto batch = message.count > 1;
+    auto header_length = batch
+                             ? worker_batch_data_header_length + message.count * checksum_size
+                             : worker_data_header_length;
+    auto payload_length = header_length + message.size();
+    auto packet_length = simple_message_header_length + payload_length;
+    auto packet = new unsigned char[packet_length];
+
+    auto write_uint32 = [](unsigned char* pos, uint32_t value) {
+        value = host_to_network_long(value);
+        std::memcpy(pos, &value, sizeof(value));
+    };
+    auto write_checksum = [](unsigned char* pos, checksum_t checksum) {
+        for (size_t i = 0; i < checksum_size; i++)
+            pos[i] = static_cast<unsigned char>(checksum >> (8 * (checksum_size - 1 - i)));  // big endian
+    };
+
+    auto pos = packet;
+    write_uint32(pos, static_cast<uint32_t>(payload_length));
+    pos += simple_message_header_length;
+    *pos++ = batch ? worker_batch_data_code : worker_data_code;
+    write_uint32(pos, static_cast<uint32_t>(room_id));
+    pos += 4;
+    if (batch)
+    {
+        write_uint32(pos, static_cast<uint32_t>(message.count));
+        pos += 4;
+        for (size_t i = 0; i < message.count; i++, pos += checksum_size)
+            write_checksum(pos, message.batch_checksum[i]);
+    }
+    else
+    {
+        write_checksum(pos, message.checksum);
+        pos += checksum_size;
+    }
+    std::memset(pos, 0, routing_key_max_size);
+    std::memcpy(pos, message.routing_key, std::min(sizeof(message.routing_key), routing_key_max_size));
+    pos += routing_key_max_size;
+    message.write(pos, static_cast<int>(message.size()));
+
+    return std::pair(packet, packet_length);
+}
 }
@@ -2,6 +2,7 @@
 
 #include "type.h"
 
+#include <cstddef>
 #include <utility>
 
 namespace vNerve {
@@ -16,4 +17,7 @@ namespace vNerve::bilibili::worker_supervisor
 /// Use delete[] to remove!
 std::pair<unsigned char*, size_t> generate_room_failed_packet(room_id_t room_id);
 std::pair<unsigned char*, size_t> generate_worker_ready_packet(int max_rooms);
+///
+/// 生成转发消息的数据包。message.count 大于 1 时生成批量数据包（BATCH DATA），一个压缩包中的全部消息一起发送。
+std::pair<unsigned char*, size_t> generate_data_packet(room_id_t room_id, const borrowed_message& message);
 }  // namespace vNerve::bilibili::worker_supervisor
\ No newline at end of file
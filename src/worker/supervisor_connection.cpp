@@ -14,6 +14,8 @@ supervisor_connection::supervisor_connection(const config::config_t config,
       _write_helper("[sv_conn]", nullptr, boost::bind(&supervisor_connection::on_failed, shared_from_this())),
       _timer(_context),
       _retry_interval_sec((*config)["retry-interval-sec"].as<int>()),
+      _shutdown_timer(_context),
+      _shutdown_timeout_sec((*config)["shutdown-timeout-sec"].as<int>()),
       _supervisor_host((*config)["supervisor-host"].as<std::string>()),
       _supervisor_port(std::to_string((*config)["supervisor-port"].as<int>())),
       _connected_handler(connected_handler)
@@ -35,7 +37,40 @@ supervisor_connection::~supervisor_connection()
         spdlog::critical("[sv_conn] Failed shutting down session IO Context! err:{}:{}:{}",
                          ex.code().value(), ex.code().message(), ex.what());
     }
+    if (_thread.joinable())
+        _thread.join();
+}
 
+void supervisor_connection::shutdown()
+{
+    post(_context, [this]() -> void
+    {
+        spdlog::info("[sv_conn] Shutting down. Flushing pending messages to supervisor.");
+        _closing = true;
+        boost::system::error_code nec;
+        _timer.cancel(nec);
+        _resolver.cancel();
+        _shutdown_timer.expires_from_now(boost::posix_time::seconds(_shutdown_timeout_sec));
+        _shutdown_timer.async_wait([this](const boost::system::error_code& ec) -> void
+        {
+            if (ec)
+                return;  // flushed.
+            spdlog::warn("[sv_conn] Timed out flushing messages to supervisor. Dropping.");
+            finish_shutdown();
+        });
+        _write_helper.on_drained(boost::bind(&supervisor_connection::finish_shutdown, this));
+    });
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void supervisor_connection::finish_shutdown()
+{
+    boost::system::error_code nec;
+    _shutdown_timer.cancel(nec);
+    force_close();
+    _guard.reset();
+    _context.stop();
 }
 
 void supervisor_connection::publish_msg(unsigned char* msg, size_t len,
@@ -51,6 +86,8 @@ void supervisor_connection::publish_msg(unsigned char* msg, size_t len,
 
 void supervisor_connection::connect()
 {
+    if (_closing)
+        return;
     if (_socket)
         force_close();
 
@@ -153,6 +190,8 @@ void supervisor_connection::on_connected(const boost::system::error_code& ec, st
 void supervisor_connection::on_failed()
 {
     force_close();
+    if (_closing)
+        return;
     reschedule_retry_timer();
 }
 }
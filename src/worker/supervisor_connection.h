@@ -37,6 +37,9 @@ private:
 
     boost::asio::deadline_timer _timer;
     int _retry_interval_sec;
+    boost::asio::deadline_timer _shutdown_timer;
+    int _shutdown_timeout_sec;
+    bool _closing = false;
 
     std::string _supervisor_host;
     std::string _supervisor_port;
@@ -54,6 +57,7 @@ private:
         );
     void on_connected(const boost::system::error_code& ec, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
     void on_failed();
+    void finish_shutdown();
 
 public:
     supervisor_connection(config::config_t config,
@@ -62,5 +66,9 @@ public:
 
     // Take the ownership of msg.
     void publish_msg(unsigned char* msg, size_t len, supervisor_buffer_deleter deleter);
+    ///
+    /// 停止重连，等待写队列发送完毕（最多 shutdown-timeout-sec 秒）后关闭连接并等待 IO 线程退出。
+    /// 阻塞调用，不能在本连接的 IO 线程上调用。
+    void shutdown();
 };
 }  // namespace vNerve::bilibili::live::worker_supervisor
\ No newline at end of file
@@ -30,6 +30,12 @@ supervisor_session::~supervisor_session()
 {
 }
 
+void supervisor_session::shutdown()
+{
+    _closing = true;
+    _connection.shutdown();
+}
+
 void supervisor_session::on_supervisor_connected()
 {
     auto [packet, packet_length] = generate_worker_ready_packet(_max_rooms);
@@ -53,6 +59,8 @@ void supervisor_session::on_supervisor_message(unsigned char* msg, size_t len)
     {
     case assign_room_code:
     {
+        if (_closing)
+            break;  // shutting down, the supervisor will move the room to other workers.
         _on_open_connection(room_id);
     }
         break;
@@ -69,7 +77,8 @@ void supervisor_session::on_supervisor_message(unsigned char* msg, size_t len)
 
 void supervisor_session::on_message(int room_id, borrowed_message const* msg)
 {
-    // TODO impl
+    auto [packet, packet_length] = generate_data_packet(room_id, *msg);
+    _connection.publish_msg(packet, packet_length, deleter_unsigned_char_array);
 }
 
 void supervisor_session::on_room_failed(int room_id)
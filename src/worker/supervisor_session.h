@@ -3,6 +3,7 @@
 #include "supervisor_connection.h"
 #include "config.h"
 
+#include <atomic>
 #include <memory>
 
 namespace vNerve {
@@ -21,6 +22,7 @@ class supervisor_session : std::enable_shared_from_this<supervisor_session>
     supervisor_connection _connection;
 
     int _max_rooms;
+    std::atomic<bool> _closing = false;
 
     room_operation_handler _on_open_connection;
     room_operation_handler _on_close_connection;
@@ -47,5 +49,9 @@ public:
 
     supervisor_session(config::config_t config, room_operation_handler on_open_connection, room_operation_handler on_close_connection);
     ~supervisor_session();
+
+    ///
+    /// 不再接受新的房间分配，并把已排队的消息发送给 supervisor 后断开。阻塞调用。
+    void shutdown();
 };
 }
@@ -0,0 +1,232 @@
+#ifdef VNERVE_IO_URING
+
+#include "uring_context.h"
+
+#include "bili_json.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <liburing.h>
+#include <spdlog/spdlog.h>
+
+namespace vNerve::bilibili
+{
+// user_data 的低 2 位为操作类型，其余为 token。
+const uint64_t uring_op_receive = 0;
+const uint64_t uring_op_send = 1;
+const uint64_t uring_op_cancel = 2;
+const int uring_op_bits = 2;
+const int uring_buffer_group = 0;
+const unsigned uring_max_buffers = 32768;  // buffer id 为 16 位，缓冲区环最多 32768 项。
+
+uring_context::uring_context(boost::asio::io_context& context, const unsigned entries, const size_t buffer_size,
+                             const unsigned buffer_count)
+    : _context(context),
+      _ring(std::make_unique<io_uring>()),
+      _buffer_size(buffer_size),
+      _buffer_stride(buffer_size + json_padding),  // json is parsed in place.
+      _buffer_count(1),
+      _event(context)
+{
+    while (_buffer_count < std::min(buffer_count, uring_max_buffers))
+        _buffer_count <<= 1;
+
+    auto result = io_uring_queue_init(entries, _ring.get(), 0);
+    if (result < 0)
+        throw std::system_error(-result, std::system_category(), "io_uring_queue_init");
+
+    _buffer_ring = io_uring_setup_buf_ring(_ring.get(), _buffer_count, uring_buffer_group, 0, &result);
+    if (!_buffer_ring)
+    {
+        io_uring_queue_exit(_ring.get());
+        throw std::system_error(-result, std::system_category(), "io_uring_setup_buf_ring");
+    }
+    _buffers.reset(new unsigned char[_buffer_stride * _buffer_count]);
+    for (unsigned i = 0; i < _buffer_count; i++)
+        io_uring_buf_ring_add(_buffer_ring, _buffers.get() + _buffer_stride * i, static_cast<unsigned>(_buffer_size),
+                              static_cast<unsigned short>(i), io_uring_buf_ring_mask(_buffer_count), static_cast<int>(i));
+    io_uring_buf_ring_advance(_buffer_ring, static_cast<int>(_buffer_count));
+
+    auto event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0 || (result = io_uring_register_eventfd(_ring.get(), event)) < 0)
+    {
+        auto err = event < 0 ? errno : -result;
+        if (event >= 0)
+            close(event);
+        io_uring_free_buf_ring(_ring.get(), _buffer_ring, _buffer_count, uring_buffer_group);
+        io_uring_queue_exit(_ring.get());
+        throw std::system_error(err, std::system_category(), "io_uring_register_eventfd");
+    }
+    _event.assign(event);
+    start_wait_completion();
+}
+
+uring_context::~uring_context()
+{
+    boost::system::error_code ec;
+    _event.close(ec);
+    // 关闭 ring 会取消全部进行中的接收与发送。
+    io_uring_free_buf_ring(_ring.get(), _buffer_ring, _buffer_count, uring_buffer_group);
+    io_uring_queue_exit(_ring.get());
+}
+
+io_uring_sqe* uring_context::get_sqe()
+{
+    auto sqe = io_uring_get_sqe(_ring.get());
+    if (!sqe)
+    {
+        // the submission queue is full: submit what we have to make room.
+        submit();
+        sqe = io_uring_get_sqe(_ring.get());
+    }
+    return sqe;
+}
+
+void uring_context::arm_receive(const uint64_t token, const int fd)
+{
+    auto sqe = get_sqe();
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = uring_buffer_group;
+    io_uring_sqe_set_data64(sqe, token << uring_op_bits | uring_op_receive);
+    submit_soon();
+}
+
+void uring_context::submit_soon()
+{
+    if (_submit_posted)
+        return;
+    _submit_posted = true;
+    boost::asio::post(_context, [this]() {
+        _submit_posted = false;
+        submit();
+    });
+}
+
+void uring_context::submit()
+{
+    auto result = io_uring_submit(_ring.get());
+    if (result < 0)
+        spdlog::warn("[uring] Failed submitting to io_uring! err:{}: {}",
+                     -result, std::system_category().message(-result));
+}
+
+uint64_t uring_context::start_receive(const int fd, uring_receiver* const receiver)
+{
+    auto token = _next_token++;
+    _receivers.emplace(token, std::pair(fd, receiver));
+    arm_receive(token, fd);
+    return token;
+}
+
+void uring_context::rebind(const uint64_t token, uring_receiver* const receiver)
+{
+    auto iter = _receivers.find(token);
+    if (iter != _receivers.end())
+        iter->second.second = receiver;
+}
+
+void uring_context::stop_receive(const uint64_t token)
+{
+    if (!_receivers.erase(token))
+        return;
+    auto sqe = get_sqe();
+    io_uring_prep_cancel64(sqe, token << uring_op_bits | uring_op_receive, 0);
+    io_uring_sqe_set_data64(sqe, token << uring_op_bits | uring_op_cancel);
+    // 排队中的发送引用的是 fd 而不是 socket，必须在调用者关闭 fd 之前提交。
+    submit();
+}
+
+void uring_context::send(const uint64_t token, const void* data, const size_t size)
+{
+    auto iter = _receivers.find(token);
+    if (iter == _receivers.end())
+        return;
+    auto sqe = get_sqe();
+    io_uring_prep_send(sqe, iter->second.first, data, size, MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, token << uring_op_bits | uring_op_send);
+    submit_soon();
+}
+
+void uring_context::start_wait_completion()
+{
+    // 读出 eventfd 的计数，之后到达的完成事件会再次使它可读。
+    _event.async_read_some(
+        boost::asio::buffer(&_event_value, sizeof(_event_value)),
+        [this](const boost::system::error_code& err, size_t) { on_completion(err); });
+}
+
+void uring_context::recycle_buffer(const unsigned buffer_id)
+{
+    io_uring_buf_ring_add(_buffer_ring, _buffers.get() + _buffer_stride * buffer_id,
+                          static_cast<unsigned>(_buffer_size), static_cast<unsigned short>(buffer_id),
+                          io_uring_buf_ring_mask(_buffer_count), 0);
+    io_uring_buf_ring_advance(_buffer_ring, 1);
+}
+
+void uring_context::on_completion(const boost::system::error_code& err)
+{
+    if (err)
+    {
+        if (err.value() == boost::asio::error::operation_aborted)
+            return;  // closing.
+        spdlog::warn("[uring] Error in waiting for completions! err:{}: {}", err.value(), err.message());
+    }
+
+    io_uring_cqe* cqe;
+    while (io_uring_peek_cqe(_ring.get(), &cqe) == 0)
+    {
+        auto data = io_uring_cqe_get_data64(cqe);
+        auto result = cqe->res;
+        auto flags = cqe->flags;
+        io_uring_cqe_seen(_ring.get(), cqe);
+
+        auto token = data >> uring_op_bits;
+        auto op = data & ((1u << uring_op_bits) - 1);
+        if (op == uring_op_cancel)
+            continue;
+        auto iter = _receivers.find(token);
+        auto receiver = iter == _receivers.end() ? nullptr : iter->second.second;
+        if (op == uring_op_send)
+        {
+            if (result < 0 && result != -ECANCELED && receiver)
+                receiver->on_uring_error(-result);
+            continue;
+        }
+
+        if (result > 0 && receiver)
+            receiver->on_uring_receive(_buffers.get() + _buffer_stride * (flags >> IORING_CQE_BUFFER_SHIFT),
+                                       static_cast<size_t>(result));
+        if (flags & IORING_CQE_F_BUFFER)
+            recycle_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (flags & IORING_CQE_F_MORE)
+            continue;
+
+        // the multishot receive has ended. The receiver may have been stopped by the callback above.
+        iter = _receivers.find(token);
+        if (iter == _receivers.end())
+            continue;
+        if (result > 0 || result == -ENOBUFS)
+        {
+            // ran out of buffers. They have been given back by now, so just receive again.
+            SPDLOG_DEBUG("[uring] [token={}] Re-arming receive. result={}", token, result);
+            arm_receive(token, iter->second.first);
+            continue;
+        }
+        receiver = iter->second.second;
+        _receivers.erase(iter);
+        if (result != -ECANCELED)
+            receiver->on_uring_error(-result);
+    }
+
+    start_wait_completion();
+}
+}  // namespace vNerve::bilibili
+
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef VNERVE_IO_URING
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include <boost/asio.hpp>
+
+// liburing.h 会引入 <linux/fs.h>，其中的宏与其他头文件冲突，只在 uring_context.cpp 中包含。
+struct io_uring;
+struct io_uring_buf_ring;
+struct io_uring_sqe;
+#endif
+
+namespace vNerve::bilibili
+{
+///
+/// 接收 uring_context 中 multishot 接收的结果。
+class uring_receiver
+{
+public:
+    virtual ~uring_receiver() = default;
+    ///
+    /// 收到一段数据。data + size 之后至少还有 json_padding 个可写的字节；返回后缓冲区立即被放回缓冲区环，不能再访问。
+    virtual void on_uring_receive(unsigned char* data, size_t size) = 0;
+    ///
+    /// 对端关闭（err 为 0）或接收、发送出错（err 为 errno）。之后不会再收到数据。
+    virtual void on_uring_error(int err) = 0;
+};
+
+#ifdef VNERVE_IO_URING
+///
+/// 一个分片的 io_uring。
+/// 每个连接只提交一次 multishot 接收，数据由内核直接写入共用的缓冲区环（provided buffer ring），
+/// 不再需要每次读取之前等待可读、每个连接各自的读缓冲区。发送（心跳）先排队，
+/// 本轮事件处理结束时与新的接收一起用一次 io_uring_enter 提交。
+/// 完成事件通过 eventfd 通知分片的 io_context，所有回调都在分片的线程上执行。不加锁。
+class uring_context
+{
+private:
+    boost::asio::io_context& _context;
+    std::unique_ptr<io_uring> _ring;
+    io_uring_buf_ring* _buffer_ring = nullptr;
+    std::unique_ptr<unsigned char[]> _buffers;
+    size_t _buffer_size;
+    size_t _buffer_stride;
+    unsigned _buffer_count;
+
+    boost::asio::posix::stream_descriptor _event;
+    uint64_t _event_value = 0;
+
+    std::unordered_map<uint64_t, std::pair<int, uring_receiver*>> _receivers;
+    uint64_t _next_token = 1;
+    bool _submit_posted = false;
+
+    io_uring_sqe* get_sqe();
+    void arm_receive(uint64_t token, int fd);
+    void submit_soon();
+    void submit();
+    void start_wait_completion();
+    void on_completion(const boost::system::error_code& err);
+    void recycle_buffer(unsigned buffer_id);
+
+public:
+    ///
+    /// @param buffer_size 每个接收缓冲区的大小
+    /// @param buffer_count 接收缓冲区的个数，向上取整到 2 的幂
+    /// @throw std::system_error 内核不支持 io_uring、multishot 接收或缓冲区环时抛出。
+    uring_context(boost::asio::io_context& context, unsigned entries, size_t buffer_size, unsigned buffer_count);
+    ~uring_context();
+
+    uring_context(const uring_context& other) = delete;
+    uring_context& operator=(const uring_context& other) = delete;
+
+    ///
+    /// 开始在 fd 上接收，直到 stop_receive 或出错。
+    /// @return 标识本次接收的 token。
+    uint64_t start_receive(int fd, uring_receiver* receiver);
+    ///
+    /// 接收者搬到了新的地址。
+    void rebind(uint64_t token, uring_receiver* receiver);
+    ///
+    /// 取消接收。之后不会再回调 receiver。
+    /// 会立即提交已排队的操作，调用者随后可以安全地关闭 fd。
+    void stop_receive(uint64_t token);
+    ///
+    /// 排队发送 [data, data + size)，在本轮事件处理结束时提交。data 在发送完成前必须有效。
+    /// 发送失败时回调 token 对应的 receiver。
+    void send(uint64_t token, const void* data, size_t size);
+};
+#else
+class uring_context;
+#endif
+}  // namespace vNerve::bilibili
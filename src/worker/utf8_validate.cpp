@@ -0,0 +1,238 @@
+#include "utf8_validate.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VNERVE_UTF8_SSSE3
+#include <tmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// 不要求整个程序用 -mssse3 编译，只在这几个函数上启用 SSSE3，运行时检查处理器后再调用。
+#if defined(VNERVE_UTF8_SSSE3) && defined(__GNUC__)
+#define UTF8_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define UTF8_TARGET_SSSE3
+#endif
+
+namespace vNerve::bilibili
+{
+namespace
+{
+bool validate_scalar(const unsigned char* data, const size_t length)
+{
+    static const uint32_t min_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+    size_t i = 0;
+    while (i < length)
+    {
+        if (length - i >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            if (!(word & 0x8080808080808080ull))
+            {
+                i += 8;  // 8 个 ASCII 字符。
+                continue;
+            }
+        }
+        auto byte = data[i];
+        if (byte < 0x80)
+        {
+            i++;
+            continue;
+        }
+        size_t size;
+        uint32_t code_point;
+        if ((byte & 0xE0) == 0xC0)
+        {
+            size = 2;
+            code_point = byte & 0x1F;
+        }
+        else if ((byte & 0xF0) == 0xE0)
+        {
+            size = 3;
+            code_point = byte & 0x0F;
+        }
+        else if ((byte & 0xF8) == 0xF0)
+        {
+            size = 4;
+            code_point = byte & 0x07;
+        }
+        else
+            return false;
+        if (length - i < size)
+            return false;
+        for (size_t j = 1; j < size; j++)
+        {
+            if ((data[i + j] & 0xC0) != 0x80)
+                return false;
+            code_point = code_point << 6 | (data[i + j] & 0x3F);
+        }
+        if (code_point < min_code_point[size] || code_point > 0x10FFFF
+            || (code_point >= 0xD800 && code_point <= 0xDFFF))
+            return false;
+        i += size;
+    }
+    return true;
+}
+
+#if defined(VNERVE_UTF8_SSSE3)
+// 查表法（Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"）：
+// 用前一个字节的高低半字节与当前字节的高半字节查三张表，三者相与后非零即为错误；
+// 多字节序列的第三、四个字节是否为续字节另行检查。
+const uint8_t TOO_SHORT = 1 << 0;       // 11______ 0_______ / 11______ 11______
+const uint8_t TOO_LONG = 1 << 1;        // 0_______ 10______
+const uint8_t OVERLONG_3 = 1 << 2;      // 11100000 100_____
+const uint8_t TOO_LARGE = 1 << 3;       // 11110100 1001____ / 11110100 101_____ / 11110101+ ________
+const uint8_t SURROGATE = 1 << 4;       // 11101101 101_____
+const uint8_t OVERLONG_2 = 1 << 5;      // 1100000_ 10______
+const uint8_t TOO_LARGE_1000 = 1 << 6;  // 11110101+ 1000____
+const uint8_t OVERLONG_4 = 1 << 6;      // 11110000 1000____
+const uint8_t TWO_CONTS = 1 << 7;       // 10______ 10______
+const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+UTF8_TARGET_SSSE3 inline __m128i high_nibbles(const __m128i input)
+{
+    return _mm_and_si128(_mm_srli_epi16(input, 4), _mm_set1_epi8(0x0F));
+}
+
+UTF8_TARGET_SSSE3 inline __m128i check_special_cases(const __m128i input, const __m128i prev1)
+{
+    const auto byte_1_high_table = _mm_setr_epi8(
+        // 0_______ ________
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        // 10______ ________
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        // 1100____ ________
+        TOO_SHORT | OVERLONG_2,
+        // 1101____ ________
+        TOO_SHORT,
+        // 1110____ ________
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        // 1111____ ________
+        static_cast<char>(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+    const auto byte_1_low_table = _mm_setr_epi8(
+        // ____0000 ________
+        static_cast<char>(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+        // ____0001 ________
+        static_cast<char>(CARRY | OVERLONG_2),
+        // ____001_ ________
+        static_cast<char>(CARRY), static_cast<char>(CARRY),
+        // ____0100 ________
+        static_cast<char>(CARRY | TOO_LARGE),
+        // ____0101 ________ 及以上
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        // ____1101 ________
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000),
+        static_cast<char>(CARRY | TOO_LARGE | TOO_LARGE_1000));
+    const auto byte_2_high_table = _mm_setr_epi8(
+        // ________ 0_______
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        // ________ 1000____
+        static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+        // ________ 1001____
+        static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+        // ________ 101_____
+        static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        static_cast<char>(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+        // ________ 11______
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+    auto byte_1_high = _mm_shuffle_epi8(byte_1_high_table, high_nibbles(prev1));
+    auto byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+    auto byte_2_high = _mm_shuffle_epi8(byte_2_high_table, high_nibbles(input));
+    return _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+}
+
+UTF8_TARGET_SSSE3 inline __m128i check_block(const __m128i input, const __m128i prev_input)
+{
+    auto special_cases = check_special_cases(input, _mm_alignr_epi8(input, prev_input, 15));
+    // 前两个字节为 111_____ 或前三个字节为 1111____ 时，当前字节必须是续字节。
+    auto is_third_byte = _mm_subs_epu8(_mm_alignr_epi8(input, prev_input, 14), _mm_set1_epi8(0xE0 - 0x80));
+    auto is_fourth_byte = _mm_subs_epu8(_mm_alignr_epi8(input, prev_input, 13), _mm_set1_epi8(0xF0 - 0x80));
+    auto must_be_continuation = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte),
+                                              _mm_set1_epi8(static_cast<char>(0x80)));
+    return _mm_xor_si128(must_be_continuation, special_cases);
+}
+
+///
+/// 块的末尾是否有未结束的多字节序列。
+UTF8_TARGET_SSSE3 inline __m128i is_incomplete(const __m128i input)
+{
+    const auto max_value = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    return _mm_subs_epu8(input, max_value);
+}
+
+UTF8_TARGET_SSSE3 inline void check_input(const __m128i input, __m128i& prev_input, __m128i& prev_incomplete,
+                                          __m128i& error)
+{
+    if (_mm_movemask_epi8(input) == 0)
+        error = _mm_or_si128(error, prev_incomplete);  // 纯 ASCII 的块，只需确认上一块的序列已经结束。
+    else
+    {
+        error = _mm_or_si128(error, check_block(input, prev_input));
+        prev_incomplete = is_incomplete(input);
+    }
+    prev_input = input;
+}
+
+UTF8_TARGET_SSSE3 bool is_valid_utf8_ssse3(const unsigned char* data, const size_t length)
+{
+    auto error = _mm_setzero_si128();
+    auto prev_input = _mm_setzero_si128();
+    auto prev_incomplete = _mm_setzero_si128();
+    size_t i = 0;
+    for (; length - i >= 16; i += 16)
+        check_input(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), prev_input, prev_incomplete, error);
+    if (i < length)
+    {
+        unsigned char tail[16] = {};
+        std::memcpy(tail, data + i, length - i);
+        check_input(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)), prev_input, prev_incomplete, error);
+    }
+    error = _mm_or_si128(error, prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+bool has_ssse3()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+#endif
+}  // namespace
+
+bool is_valid_utf8(const char* data, const size_t length)
+{
+    auto bytes = reinterpret_cast<const unsigned char*>(data);
+#if defined(VNERVE_UTF8_SSSE3)
+    static const bool ssse3 = has_ssse3();
+    if (ssse3)
+        return is_valid_utf8_ssse3(bytes, length);
+#endif
+    return validate_scalar(bytes, length);
+}
+
+bool is_valid_utf8_scalar(const char* data, const size_t length)
+{
+    return validate_scalar(reinterpret_cast<const unsigned char*>(data), length);
+}
+}  // namespace vNerve::bilibili
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vNerve::bilibili
+{
+///
+/// 检查 [data, data + length) 是否为合法的 UTF-8（不允许超长编码、代理项与超过 U+10FFFF 的码点）。
+/// 支持 SSSE3 的处理器上每次检查 16 个字节，纯 ASCII 的块只需一次比较；其他处理器逐字节检查。
+bool is_valid_utf8(const char* data, size_t length);
+///
+/// 与 is_valid_utf8 相同，但总是逐字节检查。供基准测试对比。
+bool is_valid_utf8_scalar(const char* data, size_t length);
+}  // namespace vNerve::bilibili
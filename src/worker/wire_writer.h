@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+namespace vNerve::bilibili
+{
+///
+/// 直接写 protobuf 线格式的缓冲区，不经过消息对象。
+/// 按 proto3 的规则省略默认值；嵌套消息先预留长度，写完内容后回填。
+/// 字段号应使用生成代码中的 kXxxFieldNumber，字段类型由 check_message_schema() 在启动时核对。
+/// 字段号为 0 的标量字段不写出，供启动时按名字查找、可能不存在的字段使用。
+/// 数据先写入调用者提供的初始内存块，放不下时才改用堆内存，reset() 时归还，因此常驻内存不会增长。
+class wire_writer
+{
+private:
+    enum wire_type : uint32_t
+    {
+        wire_varint = 0,
+        wire_length_delimited = 2
+    };
+
+    // 嵌套消息的长度预留两个字节，能容纳 16383 字节以内的内容，更长时才需要搬动数据。
+    static const size_t reserved_length_size = 2;
+    static const size_t max_reserved_length = (1u << 14) - 1;
+    static const size_t max_varint_size = 10;
+
+    unsigned char* _initial_block;
+    size_t _initial_size;
+    std::unique_ptr<unsigned char[]> _overflow;
+    unsigned char* _buffer;
+    size_t _capacity;
+    size_t _size = 0;
+    size_t _high_water = 0;
+
+    void reserve(const size_t size)
+    {
+        if (_size + size <= _capacity)
+            return;
+        auto new_capacity = _capacity * 2;
+        while (new_capacity < _size + size)
+            new_capacity *= 2;
+        auto new_buffer = std::unique_ptr<unsigned char[]>(new unsigned char[new_capacity]);
+        std::memcpy(new_buffer.get(), _buffer, _size);
+        _overflow = std::move(new_buffer);
+        _buffer = _overflow.get();
+        _capacity = new_capacity;
+    }
+
+    static size_t varint_size(uint64_t value)
+    {
+        size_t size = 1;
+        while (value >= 0x80)
+        {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    void put_varint(uint64_t value)
+    {
+        auto ptr = _buffer + _size;
+        while (value >= 0x80)
+        {
+            *ptr++ = static_cast<unsigned char>(value | 0x80);
+            value >>= 7;
+        }
+        *ptr++ = static_cast<unsigned char>(value);
+        _size = ptr - _buffer;
+    }
+
+    void put_tag(const int field, const wire_type type)
+    {
+        put_varint((static_cast<uint64_t>(field) << 3) | type);
+    }
+
+public:
+    ///
+    /// @param initial_block 初始内存块，由调用者持有，生命周期不短于本对象。
+    wire_writer(unsigned char* initial_block, const size_t size)
+        : _initial_block(initial_block),
+          _initial_size(size),
+          _buffer(initial_block),
+          _capacity(size)
+    {
+    }
+
+    wire_writer(const wire_writer& other) = delete;
+    wire_writer& operator=(const wire_writer& other) = delete;
+
+    [[nodiscard]] const unsigned char* data() const { return _buffer; }
+    [[nodiscard]] size_t size() const { return _size; }
+    ///
+    /// 曾经写出的最大字节数。
+    [[nodiscard]] size_t high_water() const { return _high_water; }
+
+    ///
+    /// 丢弃已写入的数据，准备写下一条消息。超出初始内存块时申请的堆内存在这里释放。
+    /// @return 是否创下新的最大值。
+    bool reset()
+    {
+        auto peak = _size > _high_water;
+        if (peak)
+            _high_water = _size;
+        _size = 0;
+        if (_overflow)
+        {
+            _overflow.reset();
+            _buffer = _initial_block;
+            _capacity = _initial_size;
+        }
+        return peak;
+    }
+
+    ///
+    /// 丢弃 size 之后写入的数据，用于撤销写了一半的消息。
+    void truncate(const size_t size)
+    {
+        if (size < _size)
+            _size = size;
+    }
+
+    ///
+    /// 写入 varint 字段（整数、bool 与枚举）。值为 0 时省略。
+    void varint(const int field, const uint64_t value)
+    {
+        if (!value || !field)
+            return;
+        reserve(max_varint_size * 2);
+        put_tag(field, wire_varint);
+        put_varint(value);
+    }
+
+    void boolean(const int field, const bool value) { varint(field, value ? 1 : 0); }
+
+    ///
+    /// 写入字符串字段。空字符串省略。
+    void string(const int field, const std::string_view value)
+    {
+        if (value.empty() || !field)
+            return;
+        reserve(max_varint_size * 2 + value.size());
+        put_tag(field, wire_length_delimited);
+        put_varint(value.size());
+        std::memcpy(_buffer + _size, value.data(), value.size());
+        _size += value.size();
+    }
+
+    ///
+    /// 开始写一个嵌套消息。消息字段即使为空也会写出，与 set_allocated_xxx 的效果相同。
+    /// @return 交给 end() 的位置。
+    [[nodiscard]] size_t begin(const int field)
+    {
+        reserve(max_varint_size + reserved_length_size);
+        put_tag(field, wire_length_delimited);
+        auto mark = _size;
+        _size += reserved_length_size;
+        return mark;
+    }
+
+    ///
+    /// 结束嵌套消息，回填长度。
+    void end(const size_t mark)
+    {
+        auto content = mark + reserved_length_size;
+        auto length = _size - content;
+        auto ptr = _buffer + mark;
+        if (length <= max_reserved_length)
+        {
+            // 补齐的 varint：低 7 位带续位，高 7 位可以为 0，解析器照常接受。
+            ptr[0] = static_cast<unsigned char>(length | 0x80);
+            ptr[1] = static_cast<unsigned char>(length >> 7);
+            return;
+        }
+        auto extra = varint_size(length) - reserved_length_size;
+        reserve(extra);
+        ptr = _buffer + mark;
+        std::memmove(ptr + reserved_length_size + extra, ptr + reserved_length_size, length);
+        _size = mark;
+        put_varint(length);
+        _size += length;
+    }
+};
+}  // namespace vNerve::bilibili